@@ -0,0 +1,125 @@
+#!/usr/bin/env python
+
+# Compare an event catalog against a reference catalog, for example to validate
+# a run with single precision Greens matrices (sim.greens.storage = float)
+# against the same model run in double precision. Exact event-by-event agreement
+# is not expected once the runs diverge, so the report focuses on catalog statistics.
+
+from __future__ import print_function
+
+import math
+import sys
+import argparse
+
+def read_events(event_file):
+    """Return a list of (year, trigger, magnitude) tuples from a text or HDF5 event file."""
+    events = []
+    if event_file.endswith(".h5"):
+        import h5py
+        with h5py.File(event_file, "r") as data_file:
+            for event in data_file["events"]:
+                events.append((float(event["event_year"]), int(event["event_trigger"]), float(event["event_magnitude"])))
+    else:
+        with open(event_file, "r") as data_file:
+            for line in data_file:
+                if line.startswith("#") or not line.strip(): continue
+                vals = line.split()
+                # Skip records that were only partially written
+                if len(vals) < 10: continue
+                events.append((float(vals[1]), int(vals[2]), float(vals[3])))
+    return events
+
+def mean(vals):
+    return sum(vals)/len(vals) if len(vals) > 0 else float("nan")
+
+def mean_interevent(events):
+    if len(events) < 2: return float("nan")
+    return (events[-1][0]-events[0][0])/(len(events)-1)
+
+def total_moment(events):
+    # Inverse of the magnitude definition used by the simulation, M = (2/3)*log10(M0) - 6
+    return sum(10**(1.5*(event[2]+6.0)) for event in events if not math.isnan(event[2]))
+
+def ks_statistic(a, b):
+    """Two sample Kolmogorov-Smirnov statistic."""
+    a = sorted(a)
+    b = sorted(b)
+    i = j = 0
+    d = 0.0
+    while i < len(a) and j < len(b):
+        # Step past all tied values before comparing the empirical CDFs
+        x = min(a[i], b[j])
+        while i < len(a) and a[i] <= x: i += 1
+        while j < len(b) and b[j] <= x: j += 1
+        d = max(d, abs(float(i)/len(a) - float(j)/len(b)))
+    return d
+
+def matching_prefix(ref_events, test_events, year_tol, mag_tol):
+    """Number of leading events that agree before the catalogs diverge."""
+    n = 0
+    for ref, test in zip(ref_events, test_events):
+        if ref[1] != test[1] or abs(ref[0]-test[0]) > year_tol or abs(ref[2]-test[2]) > mag_tol: break
+        n += 1
+    return n
+
+def rel_diff(ref, test):
+    if ref == 0: return abs(test)
+    return abs(test-ref)/abs(ref)
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Compare an event catalog against a reference catalog.")
+    parser.add_argument('--reference', required=True,
+            help="Reference event file (e.g. from a double precision run).")
+    parser.add_argument('--events', required=True,
+            help="Event file to validate.")
+    parser.add_argument('--tolerance', type=float, default=0.05,
+            help="Maximum allowed relative difference in event count, mean magnitude, mean interevent time and total moment.")
+    parser.add_argument('--max_ks', type=float, default=0.1,
+            help="Maximum allowed KS statistic between the magnitude distributions.")
+    args = parser.parse_args()
+
+    ref_events = read_events(args.reference)
+    test_events = read_events(args.events)
+
+    if len(ref_events) == 0 or len(test_events) == 0:
+        print("ERROR: empty event catalog")
+        exit(1)
+
+    ref_mags = [event[2] for event in ref_events]
+    test_mags = [event[2] for event in test_events]
+
+    # Restrict both catalogs to the common time span so truncated runs can be compared
+    end_year = min(ref_events[-1][0], test_events[-1][0])
+    ref_span = [event for event in ref_events if event[0] <= end_year]
+    test_span = [event for event in test_events if event[0] <= end_year]
+
+    checks = [
+        ("Number of events", float(len(ref_span)), float(len(test_span))),
+        ("Mean magnitude", mean(ref_mags), mean(test_mags)),
+        ("Max magnitude", max(ref_mags), max(test_mags)),
+        ("Mean interevent time (years)", mean_interevent(ref_span), mean_interevent(test_span)),
+        ("Total moment (N m)", total_moment(ref_span), total_moment(test_span)),
+        ]
+
+    err = False
+    print("Comparing", args.events, "against", args.reference, "up to year", end_year)
+    print("{:<32}{:>16}{:>16}{:>12}".format("", "reference", "test", "rel diff"))
+    for name, ref_val, test_val in checks:
+        diff = rel_diff(ref_val, test_val)
+        flag = ""
+        # Max magnitude is reported but not checked, it's dominated by single events
+        if name != "Max magnitude" and diff > args.tolerance:
+            flag = " *"
+            err = True
+        print("{:<32}{:>16.6g}{:>16.6g}{:>12.4g}{}".format(name, ref_val, test_val, diff, flag))
+
+    ks = ks_statistic(ref_mags, test_mags)
+    if ks > args.max_ks: err = True
+    print("{:<32}{:>44.4g}{}".format("Magnitude KS statistic", ks, " *" if ks > args.max_ks else ""))
+
+    prefix = matching_prefix(ref_events, test_events, 1e-3, 1e-3)
+    print("{:<32}{:>44}".format("Identical leading events", prefix))
+
+    if err:
+        print("ERROR: catalogs differ by more than the allowed tolerance (marked with *)")
+        exit(1)
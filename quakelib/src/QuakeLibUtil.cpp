@@ -20,6 +20,10 @@
 
 #include "QuakeLibUtil.h"
 
+#include <algorithm>
+#include <limits>
+#include <stdint.h>
+
 std::string quakelib::SetupInfo(void) {
     std::stringstream       ss;
 
@@ -282,11 +286,12 @@ void quakelib::Conversion::dist_vincenty(double &distance, double &start_azimuth
 }
 
 template <class CELL_TYPE>
-quakelib::DenseStd<CELL_TYPE>::DenseStd(const unsigned int &ncols, const unsigned int &nrows) : DenseMatrix<CELL_TYPE>(ncols, nrows) {
+quakelib::DenseStd<CELL_TYPE>::DenseStd(const unsigned int &ncols, const unsigned int &nrows, const bool &init_vals) : DenseMatrix<CELL_TYPE>(ncols, nrows) {
     _data = (CELL_TYPE *)valloc(sizeof(CELL_TYPE)*ncols*nrows);
 
     //assertThrow(_data, "Not enough memory to allocate matrix.");
-    for (unsigned int i=0; i<ncols*nrows; ++i) _data[i] = 0;
+    // Otherwise the pages are not touched until clearRows() is called
+    if (init_vals) for (unsigned int i=0; i<ncols*nrows; ++i) _data[i] = 0;
 }
 
 template <class CELL_TYPE>
@@ -379,6 +384,22 @@ unsigned int quakelib::CompressedRow<CELL_TYPE>::getRowLen(void) {
     return uncompressed_len;
 }
 
+template <class CELL_TYPE>
+void quakelib::DenseStdStraight<CELL_TYPE>::clearRows(const unsigned int &first, const unsigned int &last) {
+    unsigned long   i;
+
+    for (i=(unsigned long)first*this->_ncols; i<(unsigned long)last*this->_ncols; ++i) this->_data[i] = 0;
+}
+
+template <class CELL_TYPE>
+void quakelib::DenseStdTranspose<CELL_TYPE>::clearRows(const unsigned int &first, const unsigned int &last) {
+    unsigned int    row, col;
+
+    for (col=0; col<this->_ncols; ++col) {
+        for (row=first; row<last; ++row) this->_data[col*this->_nrows+row] = 0;
+    }
+}
+
 template <class CELL_TYPE>
 CELL_TYPE quakelib::DenseStdTranspose<CELL_TYPE>::val(const unsigned int &row, const unsigned int &col) const {
     return this->_data[col*this->_nrows+row];
@@ -503,7 +524,7 @@ bool quakelib::CompressedRow<CELL_TYPE>::decompressRow(void) {
     copyRowContents(raw_data);
 
     // Delete the old compressed data
-    delete runs;
+    free(runs);
     runs = NULL;
     compressed = false;
     data_dim = new_data_dim;
@@ -535,7 +556,7 @@ bool quakelib::CompressedRow<CELL_TYPE>::compressRow(const float &ratio) {
     }
 
     // Compression ratio is new_size/old_size
-    compress_ratio = (num_runs*sizeof(RowRun<CELL_TYPE>))/(data_dim*sizeof(CELL_TYPE));
+    compress_ratio = double(num_runs*sizeof(RowRun<CELL_TYPE>))/(data_dim*sizeof(CELL_TYPE));
 
     // If we achieve an acceptable compression ratio for this row, compress it
     if (compress_ratio <= ratio) {
@@ -544,19 +565,22 @@ bool quakelib::CompressedRow<CELL_TYPE>::compressRow(const float &ratio) {
         last_val = raw_data[0];
         run_start = 0;
 
-        for (i=1; i<data_dim; ++i) {
-            if (raw_data[i] != last_val || i == data_dim-1) {
+        // The runs must cover the whole row, including the final run
+        for (i=1; i<=data_dim; ++i) {
+            if (i == data_dim || raw_data[i] != last_val) {
                 runs[cur_run]._val = last_val;
                 runs[cur_run]._length = i-run_start;
                 cur_run++;
-                last_val = raw_data[i];
+
+                if (i < data_dim) last_val = raw_data[i];
+
                 run_start = i;
             }
         }
 
         data_dim = num_runs;
         compressed = true;
-        delete raw_data;
+        free(raw_data);
         raw_data = NULL;
     }
 
@@ -578,6 +602,201 @@ void quakelib::CompressedRow<CELL_TYPE>::copyRowContents(CELL_TYPE *dest) const
     }
 }
 
+template <class CELL_TYPE>
+quakelib::SparseRowMatrix<CELL_TYPE>::SparseRowMatrix(const unsigned int &ncols, const unsigned int &nrows, const bool &transposed, const unsigned long &num_nonzero) : DenseMatrix<CELL_TYPE>(ncols, nrows), _transpose(transposed) {
+    _row_starts.reserve(nrows+1);
+    _row_starts.push_back(0);
+    _cols.reserve(num_nonzero);
+    _vals.reserve(num_nonzero);
+}
+
+template <class CELL_TYPE>
+void quakelib::SparseRowMatrix<CELL_TYPE>::setRow(const unsigned int &row, const CELL_TYPE *dense_vals) {
+    unsigned int    i;
+
+    assertThrow(row == _row_starts.size()-1 && row < this->_nrows, "Sparse matrix rows must be set in order.");
+
+    for (i=0; i<this->_ncols; ++i) {
+        if (dense_vals[i] != 0) {
+            _cols.push_back(i);
+            _vals.push_back(dense_vals[i]);
+        }
+    }
+
+    _row_starts.push_back(_vals.size());
+}
+
+// Index of the value at the given stored row and column, or -1 if it is zero
+template <class CELL_TYPE>
+int quakelib::SparseRowMatrix<CELL_TYPE>::find(const unsigned int &row, const unsigned int &col) const {
+    std::vector<unsigned int>::const_iterator   first, last, it;
+
+    if (row+1 >= _row_starts.size()) return -1;
+
+    first = _cols.begin()+_row_starts[row];
+    last = _cols.begin()+_row_starts[row+1];
+    it = std::lower_bound(first, last, col);
+
+    if (it == last || *it != col) return -1;
+
+    return it-_cols.begin();
+}
+
+template <class CELL_TYPE>
+CELL_TYPE quakelib::SparseRowMatrix<CELL_TYPE>::val(const unsigned int &row, const unsigned int &col) const {
+    int     ind = (_transpose ? find(col, row) : find(row, col));
+
+    return (ind < 0 ? 0 : _vals[ind]);
+}
+
+template <class CELL_TYPE>
+void quakelib::SparseRowMatrix<CELL_TYPE>::setVal(const unsigned int &row, const unsigned int &col, const CELL_TYPE &new_val) {
+    int     ind = (_transpose ? find(col, row) : find(row, col));
+
+    if (ind >= 0) _vals[ind] = new_val;
+    else assertThrow(new_val == 0, "Cannot add a nonzero value to a sparse matrix.");
+}
+
+template <class CELL_TYPE>
+CELL_TYPE *quakelib::SparseRowMatrix<CELL_TYPE>::getRow(CELL_TYPE *buf, const unsigned int &row) const {
+    unsigned int    i;
+
+    assertThrow(!_transpose, "Not implemented.");
+
+    for (i=0; i<this->_ncols; ++i) buf[i] = 0;
+
+    for (i=_row_starts[row]; i<_row_starts[row+1]; ++i) buf[_cols[i]] = _vals[i];
+
+    return buf;
+}
+
+template <class CELL_TYPE>
+CELL_TYPE *quakelib::SparseRowMatrix<CELL_TYPE>::getCol(CELL_TYPE *buf, const unsigned int &col) const {
+    unsigned int    i;
+
+    assertThrow(_transpose, "Not implemented.");
+
+    for (i=0; i<this->_ncols; ++i) buf[i] = 0;
+
+    for (i=_row_starts[col]; i<_row_starts[col+1]; ++i) buf[_cols[i]] = _vals[i];
+
+    return buf;
+}
+
+template <class CELL_TYPE>
+unsigned long quakelib::SparseRowMatrix<CELL_TYPE>::mem_bytes(void) const {
+    return sizeof(unsigned int)*(_row_starts.capacity()+_cols.capacity()) + sizeof(CELL_TYPE)*_vals.capacity();
+}
+
+template <class CODE_TYPE>
+quakelib::QuantizedRowMatrix<CODE_TYPE>::QuantizedRowMatrix(const DenseMatrix<float> &src,
+                                                            const unsigned int &ncols,
+                                                            const unsigned int &nrows,
+                                                            const std::vector<unsigned int> &exact_cols) : DenseMatrix<double>(ncols, nrows), _transpose(src.transpose()) {
+    std::vector<float>  buf(ncols);
+    unsigned int        r;
+
+    _codes = (CODE_TYPE *)valloc(sizeof(CODE_TYPE)*ncols*nrows);
+    assertThrow(_codes, "Not enough memory to allocate quantized matrix.");
+
+    _scales.resize(nrows);
+    _offsets.resize(nrows);
+    _corrections.assign(nrows, 0);
+    _exact_pos.assign(nrows, -1);
+
+    // Find where the full precision value is in each stored row
+    for (r=0; r<exact_cols.size(); ++r) {
+        if (_transpose) {
+            if (exact_cols[r] < nrows) _exact_pos[exact_cols[r]] = r;
+        } else if (r < nrows && exact_cols[r] < ncols) {
+            _exact_pos[r] = exact_cols[r];
+        }
+    }
+
+    for (r=0; r<nrows; ++r) quantizeRow(r, (_transpose ? src.getCol(&buf[0], r) : src.getRow(&buf[0], r)));
+}
+
+template <class CODE_TYPE>
+quakelib::QuantizedRowMatrix<CODE_TYPE>::~QuantizedRowMatrix(void) {
+    if (_codes) free(_codes);
+
+    _codes = NULL;
+}
+
+/*
+ The scale and offset map the range of the row onto the symmetric code range. The full
+ precision value is left out of the range, since self interactions are often much larger
+ than the rest of the row and would otherwise make the other codes much coarser.
+ */
+template <class CODE_TYPE>
+void quakelib::QuantizedRowMatrix<CODE_TYPE>::quantizeRow(const unsigned int &row, const float *vals) {
+    const double    max_code = std::numeric_limits<CODE_TYPE>::max();
+    CODE_TYPE       *codes = &_codes[(unsigned long)row*this->_ncols];
+    double          min_val, max_val, code;
+    unsigned int    i;
+    int             exact = _exact_pos[row];
+
+    min_val = DBL_MAX;
+    max_val = -DBL_MAX;
+
+    for (i=0; i<this->_ncols; ++i) {
+        if ((int)i == exact) continue;
+
+        min_val = fmin(min_val, vals[i]);
+        max_val = fmax(max_val, vals[i]);
+    }
+
+    if (min_val > max_val) min_val = max_val = 0;
+
+    _offsets[row] = 0.5*(max_val+min_val);
+    _scales[row] = 0.5*(max_val-min_val)/max_code;
+
+    for (i=0; i<this->_ncols; ++i) {
+        code = (_scales[row] > 0 ? round((vals[i]-_offsets[row])/_scales[row]) : 0);
+        codes[i] = (CODE_TYPE)fmax(-max_code, fmin(max_code, code));
+    }
+
+    if (exact >= 0) _corrections[row] = vals[exact] - (_offsets[row]+_scales[row]*codes[exact]);
+}
+
+template <class CODE_TYPE>
+double quakelib::QuantizedRowMatrix<CODE_TYPE>::val(const unsigned int &row, const unsigned int &col) const {
+    unsigned int    r = (_transpose ? col : row), c = (_transpose ? row : col);
+    double          v = _offsets[r]+_scales[r]*_codes[(unsigned long)r*this->_ncols+c];
+
+    if ((int)c == _exact_pos[r]) v += _corrections[r];
+
+    return v;
+}
+
+template <class CODE_TYPE>
+void quakelib::QuantizedRowMatrix<CODE_TYPE>::setVal(const unsigned int &row, const unsigned int &col, const double &new_val) {
+    assertThrow(false, "Cannot change the values of a quantized matrix.");
+}
+
+template <class CODE_TYPE>
+double *quakelib::QuantizedRowMatrix<CODE_TYPE>::getRow(double *buf, const unsigned int &row) const {
+    assertThrow(!_transpose, "Not implemented.");
+
+    for (unsigned int i=0; i<this->_ncols; ++i) buf[i] = val(row, i);
+
+    return buf;
+}
+
+template <class CODE_TYPE>
+double *quakelib::QuantizedRowMatrix<CODE_TYPE>::getCol(double *buf, const unsigned int &col) const {
+    assertThrow(_transpose, "Not implemented.");
+
+    for (unsigned int i=0; i<this->_ncols; ++i) buf[i] = val(i, col);
+
+    return buf;
+}
+
+template <class CODE_TYPE>
+unsigned long quakelib::QuantizedRowMatrix<CODE_TYPE>::mem_bytes(void) const {
+    return sizeof(CODE_TYPE)*this->_ncols*this->_nrows + (3*sizeof(double)+sizeof(int))*this->_nrows;
+}
+
 template <unsigned int dim>
 double quakelib::RectBound<dim>::max_length() const {
     double          max_len;
@@ -881,12 +1100,523 @@ unsigned long quakelib::Octree<dim>::mem_bytes(void) const {
     return total;
 }
 
+template <class CELL_TYPE>
+void quakelib::HFullMatrix<CELL_TYPE>::multiply_accum(double *y, const double *x) const {
+    unsigned int    i, j;
+    double          val;
+
+    for (i=0; i<this->_rows; ++i) {
+        const CELL_TYPE *row = &_vals[i*this->_cols];
+        val = 0;
+
+        for (j=0; j<this->_cols; ++j) val += row[j]*x[j];
+
+        y[i] += val;
+    }
+}
+
+template <class CELL_TYPE>
+quakelib::HLowRankMatrix<CELL_TYPE>::HLowRankMatrix(unsigned int nrows, unsigned int ncols, unsigned int rank, const double *u, const double *v) : HierarchicalMatrix<CELL_TYPE>(nrows, ncols), _rank(rank), _u(NULL), _v(NULL) {
+    unsigned int    i;
+
+    if (_rank == 0) return;
+
+    _u = (CELL_TYPE *)malloc(sizeof(CELL_TYPE)*_rank*this->_rows);
+    _v = (CELL_TYPE *)malloc(sizeof(CELL_TYPE)*_rank*this->_cols);
+    assertThrow(_u && _v, "Not enough memory to allocate low rank block.");
+
+    for (i=0; i<_rank*this->_rows; ++i) _u[i] = u[i];
+
+    for (i=0; i<_rank*this->_cols; ++i) _v[i] = v[i];
+}
+
+template <class CELL_TYPE>
+CELL_TYPE quakelib::HLowRankMatrix<CELL_TYPE>::get(unsigned int row, unsigned int col) const {
+    unsigned int    k;
+    double          val = 0;
+
+    assertThrow(row < this->_rows, "Out of bounds");
+    assertThrow(col < this->_cols, "Out of bounds");
+
+    for (k=0; k<_rank; ++k) val += (double)_u[k*this->_rows+row]*_v[k*this->_cols+col];
+
+    return val;
+}
+
+template <class CELL_TYPE>
+void quakelib::HLowRankMatrix<CELL_TYPE>::multiply_accum(double *y, const double *x) const {
+    unsigned int    i, j, k;
+    double          t;
+
+    for (k=0; k<_rank; ++k) {
+        const CELL_TYPE *u = &_u[k*this->_rows], *v = &_v[k*this->_cols];
+
+        t = 0;
+
+        for (j=0; j<this->_cols; ++j) t += v[j]*x[j];
+
+        if (t == 0) continue;
+
+        for (i=0; i<this->_rows; ++i) y[i] += u[i]*t;
+    }
+}
+
+// Orders indices by one coordinate of their points, used to split clusters at the median
+struct PointCoordCompare {
+    const std::vector<quakelib::Vec<3> >    &_pts;
+    unsigned int                            _dim;
+
+    PointCoordCompare(const std::vector<quakelib::Vec<3> > &pts, const unsigned int &dim) : _pts(pts), _dim(dim) {};
+    bool operator()(const unsigned int &a, const unsigned int &b) const {
+        return _pts[a][_dim] < _pts[b][_dim];
+    };
+};
+
+// Diameter of the bound
+static double bound_diameter(const quakelib::RectBound<3> &bound) {
+    return (bound.max_bound()-bound.min_bound()).mag();
+}
+
+// Shortest distance between two bounds, 0 if they overlap
+static double bound_distance(const quakelib::RectBound<3> &a, const quakelib::RectBound<3> &b) {
+    double          gap, dist2 = 0;
+    unsigned int    i;
+
+    for (i=0; i<3; ++i) {
+        gap = fmax(a.min_bound()[i]-b.max_bound()[i], b.min_bound()[i]-a.max_bound()[i]);
+
+        if (gap > 0) dist2 += gap*gap;
+    }
+
+    return sqrt(dist2);
+}
+
+template <class CELL_TYPE>
+quakelib::HMatrix<CELL_TYPE>::~HMatrix(void) {
+    clear();
+}
+
+template <class CELL_TYPE>
+void quakelib::HMatrix<CELL_TYPE>::clear(void) {
+    for (unsigned int i=0; i<_blocks.size(); ++i) delete _blocks[i]._mat;
+
+    _row_clusters.clear();
+    _col_clusters.clear();
+    _row_perm.clear();
+    _col_perm.clear();
+    _row_pos.clear();
+    _col_pos.clear();
+    _blocks.clear();
+    _leaves.clear();
+}
+
+/*
+ Recursively split the elements in perm[begin, end) at the median of the
+ longest dimension of their bounding box, until clusters have at most
+ leaf_size elements. The bound of each cluster includes the element extents.
+ */
+template <class CELL_TYPE>
+int quakelib::HMatrix<CELL_TYPE>::build_clusters(std::vector<Cluster> &clusters,
+                                                  std::vector<unsigned int> &perm,
+                                                  const std::vector<Vec<3> > &pts,
+                                                  const std::vector<double> &radii,
+                                                  const unsigned int &begin,
+                                                  const unsigned int &end,
+                                                  const unsigned int &leaf_size) {
+    RectBound<3>    center_bound;
+    Vec<3>          extent, len;
+    unsigned int    i, split_dim, mid;
+    int             ind, child;
+
+    ind = clusters.size();
+    clusters.push_back(Cluster());
+    clusters[ind]._begin = begin;
+    clusters[ind]._end = end;
+    clusters[ind]._children[0] = clusters[ind]._children[1] = -1;
+
+    for (i=begin; i<end; ++i) {
+        extent = Vec<3>(radii[perm[i]], radii[perm[i]], radii[perm[i]]);
+        center_bound.extend_bound(pts[perm[i]]);
+        clusters[ind]._bound.extend_bound(pts[perm[i]]-extent);
+        clusters[ind]._bound.extend_bound(pts[perm[i]]+extent);
+    }
+
+    if (end-begin <= leaf_size) return ind;
+
+    len = center_bound.max_bound()-center_bound.min_bound();
+    split_dim = 0;
+
+    for (i=1; i<3; ++i) if (len[i] > len[split_dim]) split_dim = i;
+
+    mid = begin+(end-begin)/2;
+    std::nth_element(perm.begin()+begin, perm.begin()+mid, perm.begin()+end, PointCoordCompare(pts, split_dim));
+
+    child = build_clusters(clusters, perm, pts, radii, begin, mid, leaf_size);
+    clusters[ind]._children[0] = child;
+    child = build_clusters(clusters, perm, pts, radii, mid, end, leaf_size);
+    clusters[ind]._children[1] = child;
+
+    return ind;
+}
+
+/*
+ Recursively subdivide a pair of clusters. Admissible (well separated) pairs
+ become far-field leaves, pairs involving a leaf cluster become dense leaves.
+ The children of a block are stored contiguously.
+ */
+template <class CELL_TYPE>
+void quakelib::HMatrix<CELL_TYPE>::build_blocks(const unsigned int &node, const double &eta, const unsigned int &leaf_size) {
+    const Cluster   &rc = _row_clusters[_blocks[node]._row_cluster];
+    const Cluster   &cc = _col_clusters[_blocks[node]._col_cluster];
+    double          dist;
+    unsigned int    first, i, j;
+    int             row_children[2], col_children[2];
+
+    dist = bound_distance(rc._bound, cc._bound);
+
+    if (dist > 0 && fmin(bound_diameter(rc._bound), bound_diameter(cc._bound)) <= eta*dist) {
+        _blocks[node]._far_field = true;
+        _leaves.push_back(node);
+        return;
+    }
+
+    if (rc._children[0] < 0 || cc._children[0] < 0) {
+        _leaves.push_back(node);
+        return;
+    }
+
+    row_children[0] = rc._children[0];
+    row_children[1] = rc._children[1];
+    col_children[0] = cc._children[0];
+    col_children[1] = cc._children[1];
+
+    first = _blocks.size();
+    _blocks[node]._first_child = first;
+    _blocks[node]._num_children = 4;
+
+    for (i=0; i<2; ++i) {
+        for (j=0; j<2; ++j) {
+            BlockNode   child;
+            child._row_cluster = row_children[i];
+            child._col_cluster = col_children[j];
+            child._first_child = child._num_children = 0;
+            child._far_field = false;
+            child._mat = NULL;
+            _blocks.push_back(child);
+        }
+    }
+
+    for (i=0; i<4; ++i) build_blocks(first+i, eta, leaf_size);
+}
+
+template <class CELL_TYPE>
+quakelib::HierarchicalMatrix<CELL_TYPE> *quakelib::HMatrix<CELL_TYPE>::dense_block(const Cluster &rc, const Cluster &cc, HMatrixEntryGenerator *gen) const {
+    HFullMatrix<CELL_TYPE>  *block;
+    unsigned int            i, j;
+
+    block = new HFullMatrix<CELL_TYPE>(rc._end-rc._begin, cc._end-cc._begin);
+
+    for (i=rc._begin; i<rc._end; ++i) {
+        for (j=cc._begin; j<cc._end; ++j) {
+            block->set(i-rc._begin, j-cc._begin, gen->entry(_row_perm[i], _col_perm[j]));
+        }
+    }
+
+    return block;
+}
+
+/*
+ Approximate a far-field block by adaptive cross approximation with partial
+ pivoting. Each step takes the residual of one row and one column as the next
+ rank one term, until the last term is below tolerance times the Frobenius
+ norm of the approximation. If the block doesn't converge at a rank where
+ the low rank form is still smaller than the dense one, it is stored densely.
+ */
+template <class CELL_TYPE>
+quakelib::HierarchicalMatrix<CELL_TYPE> *quakelib::HMatrix<CELL_TYPE>::aca_block(const Cluster &rc, const Cluster &cc, HMatrixEntryGenerator *gen, const double &tolerance) const {
+    std::vector<double> u, v, row, col;
+    std::vector<bool>   used_row;
+    unsigned int        m, n, i, j, k, l, rank, max_rank, piv_row, piv_col, num_used;
+    double              pivot, u_norm2, v_norm2, norm2, uu, vv;
+    bool                converged;
+
+    m = rc._end-rc._begin;
+    n = cc._end-cc._begin;
+    max_rank = (m*n)/(m+n);
+    row.resize(n);
+    col.resize(m);
+    used_row.assign(m, false);
+
+    rank = 0;
+    num_used = 0;
+    piv_row = 0;
+    norm2 = 0;
+    converged = false;
+
+    while (rank < max_rank) {
+        used_row[piv_row] = true;
+        num_used++;
+
+        // Residual of the pivot row
+        for (j=0; j<n; ++j) {
+            row[j] = gen->entry(_row_perm[rc._begin+piv_row], _col_perm[cc._begin+j]);
+
+            for (k=0; k<rank; ++k) row[j] -= u[k*m+piv_row]*v[k*n+j];
+        }
+
+        piv_col = 0;
+
+        for (j=1; j<n; ++j) if (fabs(row[j]) > fabs(row[piv_col])) piv_col = j;
+
+        pivot = row[piv_col];
+
+        if (pivot != 0) {
+            // Residual of the pivot column
+            for (i=0; i<m; ++i) {
+                col[i] = gen->entry(_row_perm[rc._begin+i], _col_perm[cc._begin+piv_col]);
+
+                for (k=0; k<rank; ++k) col[i] -= u[k*m+i]*v[k*n+piv_col];
+            }
+
+            for (j=0; j<n; ++j) row[j] /= pivot;
+
+            // Update the Frobenius norm of the approximation with the new term
+            u_norm2 = v_norm2 = 0;
+
+            for (i=0; i<m; ++i) u_norm2 += col[i]*col[i];
+
+            for (j=0; j<n; ++j) v_norm2 += row[j]*row[j];
+
+            for (l=0; l<rank; ++l) {
+                uu = vv = 0;
+
+                for (i=0; i<m; ++i) uu += u[l*m+i]*col[i];
+
+                for (j=0; j<n; ++j) vv += v[l*n+j]*row[j];
+
+                norm2 += 2*uu*vv;
+            }
+
+            norm2 += u_norm2*v_norm2;
+
+            u.insert(u.end(), col.begin(), col.end());
+            v.insert(v.end(), row.begin(), row.end());
+            rank++;
+
+            if (u_norm2*v_norm2 <= tolerance*tolerance*norm2) {
+                converged = true;
+                break;
+            }
+        }
+
+        // Every row has been reproduced exactly
+        if (num_used == m) {
+            converged = true;
+            break;
+        }
+
+        // Next pivot is the largest entry of the new column among unused rows,
+        // or the next unused row if the last row was already exact
+        piv_row = m;
+
+        for (i=0; i<m; ++i) {
+            if (used_row[i]) continue;
+
+            if (piv_row == m || (pivot != 0 && fabs(col[i]) > fabs(col[piv_row]))) piv_row = i;
+        }
+    }
+
+    if (!converged) return dense_block(rc, cc, gen);
+
+    return new HLowRankMatrix<CELL_TYPE>(m, n, rank, (rank ? &u[0] : NULL), (rank ? &v[0] : NULL));
+}
+
+template <class CELL_TYPE>
+void quakelib::HMatrix<CELL_TYPE>::build(const std::vector<Vec<3> > &row_pts,
+                                         const std::vector<double> &row_radii,
+                                         const std::vector<Vec<3> > &col_pts,
+                                         const std::vector<double> &col_radii,
+                                         HMatrixEntryGenerator *gen,
+                                         const double &tolerance,
+                                         const double &eta,
+                                         const unsigned int &leaf_size) {
+    unsigned int    i;
+    int             n;
+    BlockNode       root;
+
+    assertThrow(row_pts.size() <= this->_nrows && col_pts.size() <= this->_ncols, "Too many points for the matrix size.");
+    assertThrow(row_pts.size() == row_radii.size() && col_pts.size() == col_radii.size(), "Each point must have a radius.");
+
+    clear();
+
+    if (row_pts.empty() || col_pts.empty()) return;
+
+    for (i=0; i<row_pts.size(); ++i) _row_perm.push_back(i);
+
+    for (i=0; i<col_pts.size(); ++i) _col_perm.push_back(i);
+
+    build_clusters(_row_clusters, _row_perm, row_pts, row_radii, 0, row_pts.size(), std::max(leaf_size, 1u));
+    build_clusters(_col_clusters, _col_perm, col_pts, col_radii, 0, col_pts.size(), std::max(leaf_size, 1u));
+
+    _row_pos.resize(_row_perm.size());
+    _col_pos.resize(_col_perm.size());
+
+    for (i=0; i<_row_perm.size(); ++i) _row_pos[_row_perm[i]] = i;
+
+    for (i=0; i<_col_perm.size(); ++i) _col_pos[_col_perm[i]] = i;
+
+    root._row_cluster = root._col_cluster = 0;
+    root._first_child = root._num_children = 0;
+    root._far_field = false;
+    root._mat = NULL;
+    _blocks.push_back(root);
+    build_blocks(0, eta, leaf_size);
+
+    // Fill in the leaves, the near-field ones are much cheaper so schedule dynamically
+    #pragma omp parallel for schedule(dynamic)
+
+    for (n=0; n<(int)_leaves.size(); ++n) {
+        BlockNode   &leaf = _blocks[_leaves[n]];
+
+        if (leaf._far_field) {
+            leaf._mat = aca_block(_row_clusters[leaf._row_cluster], _col_clusters[leaf._col_cluster], gen, tolerance);
+        } else {
+            leaf._mat = dense_block(_row_clusters[leaf._row_cluster], _col_clusters[leaf._col_cluster], gen);
+        }
+    }
+
+    _xp.resize(_col_perm.size());
+    _yp.resize(_row_perm.size());
+}
+
+template <class CELL_TYPE>
+void quakelib::HMatrix<CELL_TYPE>::multiplyAccum(double *y, const double *x) const {
+    unsigned int    i;
+
+    if (_leaves.empty()) return;
+
+    // Gather the input into cluster order so every block works on contiguous values
+    for (i=0; i<_col_perm.size(); ++i) _xp[i] = x[_col_perm[i]];
+
+    for (i=0; i<_row_perm.size(); ++i) _yp[i] = 0;
+
+    for (i=0; i<_leaves.size(); ++i) {
+        const BlockNode &leaf = _blocks[_leaves[i]];
+        leaf._mat->multiply_accum(&_yp[_row_clusters[leaf._row_cluster]._begin],
+                                  &_xp[_col_clusters[leaf._col_cluster]._begin]);
+    }
+
+    for (i=0; i<_row_perm.size(); ++i) y[_row_perm[i]] += _yp[i];
+}
+
+template <class CELL_TYPE>
+const typename quakelib::HMatrix<CELL_TYPE>::BlockNode &quakelib::HMatrix<CELL_TYPE>::find_leaf(const unsigned int &row_pos, const unsigned int &col_pos) const {
+    unsigned int    node, i, child;
+
+    node = 0;
+
+    while (_blocks[node]._num_children > 0) {
+        for (i=0; i<_blocks[node]._num_children; ++i) {
+            child = _blocks[node]._first_child+i;
+            const Cluster &rc = _row_clusters[_blocks[child]._row_cluster];
+            const Cluster &cc = _col_clusters[_blocks[child]._col_cluster];
+
+            if (row_pos >= rc._begin && row_pos < rc._end && col_pos >= cc._begin && col_pos < cc._end) break;
+        }
+
+        node = _blocks[node]._first_child+i;
+    }
+
+    return _blocks[node];
+}
+
+template <class CELL_TYPE>
+CELL_TYPE quakelib::HMatrix<CELL_TYPE>::val(const unsigned int &row, const unsigned int &col) const {
+    // Rows and columns outside the built matrix (e.g. padding) are zero
+    if (row >= _row_pos.size() || col >= _col_pos.size()) return 0;
+
+    const BlockNode &leaf = find_leaf(_row_pos[row], _col_pos[col]);
+
+    return leaf._mat->get(_row_pos[row]-_row_clusters[leaf._row_cluster]._begin,
+                          _col_pos[col]-_col_clusters[leaf._col_cluster]._begin);
+}
+
+template <class CELL_TYPE>
+void quakelib::HMatrix<CELL_TYPE>::setVal(const unsigned int &row, const unsigned int &col, const CELL_TYPE &new_val) {
+    assertThrow(row < _row_pos.size() && col < _col_pos.size(), "HMatrix values can only be set after the matrix is built.");
+
+    const BlockNode &leaf = find_leaf(_row_pos[row], _col_pos[col]);
+
+    leaf._mat->set(_row_pos[row]-_row_clusters[leaf._row_cluster]._begin,
+                   _col_pos[col]-_col_clusters[leaf._col_cluster]._begin,
+                   new_val);
+}
+
+template <class CELL_TYPE>
+CELL_TYPE *quakelib::HMatrix<CELL_TYPE>::getRow(CELL_TYPE *buf, const unsigned int &row) const {
+    for (unsigned int col=0; col<this->_ncols; ++col) buf[col] = val(row, col);
+
+    return buf;
+}
+
+template <class CELL_TYPE>
+CELL_TYPE *quakelib::HMatrix<CELL_TYPE>::getCol(CELL_TYPE *buf, const unsigned int &col) const {
+    for (unsigned int row=0; row<this->_nrows; ++row) buf[row] = val(row, col);
+
+    return buf;
+}
+
+template <class CELL_TYPE>
+unsigned long quakelib::HMatrix<CELL_TYPE>::mem_bytes(void) const {
+    unsigned long   total = 0;
+
+    for (unsigned int i=0; i<_leaves.size(); ++i) total += _blocks[_leaves[i]]._mat->mem_bytes();
+
+    total += sizeof(Cluster)*(_row_clusters.size()+_col_clusters.size());
+    total += sizeof(unsigned int)*2*(_row_perm.size()+_col_perm.size());
+    total += sizeof(BlockNode)*_blocks.size()+sizeof(unsigned int)*_leaves.size();
+    total += sizeof(double)*(_xp.size()+_yp.size());
+
+    return total;
+}
+
+template <class CELL_TYPE>
+unsigned int quakelib::HMatrix<CELL_TYPE>::num_dense_blocks(void) const {
+    unsigned int    i, num = 0;
+
+    for (i=0; i<_leaves.size(); ++i) {
+        if (dynamic_cast<const HFullMatrix<CELL_TYPE> *>(_blocks[_leaves[i]]._mat)) num++;
+    }
+
+    return num;
+}
+
+template <class CELL_TYPE>
+unsigned int quakelib::HMatrix<CELL_TYPE>::num_low_rank_blocks(void) const {
+    return _leaves.size()-num_dense_blocks();
+}
+
+template <class CELL_TYPE>
+unsigned int quakelib::HMatrix<CELL_TYPE>::max_rank(void) const {
+    const HLowRankMatrix<CELL_TYPE>     *block;
+    unsigned int                        i, rank = 0;
+
+    for (i=0; i<_leaves.size(); ++i) {
+        block = dynamic_cast<const HLowRankMatrix<CELL_TYPE> *>(_blocks[_leaves[i]]._mat);
+
+        if (block) rank = std::max(rank, block->rank());
+    }
+
+    return rank;
+}
+
 template class quakelib::DenseStd<float>;
 template class quakelib::DenseStdStraight<float>;
 template class quakelib::DenseStdTranspose<float>;
 template class quakelib::CompressedRowMatrix<float>;
 template class quakelib::CompressedRowMatrixStraight<float>;
 template class quakelib::CompressedRowMatrixTranspose<float>;
+template class quakelib::SparseRowMatrix<float>;
 
 template class quakelib::DenseStd<double>;
 template class quakelib::DenseStdStraight<double>;
@@ -894,12 +1624,20 @@ template class quakelib::DenseStdTranspose<double>;
 template class quakelib::CompressedRowMatrix<double>;
 template class quakelib::CompressedRowMatrixStraight<double>;
 template class quakelib::CompressedRowMatrixTranspose<double>;
+template class quakelib::SparseRowMatrix<double>;
+
+template class quakelib::QuantizedRowMatrix<int16_t>;
+template class quakelib::QuantizedRowMatrix<int8_t>;
 
 template class quakelib::HFullMatrix<float>;
+template class quakelib::HLowRankMatrix<float>;
 template class quakelib::HSuperMatrix<float>;
+template class quakelib::HMatrix<float>;
 
 template class quakelib::HFullMatrix<double>;
+template class quakelib::HLowRankMatrix<double>;
 template class quakelib::HSuperMatrix<double>;
+template class quakelib::HMatrix<double>;
 
 template class quakelib::RectBound<2>;
 template class quakelib::RectBound<3>;
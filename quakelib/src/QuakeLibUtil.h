@@ -572,9 +572,16 @@ namespace quakelib {
         protected:
             CELL_TYPE       *_data;
         public:
-            DenseStd(const unsigned int &ncols, const unsigned int &nrows);
+            DenseStd(const unsigned int &ncols, const unsigned int &nrows, const bool &init_vals=true);
             virtual ~DenseStd(void);
             void allocateRow(const unsigned int &row) {};
+            //! Zero the values of rows [first, last). If the matrix was created with init_vals
+            //! false this must be called for every row before use, the thread calling it
+            //! decides where the pages are placed on NUMA systems.
+            virtual void clearRows(const unsigned int &first, const unsigned int &last) = 0;
+            CELL_TYPE *data(void) const {
+                return _data;
+            };
             bool compressed(void) const {
                 return false;
             };
@@ -593,8 +600,9 @@ namespace quakelib {
     template <class CELL_TYPE>
     class DenseStdStraight : public DenseStd<CELL_TYPE> {
         public:
-            DenseStdStraight(const unsigned int &ncols, const unsigned int &nrows) : DenseStd<CELL_TYPE>(ncols, nrows) {};
+            DenseStdStraight(const unsigned int &ncols, const unsigned int &nrows, const bool &init_vals=true) : DenseStd<CELL_TYPE>(ncols, nrows, init_vals) {};
             virtual ~DenseStdStraight(void) {};
+            void clearRows(const unsigned int &first, const unsigned int &last);
             bool transpose(void) const {
                 return false;
             };
@@ -610,8 +618,9 @@ namespace quakelib {
     template <class CELL_TYPE>
     class DenseStdTranspose : public DenseStd<CELL_TYPE> {
         public:
-            DenseStdTranspose(const unsigned int &ncols, const unsigned int &nrows) : DenseStd<CELL_TYPE>(nrows, ncols) {};
+            DenseStdTranspose(const unsigned int &ncols, const unsigned int &nrows, const bool &init_vals=true) : DenseStd<CELL_TYPE>(nrows, ncols, init_vals) {};
             virtual ~DenseStdTranspose(void) {};
+            void clearRows(const unsigned int &first, const unsigned int &last);
             bool transpose(void) const {
                 return true;
             };
@@ -647,6 +656,21 @@ namespace quakelib {
             void setVal(const unsigned int &col, const CELL_TYPE &new_val);
             void copyRowContents(CELL_TYPE *dest) const;
             unsigned long mem_bytes(void) const;
+
+            //! Whether the row is stored as runs (see runs()) rather than as raw values (see rawData()).
+            bool isCompressed(void) const {
+                return compressed;
+            };
+            //! Number of runs if the row is compressed, otherwise number of raw values.
+            unsigned int dataDim(void) const {
+                return data_dim;
+            };
+            const RowRun<CELL_TYPE> *getRuns(void) const {
+                return runs;
+            };
+            const CELL_TYPE *getRawData(void) const {
+                return raw_data;
+            };
     };
 
     template <class CELL_TYPE>
@@ -663,6 +687,11 @@ namespace quakelib {
             bool compressRow(const unsigned int &row, const float &ratio);
             bool decompressRow(const unsigned int &row);
             unsigned long mem_bytes(void) const;
+            //! The stored row, which is a matrix column if the matrix is transposed.
+            //! Used to multiply with the runs directly instead of decompressing them.
+            const CompressedRow<CELL_TYPE> *storedRow(const unsigned int &row) const {
+                return _rows[row];
+            };
     };
 
     template <class CELL_TYPE>
@@ -691,6 +720,139 @@ namespace quakelib {
             CELL_TYPE *getCol(CELL_TYPE *buf, const unsigned int &col) const;
     };
 
+    /*
+     Compressed sparse row (CSR) matrix holding only the nonzero values of a matrix.
+     As with CompressedRowMatrixTranspose, the stored rows are the matrix columns when the
+     matrix is transposed. The sparsity pattern is fixed once the rows are set, so only
+     existing nonzero values can be changed afterwards.
+     */
+    template <class CELL_TYPE>
+    class SparseRowMatrix : public DenseMatrix<CELL_TYPE> {
+        private:
+            bool                        _transpose;
+            //! Offset of the first value of each stored row, with one extra entry for the end
+            std::vector<unsigned int>   _row_starts;
+            //! Column within the stored row of each value, increasing in each row
+            std::vector<unsigned int>   _cols;
+            std::vector<CELL_TYPE>      _vals;
+
+            int find(const unsigned int &row, const unsigned int &col) const;
+
+        public:
+            //! Create an empty matrix with nrows stored rows of ncols values each,
+            //! with room reserved for num_nonzero values.
+            SparseRowMatrix(const unsigned int &ncols, const unsigned int &nrows, const bool &transposed, const unsigned long &num_nonzero);
+            virtual ~SparseRowMatrix(void) {};
+
+            //! Set the contents of the next stored row from its dense values, rows must be set in order.
+            void setRow(const unsigned int &row, const CELL_TYPE *dense_vals);
+
+            void allocateRow(const unsigned int &row) {};
+            bool transpose(void) const {
+                return _transpose;
+            };
+            bool compressed(void) const {
+                return false;
+            };
+            bool compressRow(const unsigned int &row, const float &ratio) {
+                return false;
+            };
+            bool decompressRow(const unsigned int &row) {
+                return false;
+            };
+            CELL_TYPE val(const unsigned int &row, const unsigned int &col) const;
+            void setVal(const unsigned int &row, const unsigned int &col, const CELL_TYPE &new_val);
+            CELL_TYPE *getRow(CELL_TYPE *buf, const unsigned int &row) const;
+            CELL_TYPE *getCol(CELL_TYPE *buf, const unsigned int &col) const;
+            unsigned long mem_bytes(void) const;
+
+            unsigned long num_nonzero(void) const {
+                return _vals.size();
+            };
+            const unsigned int *row_starts(void) const {
+                return &_row_starts[0];
+            };
+            const unsigned int *cols(void) const {
+                return (_cols.empty() ? NULL : &_cols[0]);
+            };
+            const CELL_TYPE *vals(void) const {
+                return (_vals.empty() ? NULL : &_vals[0]);
+            };
+
+            //! Bytes needed to store a matrix with the given dimensions and number of nonzero values.
+            static unsigned long mem_bytes(const unsigned int &nrows, const unsigned long &num_nonzero) {
+                return sizeof(unsigned int)*(nrows+1) + (sizeof(unsigned int)+sizeof(CELL_TYPE))*num_nonzero;
+            };
+    };
+
+    /*
+     Matrix with the values of each stored row quantized to integer codes, with
+     value = offset + scale*code using a scale and offset per stored row. One value in
+     each row can be kept in full precision, which is stored as a correction to its
+     quantized value. As with SparseRowMatrix the stored rows are the matrix columns
+     when the matrix is transposed, and values can't be changed once quantized.
+     */
+    template <class CODE_TYPE>
+    class QuantizedRowMatrix : public DenseMatrix<double> {
+        private:
+            bool                        _transpose;
+            CODE_TYPE                   *_codes;
+            std::vector<double>         _scales, _offsets, _corrections;
+            //! Position in each stored row of the full precision value, or -1 if there is none
+            std::vector<int>            _exact_pos;
+
+            void quantizeRow(const unsigned int &row, const float *vals);
+
+        public:
+            //! Quantize the nrows stored rows of ncols values of src. The value in column
+            //! exact_cols[r] of each matrix row r keeps its full precision.
+            QuantizedRowMatrix(const DenseMatrix<float> &src,
+                               const unsigned int &ncols,
+                               const unsigned int &nrows,
+                               const std::vector<unsigned int> &exact_cols);
+            virtual ~QuantizedRowMatrix(void);
+
+            void allocateRow(const unsigned int &row) {};
+            bool transpose(void) const {
+                return _transpose;
+            };
+            bool compressed(void) const {
+                return false;
+            };
+            bool compressRow(const unsigned int &row, const float &ratio) {
+                return false;
+            };
+            bool decompressRow(const unsigned int &row) {
+                return false;
+            };
+            double val(const unsigned int &row, const unsigned int &col) const;
+            void setVal(const unsigned int &row, const unsigned int &col, const double &new_val);
+            double *getRow(double *buf, const unsigned int &row) const;
+            double *getCol(double *buf, const unsigned int &col) const;
+            unsigned long mem_bytes(void) const;
+
+            //! The codes of a stored row, padded like the rows of the source matrix
+            const CODE_TYPE *codes(const unsigned int &row) const {
+                return &_codes[(unsigned long)row*this->_ncols];
+            };
+            double scale(const unsigned int &row) const {
+                return _scales[row];
+            };
+            double offset(const unsigned int &row) const {
+                return _offsets[row];
+            };
+            int exact_pos(const unsigned int &row) const {
+                return _exact_pos[row];
+            };
+            double correction(const unsigned int &row) const {
+                return _corrections[row];
+            };
+    };
+
+    /*
+     Block of a hierarchical matrix. Blocks are either stored in full, as a low rank
+     product or subdivided into further blocks.
+     */
     template <class CELL_TYPE>
     class HierarchicalMatrix {
         protected:
@@ -698,9 +860,19 @@ namespace quakelib {
 
         public:
             HierarchicalMatrix(void) : _rows(0), _cols(0) {};
+            HierarchicalMatrix(unsigned int nrows, unsigned int ncols) : _rows(nrows), _cols(ncols) {};
             virtual ~HierarchicalMatrix(void) {};
+            unsigned int rows(void) const {
+                return _rows;
+            };
+            unsigned int cols(void) const {
+                return _cols;
+            };
             virtual void set(unsigned int row, unsigned int col, CELL_TYPE new_val) = 0;
             virtual CELL_TYPE get(unsigned int row, unsigned int col) const = 0;
+            // y[0.._rows) += this * x[0.._cols)
+            virtual void multiply_accum(double *y, const double *x) const = 0;
+            virtual unsigned long mem_bytes(void) const = 0;
     };
 
     template <class CELL_TYPE>
@@ -711,9 +883,7 @@ namespace quakelib {
         public:
             HFullMatrix(void) : HierarchicalMatrix<CELL_TYPE>(), _vals(NULL) {};
 
-            HFullMatrix(unsigned int nrows, unsigned int ncols) {
-                this->_rows = nrows;
-                this->_cols = ncols;
+            HFullMatrix(unsigned int nrows, unsigned int ncols) : HierarchicalMatrix<CELL_TYPE>(nrows, ncols) {
                 _vals = (CELL_TYPE *)malloc(this->_rows*this->_cols*sizeof(CELL_TYPE));
             }
 
@@ -732,32 +902,107 @@ namespace quakelib {
                 assertThrow(col < this->_cols, "Out of bounds");
                 return _vals[row*this->_cols+col];
             }
+
+            virtual void multiply_accum(double *y, const double *x) const;
+
+            virtual unsigned long mem_bytes(void) const {
+                return sizeof(CELL_TYPE)*this->_rows*this->_cols;
+            }
     };
 
+    /*
+     Low rank block stored as U*V^T, where U is rows x rank and V is cols x rank.
+     Values can't be set individually.
+     */
+    template <class CELL_TYPE>
+    class HLowRankMatrix : public HierarchicalMatrix<CELL_TYPE> {
+        private:
+            unsigned int    _rank;
+            // Columns of U and V, each stored contiguously
+            CELL_TYPE       *_u, *_v;
+
+        public:
+            HLowRankMatrix(unsigned int nrows, unsigned int ncols, unsigned int rank, const double *u, const double *v);
+
+            virtual ~HLowRankMatrix(void) {
+                if (_u) free(_u);
+
+                if (_v) free(_v);
+            }
+
+            unsigned int rank(void) const {
+                return _rank;
+            };
+
+            virtual void set(unsigned int row, unsigned int col, CELL_TYPE new_val) {
+                assertThrow(false, "Values in a low rank block can't be set.");
+            }
+
+            virtual CELL_TYPE get(unsigned int row, unsigned int col) const;
+
+            virtual void multiply_accum(double *y, const double *x) const;
+
+            virtual unsigned long mem_bytes(void) const {
+                return sizeof(CELL_TYPE)*_rank*(this->_rows+this->_cols);
+            }
+    };
 
+    /*
+     Block divided into a regular grid of mat_rows x mat_cols sub-blocks.
+     The sub-blocks are owned by this matrix and deleted with it.
+     */
     template <class CELL_TYPE>
     class HSuperMatrix : public HierarchicalMatrix<CELL_TYPE> {
         private:
             unsigned int                    _mat_rows, _mat_cols;
             HierarchicalMatrix<CELL_TYPE>   **_matrices;
 
+            // Number of rows and columns in each sub-block
+            unsigned int sub_rows(void) const {
+                return this->_rows/_mat_rows;
+            };
+            unsigned int sub_cols(void) const {
+                return this->_cols/_mat_cols;
+            };
+
         public:
+            HSuperMatrix(unsigned int nrows, unsigned int ncols, unsigned int mat_rows, unsigned int mat_cols) : HierarchicalMatrix<CELL_TYPE>(nrows, ncols), _mat_rows(mat_rows), _mat_cols(mat_cols) {
+                assertThrow(mat_rows > 0 && mat_cols > 0 && nrows%mat_rows == 0 && ncols%mat_cols == 0, "Sub-blocks must evenly divide the matrix");
+                _matrices = new HierarchicalMatrix<CELL_TYPE>*[_mat_rows*_mat_cols];
+
+                for (unsigned int i=0; i<_mat_rows*_mat_cols; ++i) _matrices[i] = NULL;
+            }
+
+            virtual ~HSuperMatrix(void) {
+                for (unsigned int i=0; i<_mat_rows*_mat_cols; ++i) delete _matrices[i];
+
+                delete [] _matrices;
+            }
+
+            // Set the sub-block at the specified grid position, taking ownership of it
+            void set_matrix(unsigned int mat_row, unsigned int mat_col, HierarchicalMatrix<CELL_TYPE> *new_mat) {
+                assertThrow(mat_row < _mat_rows && mat_col < _mat_cols, "Out of bounds");
+                assertThrow(new_mat->rows() == sub_rows() && new_mat->cols() == sub_cols(), "Sub-block has the wrong size");
+                delete _matrices[mat_row*_mat_cols+mat_col];
+                _matrices[mat_row*_mat_cols+mat_col] = new_mat;
+            }
+
             virtual void set(unsigned int row, unsigned int col, CELL_TYPE new_val) {
                 unsigned int sub_matrix_row, sub_matrix_col, new_row, new_col;
 
                 assertThrow(row < this->_rows, "Out of bounds");
                 assertThrow(col < this->_cols, "Out of bounds");
 
-                sub_matrix_row = row/(this->_rows/_mat_rows);
-                sub_matrix_col = col/(this->_cols/_mat_cols);
+                sub_matrix_row = row/sub_rows();
+                sub_matrix_col = col/sub_cols();
 
                 assertThrow(sub_matrix_row < this->_mat_rows, "Out of bounds");
                 assertThrow(sub_matrix_col < this->_mat_cols, "Out of bounds");
 
-                new_row = row-sub_matrix_row*(this->_rows/_mat_rows);
-                new_col = col-sub_matrix_col*(this->_cols/_mat_cols);
+                new_row = row-sub_matrix_row*sub_rows();
+                new_col = col-sub_matrix_col*sub_cols();
 
-                _matrices[sub_matrix_row*_mat_rows+sub_matrix_col]->set(new_row, new_col, new_val);
+                _matrices[sub_matrix_row*_mat_cols+sub_matrix_col]->set(new_row, new_col, new_val);
             }
 
             virtual CELL_TYPE get(unsigned int row, unsigned int col) const {
@@ -766,19 +1011,36 @@ namespace quakelib {
                 assertThrow(row < this->_rows, "Out of bounds");
                 assertThrow(col < this->_cols, "Out of bounds");
 
-                sub_matrix_row = row/_mat_rows;
-                sub_matrix_col = col/_mat_cols;
+                sub_matrix_row = row/sub_rows();
+                sub_matrix_col = col/sub_cols();
 
                 assertThrow(sub_matrix_row < this->_mat_rows, "Out of bounds");
                 assertThrow(sub_matrix_col < this->_mat_cols, "Out of bounds");
 
-                new_row = row-sub_matrix_row*(this->_rows/_mat_rows);
-                new_col = col-sub_matrix_col*(this->_cols/_mat_cols);
+                new_row = row-sub_matrix_row*sub_rows();
+                new_col = col-sub_matrix_col*sub_cols();
 
-                return _matrices[sub_matrix_row*_mat_rows+sub_matrix_col]->get(new_row, new_col);
+                return _matrices[sub_matrix_row*_mat_cols+sub_matrix_col]->get(new_row, new_col);
+            }
+
+            virtual void multiply_accum(double *y, const double *x) const {
+                for (unsigned int i=0; i<_mat_rows; ++i) {
+                    for (unsigned int j=0; j<_mat_cols; ++j) {
+                        _matrices[i*_mat_cols+j]->multiply_accum(&y[i*sub_rows()], &x[j*sub_cols()]);
+                    }
+                }
             }
-    };
 
+            virtual unsigned long mem_bytes(void) const {
+                unsigned long total = 0;
+
+                for (unsigned int i=0; i<_mat_rows*_mat_cols; ++i) {
+                    if (_matrices[i]) total += _matrices[i]->mem_bytes();
+                }
+
+                return total;
+            }
+    };
 
     // Rectangular shaped bound of Cartesian space
     // The bound consists of all points in [_min_bound[i], _max_bound[i]) for i in [0,dim)
@@ -851,6 +1113,107 @@ namespace quakelib {
     std::ostream &operator<<(std::ostream &os, const RectBound<2> &pt);
     std::ostream &operator<<(std::ostream &os, const RectBound<3> &pt);
 
+    /*
+     Source of matrix values for building an HMatrix. Entries are requested
+     in arbitrary order and from multiple threads at once.
+     */
+    class HMatrixEntryGenerator {
+        public:
+            virtual ~HMatrixEntryGenerator(void) {};
+            virtual double entry(const unsigned int &row, const unsigned int &col) = 0;
+    };
+
+    /*
+     Hierarchical matrix presented through the DenseMatrix interface.
+     Rows and columns are each ordered by a binary cluster tree over the
+     element locations. Pairs of clusters far enough apart relative to their
+     size are approximated by low rank blocks using adaptive cross approximation
+     (ACA), which only evaluates O(k(m+n)) entries of an m x n block of rank k.
+     Near-field pairs are subdivided down to dense leaf blocks. This takes
+     O(N log N) memory and time per matrix-vector product, rather than O(N^2).
+     Individual values can only be set in dense blocks, the matrix is filled
+     in all at once by build().
+     */
+    template <class CELL_TYPE>
+    class HMatrix : public DenseMatrix<CELL_TYPE> {
+        private:
+            struct Cluster {
+                unsigned int    _begin, _end;
+                int             _children[2];
+                RectBound<3>    _bound;
+            };
+
+            struct BlockNode {
+                int             _row_cluster, _col_cluster;
+                unsigned int    _first_child, _num_children;
+                bool            _far_field;
+                HierarchicalMatrix<CELL_TYPE>   *_mat;
+            };
+
+            std::vector<Cluster>        _row_clusters, _col_clusters;
+            // perm[position] gives the row or column at a position in the cluster ordering, pos is the inverse
+            std::vector<unsigned int>   _row_perm, _col_perm, _row_pos, _col_pos;
+            std::vector<BlockNode>      _blocks;
+            std::vector<unsigned int>   _leaves;
+            // Permuted input and output vectors used in the multiplication
+            mutable std::vector<double> _xp, _yp;
+
+            int build_clusters(std::vector<Cluster> &clusters,
+                               std::vector<unsigned int> &perm,
+                               const std::vector<Vec<3> > &pts,
+                               const std::vector<double> &radii,
+                               const unsigned int &begin,
+                               const unsigned int &end,
+                               const unsigned int &leaf_size);
+            void build_blocks(const unsigned int &node, const double &eta, const unsigned int &leaf_size);
+            HierarchicalMatrix<CELL_TYPE> *dense_block(const Cluster &rc, const Cluster &cc, HMatrixEntryGenerator *gen) const;
+            HierarchicalMatrix<CELL_TYPE> *aca_block(const Cluster &rc, const Cluster &cc, HMatrixEntryGenerator *gen, const double &tolerance) const;
+            const BlockNode &find_leaf(const unsigned int &row_pos, const unsigned int &col_pos) const;
+            void clear(void);
+
+        public:
+            HMatrix(const unsigned int &ncols, const unsigned int &nrows) : DenseMatrix<CELL_TYPE>(ncols, nrows) {};
+            virtual ~HMatrix(void);
+
+            // Build the matrix from the locations and extents of the row and column
+            // elements, evaluating entries as needed with gen.
+            void build(const std::vector<Vec<3> > &row_pts,
+                       const std::vector<double> &row_radii,
+                       const std::vector<Vec<3> > &col_pts,
+                       const std::vector<double> &col_radii,
+                       HMatrixEntryGenerator *gen,
+                       const double &tolerance,
+                       const double &eta,
+                       const unsigned int &leaf_size);
+
+            // y[row] += sum over col of this[row][col]*x[col]
+            void multiplyAccum(double *y, const double *x) const;
+
+            void allocateRow(const unsigned int &row) {};
+            CELL_TYPE val(const unsigned int &row, const unsigned int &col) const;
+            void setVal(const unsigned int &row, const unsigned int &col, const CELL_TYPE &new_val);
+            bool transpose(void) const {
+                return false;
+            };
+            bool compressed(void) const {
+                return false;
+            };
+            bool compressRow(const unsigned int &row, const float &ratio) {
+                return false;
+            };
+            bool decompressRow(const unsigned int &row) {
+                return false;
+            };
+            // Rows and columns are assembled value by value, use multiplyAccum instead where possible
+            CELL_TYPE *getRow(CELL_TYPE *buf, const unsigned int &row) const;
+            CELL_TYPE *getCol(CELL_TYPE *buf, const unsigned int &col) const;
+            unsigned long mem_bytes(void) const;
+
+            unsigned int num_dense_blocks(void) const;
+            unsigned int num_low_rank_blocks(void) const;
+            unsigned int max_rank(void) const;
+    };
+
     enum TraverseCommand {
         CONTINUE_TRAVERSE,
         BACK_TO_PARENT,
@@ -21,6 +21,8 @@
 #include "Comm.h"
 #include "SimFramework.h"
 
+#include <vector>
+
 #ifdef MPI_C_FOUND
 
 // Note: We assume these operations are only called for the BlockVal MPI datatype
@@ -163,11 +165,79 @@ int VCComm::broadcastValue(const int &bval) {
 #endif
 }
 
+/*!
+ Gathers a group of per-block fields from the nodes that own each block to all nodes.
+ fields holds num_fields values for each global block, stored as fields[gid*num_fields+f].
+ On entry only the values of local blocks need to be set, on return all blocks are set.
+ The whole group is moved with a single MPI_Allgatherv.
+ */
+void VCComm::allGatherBlockFields(double *fields, const int &num_fields) {
+#ifdef MPI_C_FOUND
+    std::vector<double>     send_buf, recv_buf;
+    std::vector<int>        counts, disps;
+    BlockID                 gid;
+    int                     i, f;
+
+    send_buf.resize(blockFieldNumLocal*num_fields);
+    recv_buf.resize(blockFieldNumGlobal*num_fields);
+    counts.resize(blockFieldWorldSize);
+    disps.resize(blockFieldWorldSize);
+
+    for (i=0; i<blockFieldWorldSize; ++i) {
+        counts[i] = updateFieldCounts[i]*num_fields;
+        disps[i] = updateFieldDisps[i]*num_fields;
+    }
+
+    // Pack the local block fields in send order
+    for (i=0; i<blockFieldNumLocal; ++i) {
+        gid = updateFieldSendIDs[i];
+
+        for (f=0; f<num_fields; ++f) send_buf[i*num_fields+f] = fields[gid*num_fields+f];
+    }
+
+#ifdef DEBUG
+    startTimer(dist_comm_timer);
+#endif
+    MPI_Allgatherv(send_buf.data(), blockFieldNumLocal*num_fields, MPI_DOUBLE,
+                   recv_buf.data(), counts.data(), disps.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+#ifdef DEBUG
+    stopTimer(dist_comm_timer);
+#endif
+
+    // Unpack the fields of all blocks into global block order
+    for (i=0; i<blockFieldNumGlobal; ++i) {
+        gid = updateFieldRecvIDs[i];
+
+        for (f=0; f<num_fields; ++f) fields[gid*num_fields+f] = recv_buf[i*num_fields+f];
+    }
+
+#endif
+}
+
+/*!
+ Broadcasts a group of per-block fields from the root node to all nodes.
+ fields holds num_fields values for each global block, stored as fields[gid*num_fields+f].
+ The whole group is moved with a single MPI_Bcast.
+ */
+void VCComm::broadcastBlockFields(double *fields, const int &num_fields) {
+#ifdef MPI_C_FOUND
+#ifdef DEBUG
+    startTimer(dist_comm_timer);
+#endif
+    MPI_Bcast(fields, blockFieldNumGlobal*num_fields, MPI_DOUBLE, ROOT_NODE_RANK, MPI_COMM_WORLD);
+#ifdef DEBUG
+    stopTimer(dist_comm_timer);
+#endif
+#endif
+}
+
 /*!
  Register the block ID/value MPI datatype and block sweep datatype.
  This must exactly match the contents of BlockVal and BlockSweepVals.
  */
 VCComm::VCComm(void) {
+    num_dense_exchanges = num_sparse_exchanges = 0;
+    exchange_bytes = exchange_dense_bytes = 0;
 #ifdef MPI_C_FOUND
     int             block_lengths[3];
     MPI_Aint        displacements[3];
@@ -177,6 +247,10 @@ VCComm::VCComm(void) {
     updateFieldSendBuf = updateFieldRecvBuf = NULL;
     updateFieldSendIDs = updateFieldRecvIDs = NULL;
     failBlockSendBuf = failBlockRecvBuf = NULL;
+    blockFieldWorldSize = blockFieldNumLocal = blockFieldNumGlobal = 0;
+    updateFieldLast = NULL;
+    updateFieldDeltaSendBuf = updateFieldDeltaRecvBuf = NULL;
+    updateFieldDeltaCounts = updateFieldDeltaDisps = NULL;
 
     // Register BlockVal datatype
     block_lengths[0] = block_lengths[1] = 1;    // 1 member for each block
@@ -244,6 +318,16 @@ VCComm::~VCComm(void) {
 
     if (failBlockDisps) delete [] failBlockDisps;
 
+    if (updateFieldLast) delete [] updateFieldLast;
+
+    if (updateFieldDeltaSendBuf) delete [] updateFieldDeltaSendBuf;
+
+    if (updateFieldDeltaRecvBuf) delete [] updateFieldDeltaRecvBuf;
+
+    if (updateFieldDeltaCounts) delete [] updateFieldDeltaCounts;
+
+    if (updateFieldDeltaDisps) delete [] updateFieldDeltaDisps;
+
     MPI_Type_free(&block_val_type);
     MPI_Op_free(&bv_min_op);
     MPI_Op_free(&bv_max_op);
@@ -251,3 +335,73 @@ VCComm::~VCComm(void) {
     MPI_Type_free(&element_sweep_type);
 #endif
 }
+
+/*!
+ Allocate local_bytes for this process in memory shared with the other processes on its node.
+ */
+NodeSharedArray::NodeSharedArray(const size_t &local_bytes) {
+#if defined(MPI_C_FOUND) && MPI_VERSION >= 3
+    std::vector<int>    node_ranks;
+    MPI_Aint            seg_size;
+    int                 world_rank, world_size, disp_unit, i;
+    void                *seg;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL, &_node_comm);
+    MPI_Comm_size(_node_comm, &_node_size);
+
+    MPI_Win_allocate_shared(local_bytes, 1, MPI_INFO_NULL, _node_comm, &_local, &_win);
+    // Keep a passive access epoch open so sync() can make the segments consistent
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, _win);
+
+    // Find the world rank of each process on this node and the start of its segment
+    node_ranks.resize(_node_size);
+    MPI_Allgather(&world_rank, 1, MPI_INT, node_ranks.data(), 1, MPI_INT, _node_comm);
+
+    _segments.assign(world_size, NULL);
+    _node_bytes = 0;
+
+    for (i=0; i<_node_size; ++i) {
+        MPI_Win_shared_query(_win, i, &seg_size, &disp_unit, &seg);
+        _segments[node_ranks[i]] = seg;
+        _node_bytes += seg_size;
+    }
+
+#else
+    _local = malloc(local_bytes);
+    assertThrow(_local || !local_bytes, "Not enough memory to allocate node shared array.");
+    _node_size = 1;
+    _node_bytes = local_bytes;
+#ifdef MPI_C_FOUND
+    int                 world_rank, world_size;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    _segments.assign(world_size, NULL);
+    _segments[world_rank] = _local;
+#else
+    _segments.assign(1, _local);
+#endif
+#endif
+}
+
+NodeSharedArray::~NodeSharedArray(void) {
+#if defined(MPI_C_FOUND) && MPI_VERSION >= 3
+    MPI_Win_unlock_all(_win);
+    MPI_Win_free(&_win);
+    MPI_Comm_free(&_node_comm);
+#else
+
+    if (_local) free(_local);
+
+#endif
+}
+
+void NodeSharedArray::sync(void) {
+#if defined(MPI_C_FOUND) && MPI_VERSION >= 3
+    MPI_Win_sync(_win);
+    MPI_Barrier(_node_comm);
+    MPI_Win_sync(_win);
+#endif
+}
@@ -21,6 +21,8 @@
 #include "SimTimer.h"
 #include "Block.h"
 
+#include <vector>
+
 #include "config.h"
 
 #ifdef MPI_C_FOUND
@@ -46,6 +48,18 @@ class VCComm : virtual public SimTimer {
         int                         *failBlockSendBuf, *failBlockRecvBuf;
         int                         *failBlockCounts, *failBlockDisps;
 
+        //! Number of nodes, local blocks and global blocks used to exchange per-block fields.
+        //! The block IDs on each node are given by updateFieldSendIDs/RecvIDs.
+        int                         blockFieldWorldSize, blockFieldNumLocal, blockFieldNumGlobal;
+
+        //! Update field values as of the last exchange, identical on all nodes, used to find
+        //! which local values changed so only those are sent
+        double                      *updateFieldLast;
+
+        //! Buffers and counts of changed (block, value) pairs for sparse update field exchanges
+        BlockVal                    *updateFieldDeltaSendBuf, *updateFieldDeltaRecvBuf;
+        int                         *updateFieldDeltaCounts, *updateFieldDeltaDisps;
+
         //! Registered MPI datatype for the block-value combination structure
         MPI_Datatype                block_val_type;
 
@@ -56,6 +70,11 @@ class VCComm : virtual public SimTimer {
         MPI_Datatype                element_sweep_type;
 #endif
 
+        //! Counts of dense and sparse update field exchanges and the bytes gathered by each node.
+        //! exchange_dense_bytes is what would have been gathered if all exchanges were dense.
+        unsigned long long          num_dense_exchanges, num_sparse_exchanges;
+        unsigned long long          exchange_bytes, exchange_dense_bytes;
+
     public:
         VCComm(void);
         ~VCComm(void);
@@ -63,6 +82,50 @@ class VCComm : virtual public SimTimer {
         void allReduceBlockVal(BlockVal &in_val, BlockVal &out_val, const BlockValOp &op);
         int blocksToFail(const bool &local_fail);
         int broadcastValue(const int &bval);
+
+        void allGatherBlockFields(double *fields, const int &num_fields);
+        void broadcastBlockFields(double *fields, const int &num_fields);
+};
+
+/*!
+ Memory shared by the processes running on the same node. Each process allocates its own
+ segment with MPI_Win_allocate_shared and can read the segments of the other processes on
+ its node directly. Without MPI 3 each process is alone on its node and the segment is
+ private memory. Construction and destruction are collective over all processes.
+ */
+class NodeSharedArray {
+    private:
+        void                        *_local;
+        //! Segment of each process by world rank, NULL for processes on other nodes
+        std::vector<void *>         _segments;
+        int                         _node_size;
+        size_t                      _node_bytes;
+#if defined(MPI_C_FOUND) && MPI_VERSION >= 3
+        MPI_Comm                    _node_comm;
+        MPI_Win                     _win;
+#endif
+
+    public:
+        NodeSharedArray(const size_t &local_bytes);
+        ~NodeSharedArray(void);
+
+        void *local(void) const {
+            return _local;
+        };
+        //! Segment of the process with the specified world rank, NULL if it runs on another node.
+        void *segment(const int &rank) const {
+            return _segments[rank];
+        };
+        int nodeSize(void) const {
+            return _node_size;
+        };
+        //! Total size of the segments on this node.
+        size_t nodeBytes(void) const {
+            return _node_bytes;
+        };
+
+        //! Wait for all processes on this node and make their writes visible to each other.
+        void sync(void);
 };
 
 #endif
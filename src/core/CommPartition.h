@@ -28,14 +28,41 @@ class VCCommPartition {
         //! Map of local array indices to global block IDs for blocks assigned to this node
         BlockIDList                 local_block_ids;
 
-        //! Map of global block IDs to array indices for blocks assigned to this node
-        BlockIDMap                  global_block_ids;
+        //! Local array index of each global block ID, -1 for blocks assigned to other nodes
+        std::vector<int>            global_block_ids;
 
-        //! Map of which blocks belong to which nodes
-        std::map<BlockID, int>      block_node_map;
+        //! Node each global block ID is assigned to
+        std::vector<int>            block_node_map;
 
-        //! Map of which nodes manage which blocks (reverse of block_node_map)
-        std::multimap<int, BlockID> node_block_map;
+        //! Blocks managed by each node (reverse of block_node_map). The blocks of node n are
+        //! node_block_ids[node_block_start[n]] up to but not including node_block_ids[node_block_start[n+1]].
+        std::vector<int>            node_block_start;
+        BlockIDList                 node_block_ids;
+
+        void clearPartition(const unsigned int &num_global_blocks) {
+            local_block_ids.clear();
+            global_block_ids.assign(num_global_blocks, -1);
+            block_node_map.assign(num_global_blocks, -1);
+            node_block_start.clear();
+            node_block_ids.clear();
+        };
+        //! Assign the next block of node, nodes must be assigned in increasing order.
+        void assignBlock(const BlockID &global_id, const int &node, const bool &local) {
+            if (local) {
+                global_block_ids[global_id] = local_block_ids.size();
+                local_block_ids.push_back(global_id);
+            }
+
+            block_node_map[global_id] = node;
+
+            while ((int)node_block_start.size() <= node) node_block_start.push_back(node_block_ids.size());
+
+            node_block_ids.push_back(global_id);
+        };
+        //! Close the range table after the last node has been assigned.
+        void finishPartition(const int &num_nodes) {
+            while ((int)node_block_start.size() <= num_nodes) node_block_start.push_back(node_block_ids.size());
+        };
 
     public:
         unsigned int numLocalBlocks(void) const {
@@ -43,16 +70,25 @@ class VCCommPartition {
         };
 
         BlockID getGlobalBID(const int &local_id) const {
-            return local_block_ids.at(local_id);
+            return local_block_ids[local_id];
         };
+        //! Local array index of a block assigned to this node.
         int getLocalInd(const BlockID &global_id) const {
-            return global_block_ids.at(global_id);
+            return global_block_ids[global_id];
         };
         int getBlockNode(const BlockID &global_id) const {
-            return block_node_map.at(global_id);
+            return block_node_map[global_id];
         };
         bool isLocalToNode(const BlockID &global_id) const {
-            return (global_block_ids.count(global_id) > 0);
+            return (global_id < global_block_ids.size() && global_block_ids[global_id] >= 0);
+        };
+        //! Number of blocks assigned to node.
+        int numNodeBlocks(const int &node) const {
+            return node_block_start[node+1]-node_block_start[node];
+        };
+        //! Global ID of the i-th block assigned to node.
+        BlockID getNodeBlock(const int &node, const int &i) const {
+            return node_block_ids[node_block_start[node]+i];
         };
 };
 
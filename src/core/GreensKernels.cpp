@@ -0,0 +1,923 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "GreensKernels.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+// The vector kernels are compiled with per-function target attributes rather
+// than global -m flags, so the binary still runs on CPUs without AVX.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VQ_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// ***************************************************************************
+// *** Scalar kernels
+// ***************************************************************************
+template <class CELL_TYPE>
+static void multiplyRowScalar(double *c, const double b, const CELL_TYPE *a, const int n) {
+    for (int x=0; x<n; ++x) c[x] += b*a[x];
+}
+
+template <class CELL_TYPE>
+static double multiplySumRowScalar(const double *b, const CELL_TYPE *a, const int n) {
+    double val = 0;
+
+    for (int x=0; x<n; ++x) val += a[x]*b[x];
+
+    return val;
+}
+
+static void addRowScalar(double *c, const double v, const int n) {
+    for (int x=0; x<n; ++x) c[x] += v;
+}
+
+static double sumRowScalar(const double *b, const int n) {
+    double val = 0;
+
+    for (int x=0; x<n; ++x) val += b[x];
+
+    return val;
+}
+
+template <class CELL_TYPE>
+static void multiplyRowPairScalar(double *c0, double *c1, const double b, const CELL_TYPE *a0, const CELL_TYPE *a1, const int n) {
+    for (int x=0; x<n; ++x) {
+        c0[x] += b*a0[x];
+        c1[x] += b*a1[x];
+    }
+}
+
+template <class CELL_TYPE>
+static void multiplySumRowPairScalar(double *vals, const double *b, const CELL_TYPE *a0, const CELL_TYPE *a1, const int n) {
+    double val0 = 0, val1 = 0;
+
+    for (int x=0; x<n; ++x) {
+        val0 += a0[x]*b[x];
+        val1 += a1[x]*b[x];
+    }
+
+    vals[0] = val0;
+    vals[1] = val1;
+}
+
+#ifdef VQ_X86_KERNELS
+
+// Number of scalar iterations needed to bring ptr to the given byte alignment
+#define ALIGN_HEAD(ptr, align, n)   std::min((int)(((align)-((uintptr_t)(ptr)&((align)-1)))&((align)-1))/(int)sizeof(*(ptr)), (n))
+
+// Whether two arrays have different offsets from the given byte alignment. The
+// pair kernels split both arrays at the same point, so in that case they fall
+// back to two single kernel calls to keep the same summation order.
+#define ALIGN_DIFFERS(p0, p1, align)    ((((uintptr_t)(p0))^((uintptr_t)(p1)))&((align)-1))
+
+// Loads of matrix values widened to double, single precision
+// values are converted in registers so the accumulation stays in double.
+__attribute__((target("sse2")))
+static inline __m128d load2(const double *a) {
+    return _mm_loadu_pd(a);
+}
+__attribute__((target("sse2")))
+static inline __m128d load2(const float *a) {
+    return _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double *)a)));
+}
+__attribute__((target("sse2")))
+static inline __m128d load2(const int16_t *a) {
+    int32_t     v;
+    __m128i     codes;
+
+    memcpy(&v, a, sizeof(v));
+    codes = _mm_cvtsi32_si128(v);
+
+    // Sign extend by moving each code to the top of a 32 bit lane and shifting it back
+    return _mm_cvtepi32_pd(_mm_srai_epi32(_mm_unpacklo_epi16(codes, codes), 16));
+}
+__attribute__((target("sse2")))
+static inline __m128d load2(const int8_t *a) {
+    uint16_t    v;
+    __m128i     codes;
+
+    memcpy(&v, a, sizeof(v));
+    codes = _mm_cvtsi32_si128(v);
+
+    codes = _mm_unpacklo_epi8(codes, codes);
+    return _mm_cvtepi32_pd(_mm_srai_epi32(_mm_unpacklo_epi16(codes, codes), 24));
+}
+__attribute__((target("avx2,fma")))
+static inline __m256d load4(const double *a) {
+    return _mm256_loadu_pd(a);
+}
+__attribute__((target("avx2,fma")))
+static inline __m256d load4(const float *a) {
+    return _mm256_cvtps_pd(_mm_loadu_ps(a));
+}
+__attribute__((target("avx2,fma")))
+static inline __m256d load4(const int16_t *a) {
+    return _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)a)));
+}
+__attribute__((target("avx2,fma")))
+static inline __m256d load4(const int8_t *a) {
+    int32_t     v;
+
+    memcpy(&v, a, sizeof(v));
+    return _mm256_cvtepi32_pd(_mm_cvtepi8_epi32(_mm_cvtsi32_si128(v)));
+}
+__attribute__((target("avx512f")))
+static inline __m512d load8(const double *a) {
+    return _mm512_loadu_pd(a);
+}
+__attribute__((target("avx512f")))
+static inline __m512d load8(const float *a) {
+    return _mm512_cvtps_pd(_mm256_loadu_ps(a));
+}
+__attribute__((target("avx512f")))
+static inline __m512d load8(const int16_t *a) {
+    return _mm512_cvtepi32_pd(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)a)));
+}
+__attribute__((target("avx512f")))
+static inline __m512d load8(const int8_t *a) {
+    return _mm512_cvtepi32_pd(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)a)));
+}
+__attribute__((target("avx512f")))
+static inline __m512d maskLoad8(const __mmask8 mask, const double *a) {
+    return _mm512_maskz_loadu_pd(mask, a);
+}
+__attribute__((target("avx512f")))
+static inline __m512d maskLoad8(const __mmask8 mask, const float *a) {
+    return _mm512_cvtps_pd(_mm512_castps512_ps256(_mm512_maskz_loadu_ps(mask, a)));
+}
+// Masked loads of 8 and 16 bit values need AVX-512BW, so integer codes are copied instead
+template <class CODE_TYPE>
+__attribute__((target("avx512f")))
+static inline __m512d maskLoad8(const __mmask8 mask, const CODE_TYPE *a) {
+    CODE_TYPE   tmp[8] = {0};
+
+    for (int i=0; i<8; ++i) if (mask & (1<<i)) tmp[i] = a[i];
+
+    return load8(tmp);
+}
+
+// ***************************************************************************
+// *** SSE2 kernels
+// *** No FMA, so the row updates (c += b*a) are bit identical to the scalar kernels.
+// *** The row sums use several accumulators, so they are summed in a different order.
+// ***************************************************************************
+template <class CELL_TYPE>
+__attribute__((target("sse2")))
+static void multiplyRowSSE2(double *c, const double b, const CELL_TYPE *a, const int n) {
+    __m128d     bval, c0, c1, c2, c3;
+    int         x, head;
+
+    head = ALIGN_HEAD(c, 16, n);
+
+    for (x=0; x<head; ++x) c[x] += b*a[x];
+
+    bval = _mm_set1_pd(b);
+
+    for (; x+8<=n; x+=8) {
+        c0 = _mm_add_pd(_mm_load_pd(&c[x]), _mm_mul_pd(load2(&a[x]), bval));
+        c1 = _mm_add_pd(_mm_load_pd(&c[x+2]), _mm_mul_pd(load2(&a[x+2]), bval));
+        c2 = _mm_add_pd(_mm_load_pd(&c[x+4]), _mm_mul_pd(load2(&a[x+4]), bval));
+        c3 = _mm_add_pd(_mm_load_pd(&c[x+6]), _mm_mul_pd(load2(&a[x+6]), bval));
+        _mm_store_pd(&c[x], c0);
+        _mm_store_pd(&c[x+2], c1);
+        _mm_store_pd(&c[x+4], c2);
+        _mm_store_pd(&c[x+6], c3);
+    }
+
+    for (; x+2<=n; x+=2) {
+        _mm_store_pd(&c[x], _mm_add_pd(_mm_load_pd(&c[x]), _mm_mul_pd(load2(&a[x]), bval)));
+    }
+
+    for (; x<n; ++x) c[x] += b*a[x];
+}
+
+template <class CELL_TYPE>
+__attribute__((target("sse2")))
+static double multiplySumRowSSE2(const double *b, const CELL_TYPE *a, const int n) {
+    __m128d     s0, s1, s2, s3;
+    double      tmp[2], val = 0;
+    int         x, head;
+
+    head = ALIGN_HEAD(a, 16, n);
+
+    for (x=0; x<head; ++x) val += a[x]*b[x];
+
+    s0 = s1 = s2 = s3 = _mm_setzero_pd();
+
+    for (; x+8<=n; x+=8) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(load2(&a[x]), _mm_loadu_pd(&b[x])));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(load2(&a[x+2]), _mm_loadu_pd(&b[x+2])));
+        s2 = _mm_add_pd(s2, _mm_mul_pd(load2(&a[x+4]), _mm_loadu_pd(&b[x+4])));
+        s3 = _mm_add_pd(s3, _mm_mul_pd(load2(&a[x+6]), _mm_loadu_pd(&b[x+6])));
+    }
+
+    for (; x+2<=n; x+=2) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(load2(&a[x]), _mm_loadu_pd(&b[x])));
+    }
+
+    s0 = _mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3));
+    _mm_storeu_pd(tmp, s0);
+    val += tmp[0] + tmp[1];
+
+    for (; x<n; ++x) val += a[x]*b[x];
+
+    return val;
+}
+
+__attribute__((target("sse2")))
+static void addRowSSE2(double *c, const double v, const int n) {
+    __m128d     vval;
+    int         x, head;
+
+    head = ALIGN_HEAD(c, 16, n);
+
+    for (x=0; x<head; ++x) c[x] += v;
+
+    vval = _mm_set1_pd(v);
+
+    for (; x+4<=n; x+=4) {
+        _mm_store_pd(&c[x], _mm_add_pd(_mm_load_pd(&c[x]), vval));
+        _mm_store_pd(&c[x+2], _mm_add_pd(_mm_load_pd(&c[x+2]), vval));
+    }
+
+    for (; x<n; ++x) c[x] += v;
+}
+
+__attribute__((target("sse2")))
+static double sumRowSSE2(const double *b, const int n) {
+    __m128d     s0, s1;
+    double      tmp[2], val = 0;
+    int         x, head;
+
+    head = ALIGN_HEAD(b, 16, n);
+
+    for (x=0; x<head; ++x) val += b[x];
+
+    s0 = s1 = _mm_setzero_pd();
+
+    for (; x+4<=n; x+=4) {
+        s0 = _mm_add_pd(s0, _mm_load_pd(&b[x]));
+        s1 = _mm_add_pd(s1, _mm_load_pd(&b[x+2]));
+    }
+
+    _mm_storeu_pd(tmp, _mm_add_pd(s0, s1));
+    val += tmp[0] + tmp[1];
+
+    for (; x<n; ++x) val += b[x];
+
+    return val;
+}
+
+template <class CELL_TYPE>
+__attribute__((target("sse2")))
+static void multiplyRowPairSSE2(double *c0, double *c1, const double b, const CELL_TYPE *a0, const CELL_TYPE *a1, const int n) {
+    __m128d     bval, s0, s1, n0, n1;
+    int         x, head;
+
+    if (ALIGN_DIFFERS(c0, c1, 16)) {
+        multiplyRowSSE2(c0, b, a0, n);
+        multiplyRowSSE2(c1, b, a1, n);
+        return;
+    }
+
+    head = ALIGN_HEAD(c0, 16, n);
+
+    for (x=0; x<head; ++x) {
+        c0[x] += b*a0[x];
+        c1[x] += b*a1[x];
+    }
+
+    bval = _mm_set1_pd(b);
+
+    for (; x+4<=n; x+=4) {
+        s0 = _mm_add_pd(_mm_load_pd(&c0[x]), _mm_mul_pd(load2(&a0[x]), bval));
+        n0 = _mm_add_pd(_mm_load_pd(&c1[x]), _mm_mul_pd(load2(&a1[x]), bval));
+        s1 = _mm_add_pd(_mm_load_pd(&c0[x+2]), _mm_mul_pd(load2(&a0[x+2]), bval));
+        n1 = _mm_add_pd(_mm_load_pd(&c1[x+2]), _mm_mul_pd(load2(&a1[x+2]), bval));
+        _mm_store_pd(&c0[x], s0);
+        _mm_store_pd(&c1[x], n0);
+        _mm_store_pd(&c0[x+2], s1);
+        _mm_store_pd(&c1[x+2], n1);
+    }
+
+    for (; x+2<=n; x+=2) {
+        _mm_store_pd(&c0[x], _mm_add_pd(_mm_load_pd(&c0[x]), _mm_mul_pd(load2(&a0[x]), bval)));
+        _mm_store_pd(&c1[x], _mm_add_pd(_mm_load_pd(&c1[x]), _mm_mul_pd(load2(&a1[x]), bval)));
+    }
+
+    for (; x<n; ++x) {
+        c0[x] += b*a0[x];
+        c1[x] += b*a1[x];
+    }
+}
+
+// The accumulators of the two rows are interleaved so each loaded value of b is used twice
+template <class CELL_TYPE>
+__attribute__((target("sse2")))
+static void multiplySumRowPairSSE2(double *vals, const double *b, const CELL_TYPE *a0, const CELL_TYPE *a1, const int n) {
+    __m128d     bv, s0, s1, s2, s3, n0, n1, n2, n3;
+    double      tmp[2], val0 = 0, val1 = 0;
+    int         x, head;
+
+    if (ALIGN_DIFFERS(a0, a1, 16)) {
+        vals[0] = multiplySumRowSSE2(b, a0, n);
+        vals[1] = multiplySumRowSSE2(b, a1, n);
+        return;
+    }
+
+    head = ALIGN_HEAD(a0, 16, n);
+
+    for (x=0; x<head; ++x) {
+        val0 += a0[x]*b[x];
+        val1 += a1[x]*b[x];
+    }
+
+    s0 = s1 = s2 = s3 = n0 = n1 = n2 = n3 = _mm_setzero_pd();
+
+    for (; x+8<=n; x+=8) {
+        bv = _mm_loadu_pd(&b[x]);
+        s0 = _mm_add_pd(s0, _mm_mul_pd(load2(&a0[x]), bv));
+        n0 = _mm_add_pd(n0, _mm_mul_pd(load2(&a1[x]), bv));
+        bv = _mm_loadu_pd(&b[x+2]);
+        s1 = _mm_add_pd(s1, _mm_mul_pd(load2(&a0[x+2]), bv));
+        n1 = _mm_add_pd(n1, _mm_mul_pd(load2(&a1[x+2]), bv));
+        bv = _mm_loadu_pd(&b[x+4]);
+        s2 = _mm_add_pd(s2, _mm_mul_pd(load2(&a0[x+4]), bv));
+        n2 = _mm_add_pd(n2, _mm_mul_pd(load2(&a1[x+4]), bv));
+        bv = _mm_loadu_pd(&b[x+6]);
+        s3 = _mm_add_pd(s3, _mm_mul_pd(load2(&a0[x+6]), bv));
+        n3 = _mm_add_pd(n3, _mm_mul_pd(load2(&a1[x+6]), bv));
+    }
+
+    for (; x+2<=n; x+=2) {
+        bv = _mm_loadu_pd(&b[x]);
+        s0 = _mm_add_pd(s0, _mm_mul_pd(load2(&a0[x]), bv));
+        n0 = _mm_add_pd(n0, _mm_mul_pd(load2(&a1[x]), bv));
+    }
+
+    s0 = _mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3));
+    _mm_storeu_pd(tmp, s0);
+    val0 += tmp[0] + tmp[1];
+    n0 = _mm_add_pd(_mm_add_pd(n0, n1), _mm_add_pd(n2, n3));
+    _mm_storeu_pd(tmp, n0);
+    val1 += tmp[0] + tmp[1];
+
+    for (; x<n; ++x) {
+        val0 += a0[x]*b[x];
+        val1 += a1[x]*b[x];
+    }
+
+    vals[0] = val0;
+    vals[1] = val1;
+}
+
+// ***************************************************************************
+// *** AVX2 kernels
+// ***************************************************************************
+template <class CELL_TYPE>
+__attribute__((target("avx2,fma")))
+static void multiplyRowAVX2(double *c, const double b, const CELL_TYPE *a, const int n) {
+    __m256d     bval, c0, c1, c2, c3;
+    int         x, head;
+
+    head = ALIGN_HEAD(c, 32, n);
+
+    for (x=0; x<head; ++x) c[x] += b*a[x];
+
+    bval = _mm256_set1_pd(b);
+
+    for (; x+16<=n; x+=16) {
+        c0 = _mm256_fmadd_pd(load4(&a[x]), bval, _mm256_load_pd(&c[x]));
+        c1 = _mm256_fmadd_pd(load4(&a[x+4]), bval, _mm256_load_pd(&c[x+4]));
+        c2 = _mm256_fmadd_pd(load4(&a[x+8]), bval, _mm256_load_pd(&c[x+8]));
+        c3 = _mm256_fmadd_pd(load4(&a[x+12]), bval, _mm256_load_pd(&c[x+12]));
+        _mm256_store_pd(&c[x], c0);
+        _mm256_store_pd(&c[x+4], c1);
+        _mm256_store_pd(&c[x+8], c2);
+        _mm256_store_pd(&c[x+12], c3);
+    }
+
+    for (; x+4<=n; x+=4) {
+        _mm256_store_pd(&c[x], _mm256_fmadd_pd(load4(&a[x]), bval, _mm256_load_pd(&c[x])));
+    }
+
+    for (; x<n; ++x) c[x] += b*a[x];
+}
+
+template <class CELL_TYPE>
+__attribute__((target("avx2,fma")))
+static double multiplySumRowAVX2(const double *b, const CELL_TYPE *a, const int n) {
+    __m256d     s0, s1, s2, s3;
+    __m128d     lo, hi;
+    double      val = 0;
+    int         x, head;
+
+    head = ALIGN_HEAD(a, 32, n);
+
+    for (x=0; x<head; ++x) val += a[x]*b[x];
+
+    s0 = s1 = s2 = s3 = _mm256_setzero_pd();
+
+    for (; x+16<=n; x+=16) {
+        s0 = _mm256_fmadd_pd(load4(&a[x]), _mm256_loadu_pd(&b[x]), s0);
+        s1 = _mm256_fmadd_pd(load4(&a[x+4]), _mm256_loadu_pd(&b[x+4]), s1);
+        s2 = _mm256_fmadd_pd(load4(&a[x+8]), _mm256_loadu_pd(&b[x+8]), s2);
+        s3 = _mm256_fmadd_pd(load4(&a[x+12]), _mm256_loadu_pd(&b[x+12]), s3);
+    }
+
+    for (; x+4<=n; x+=4) {
+        s0 = _mm256_fmadd_pd(load4(&a[x]), _mm256_loadu_pd(&b[x]), s0);
+    }
+
+    s0 = _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3));
+    lo = _mm256_castpd256_pd128(s0);
+    hi = _mm256_extractf128_pd(s0, 1);
+    lo = _mm_add_pd(lo, hi);
+    val += _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+
+    for (; x<n; ++x) val += a[x]*b[x];
+
+    return val;
+}
+
+template <class CELL_TYPE>
+__attribute__((target("avx2,fma")))
+static void multiplyRowPairAVX2(double *c0, double *c1, const double b, const CELL_TYPE *a0, const CELL_TYPE *a1, const int n) {
+    __m256d     bval, s0, s1, n0, n1;
+    int         x, head;
+
+    if (ALIGN_DIFFERS(c0, c1, 32)) {
+        multiplyRowAVX2(c0, b, a0, n);
+        multiplyRowAVX2(c1, b, a1, n);
+        return;
+    }
+
+    head = ALIGN_HEAD(c0, 32, n);
+
+    for (x=0; x<head; ++x) {
+        c0[x] += b*a0[x];
+        c1[x] += b*a1[x];
+    }
+
+    bval = _mm256_set1_pd(b);
+
+    for (; x+8<=n; x+=8) {
+        s0 = _mm256_fmadd_pd(load4(&a0[x]), bval, _mm256_load_pd(&c0[x]));
+        n0 = _mm256_fmadd_pd(load4(&a1[x]), bval, _mm256_load_pd(&c1[x]));
+        s1 = _mm256_fmadd_pd(load4(&a0[x+4]), bval, _mm256_load_pd(&c0[x+4]));
+        n1 = _mm256_fmadd_pd(load4(&a1[x+4]), bval, _mm256_load_pd(&c1[x+4]));
+        _mm256_store_pd(&c0[x], s0);
+        _mm256_store_pd(&c1[x], n0);
+        _mm256_store_pd(&c0[x+4], s1);
+        _mm256_store_pd(&c1[x+4], n1);
+    }
+
+    for (; x+4<=n; x+=4) {
+        _mm256_store_pd(&c0[x], _mm256_fmadd_pd(load4(&a0[x]), bval, _mm256_load_pd(&c0[x])));
+        _mm256_store_pd(&c1[x], _mm256_fmadd_pd(load4(&a1[x]), bval, _mm256_load_pd(&c1[x])));
+    }
+
+    for (; x<n; ++x) {
+        c0[x] += b*a0[x];
+        c1[x] += b*a1[x];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static inline double reduce4(const __m256d s) {
+    __m128d     lo, hi;
+
+    lo = _mm256_castpd256_pd128(s);
+    hi = _mm256_extractf128_pd(s, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2,fma")))
+static void addRowAVX2(double *c, const double v, const int n) {
+    __m256d     vval;
+    int         x, head;
+
+    head = ALIGN_HEAD(c, 32, n);
+
+    for (x=0; x<head; ++x) c[x] += v;
+
+    vval = _mm256_set1_pd(v);
+
+    for (; x+8<=n; x+=8) {
+        _mm256_store_pd(&c[x], _mm256_add_pd(_mm256_load_pd(&c[x]), vval));
+        _mm256_store_pd(&c[x+4], _mm256_add_pd(_mm256_load_pd(&c[x+4]), vval));
+    }
+
+    for (; x<n; ++x) c[x] += v;
+}
+
+__attribute__((target("avx2,fma")))
+static double sumRowAVX2(const double *b, const int n) {
+    __m256d     s0, s1;
+    double      val = 0;
+    int         x, head;
+
+    head = ALIGN_HEAD(b, 32, n);
+
+    for (x=0; x<head; ++x) val += b[x];
+
+    s0 = s1 = _mm256_setzero_pd();
+
+    for (; x+8<=n; x+=8) {
+        s0 = _mm256_add_pd(s0, _mm256_load_pd(&b[x]));
+        s1 = _mm256_add_pd(s1, _mm256_load_pd(&b[x+4]));
+    }
+
+    val += reduce4(_mm256_add_pd(s0, s1));
+
+    for (; x<n; ++x) val += b[x];
+
+    return val;
+}
+
+template <class CELL_TYPE>
+__attribute__((target("avx2,fma")))
+static void multiplySumRowPairAVX2(double *vals, const double *b, const CELL_TYPE *a0, const CELL_TYPE *a1, const int n) {
+    __m256d     bv, s0, s1, s2, s3, n0, n1, n2, n3;
+    double      val0 = 0, val1 = 0;
+    int         x, head;
+
+    if (ALIGN_DIFFERS(a0, a1, 32)) {
+        vals[0] = multiplySumRowAVX2(b, a0, n);
+        vals[1] = multiplySumRowAVX2(b, a1, n);
+        return;
+    }
+
+    head = ALIGN_HEAD(a0, 32, n);
+
+    for (x=0; x<head; ++x) {
+        val0 += a0[x]*b[x];
+        val1 += a1[x]*b[x];
+    }
+
+    s0 = s1 = s2 = s3 = n0 = n1 = n2 = n3 = _mm256_setzero_pd();
+
+    for (; x+16<=n; x+=16) {
+        bv = _mm256_loadu_pd(&b[x]);
+        s0 = _mm256_fmadd_pd(load4(&a0[x]), bv, s0);
+        n0 = _mm256_fmadd_pd(load4(&a1[x]), bv, n0);
+        bv = _mm256_loadu_pd(&b[x+4]);
+        s1 = _mm256_fmadd_pd(load4(&a0[x+4]), bv, s1);
+        n1 = _mm256_fmadd_pd(load4(&a1[x+4]), bv, n1);
+        bv = _mm256_loadu_pd(&b[x+8]);
+        s2 = _mm256_fmadd_pd(load4(&a0[x+8]), bv, s2);
+        n2 = _mm256_fmadd_pd(load4(&a1[x+8]), bv, n2);
+        bv = _mm256_loadu_pd(&b[x+12]);
+        s3 = _mm256_fmadd_pd(load4(&a0[x+12]), bv, s3);
+        n3 = _mm256_fmadd_pd(load4(&a1[x+12]), bv, n3);
+    }
+
+    for (; x+4<=n; x+=4) {
+        bv = _mm256_loadu_pd(&b[x]);
+        s0 = _mm256_fmadd_pd(load4(&a0[x]), bv, s0);
+        n0 = _mm256_fmadd_pd(load4(&a1[x]), bv, n0);
+    }
+
+    val0 += reduce4(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+    val1 += reduce4(_mm256_add_pd(_mm256_add_pd(n0, n1), _mm256_add_pd(n2, n3)));
+
+    for (; x<n; ++x) {
+        val0 += a0[x]*b[x];
+        val1 += a1[x]*b[x];
+    }
+
+    vals[0] = val0;
+    vals[1] = val1;
+}
+
+// ***************************************************************************
+// *** AVX-512 kernels
+// *** Tails are handled with masked loads/stores instead of a scalar loop.
+// ***************************************************************************
+template <class CELL_TYPE>
+__attribute__((target("avx512f")))
+static void multiplyRowAVX512(double *c, const double b, const CELL_TYPE *a, const int n) {
+    __m512d     bval, c0, c1;
+    __mmask8    mask;
+    int         x, head;
+
+    head = ALIGN_HEAD(c, 64, n);
+
+    for (x=0; x<head; ++x) c[x] += b*a[x];
+
+    bval = _mm512_set1_pd(b);
+
+    for (; x+16<=n; x+=16) {
+        c0 = _mm512_fmadd_pd(load8(&a[x]), bval, _mm512_load_pd(&c[x]));
+        c1 = _mm512_fmadd_pd(load8(&a[x+8]), bval, _mm512_load_pd(&c[x+8]));
+        _mm512_store_pd(&c[x], c0);
+        _mm512_store_pd(&c[x+8], c1);
+    }
+
+    for (; x<n; x+=8) {
+        mask = (n-x >= 8) ? 0xFF : (__mmask8)((1u<<(n-x))-1);
+        c0 = _mm512_fmadd_pd(maskLoad8(mask, &a[x]), bval, _mm512_maskz_loadu_pd(mask, &c[x]));
+        _mm512_mask_storeu_pd(&c[x], mask, c0);
+    }
+}
+
+template <class CELL_TYPE>
+__attribute__((target("avx512f")))
+static double multiplySumRowAVX512(const double *b, const CELL_TYPE *a, const int n) {
+    __m512d     s0, s1;
+    __mmask8    mask;
+    double      val = 0;
+    int         x, head;
+
+    head = ALIGN_HEAD(a, 64, n);
+
+    for (x=0; x<head; ++x) val += a[x]*b[x];
+
+    s0 = s1 = _mm512_setzero_pd();
+
+    for (; x+16<=n; x+=16) {
+        s0 = _mm512_fmadd_pd(load8(&a[x]), _mm512_loadu_pd(&b[x]), s0);
+        s1 = _mm512_fmadd_pd(load8(&a[x+8]), _mm512_loadu_pd(&b[x+8]), s1);
+    }
+
+    for (; x<n; x+=8) {
+        mask = (n-x >= 8) ? 0xFF : (__mmask8)((1u<<(n-x))-1);
+        s0 = _mm512_fmadd_pd(maskLoad8(mask, &a[x]), _mm512_maskz_loadu_pd(mask, &b[x]), s0);
+    }
+
+    return val + _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+}
+
+__attribute__((target("avx512f")))
+static void addRowAVX512(double *c, const double v, const int n) {
+    __m512d     vval;
+    __mmask8    mask;
+    int         x, head;
+
+    head = ALIGN_HEAD(c, 64, n);
+
+    for (x=0; x<head; ++x) c[x] += v;
+
+    vval = _mm512_set1_pd(v);
+
+    for (; x+8<=n; x+=8) _mm512_store_pd(&c[x], _mm512_add_pd(_mm512_load_pd(&c[x]), vval));
+
+    if (x<n) {
+        mask = (__mmask8)((1u<<(n-x))-1);
+        _mm512_mask_storeu_pd(&c[x], mask, _mm512_add_pd(_mm512_maskz_loadu_pd(mask, &c[x]), vval));
+    }
+}
+
+__attribute__((target("avx512f")))
+static double sumRowAVX512(const double *b, const int n) {
+    __m512d     s0;
+    __mmask8    mask;
+    double      val = 0;
+    int         x, head;
+
+    head = ALIGN_HEAD(b, 64, n);
+
+    for (x=0; x<head; ++x) val += b[x];
+
+    s0 = _mm512_setzero_pd();
+
+    for (; x+8<=n; x+=8) s0 = _mm512_add_pd(s0, _mm512_load_pd(&b[x]));
+
+    if (x<n) {
+        mask = (__mmask8)((1u<<(n-x))-1);
+        s0 = _mm512_add_pd(s0, _mm512_maskz_loadu_pd(mask, &b[x]));
+    }
+
+    return val + _mm512_reduce_add_pd(s0);
+}
+
+template <class CELL_TYPE>
+__attribute__((target("avx512f")))
+static void multiplyRowPairAVX512(double *c0, double *c1, const double b, const CELL_TYPE *a0, const CELL_TYPE *a1, const int n) {
+    __m512d     bval, s0, n0;
+    __mmask8    mask;
+    int         x, head;
+
+    if (ALIGN_DIFFERS(c0, c1, 64)) {
+        multiplyRowAVX512(c0, b, a0, n);
+        multiplyRowAVX512(c1, b, a1, n);
+        return;
+    }
+
+    head = ALIGN_HEAD(c0, 64, n);
+
+    for (x=0; x<head; ++x) {
+        c0[x] += b*a0[x];
+        c1[x] += b*a1[x];
+    }
+
+    bval = _mm512_set1_pd(b);
+
+    for (; x+8<=n; x+=8) {
+        s0 = _mm512_fmadd_pd(load8(&a0[x]), bval, _mm512_load_pd(&c0[x]));
+        n0 = _mm512_fmadd_pd(load8(&a1[x]), bval, _mm512_load_pd(&c1[x]));
+        _mm512_store_pd(&c0[x], s0);
+        _mm512_store_pd(&c1[x], n0);
+    }
+
+    if (x<n) {
+        mask = (__mmask8)((1u<<(n-x))-1);
+        s0 = _mm512_fmadd_pd(maskLoad8(mask, &a0[x]), bval, _mm512_maskz_loadu_pd(mask, &c0[x]));
+        n0 = _mm512_fmadd_pd(maskLoad8(mask, &a1[x]), bval, _mm512_maskz_loadu_pd(mask, &c1[x]));
+        _mm512_mask_storeu_pd(&c0[x], mask, s0);
+        _mm512_mask_storeu_pd(&c1[x], mask, n0);
+    }
+}
+
+template <class CELL_TYPE>
+__attribute__((target("avx512f")))
+static void multiplySumRowPairAVX512(double *vals, const double *b, const CELL_TYPE *a0, const CELL_TYPE *a1, const int n) {
+    __m512d     bv, s0, s1, n0, n1;
+    __mmask8    mask;
+    double      val0 = 0, val1 = 0;
+    int         x, head;
+
+    if (ALIGN_DIFFERS(a0, a1, 64)) {
+        vals[0] = multiplySumRowAVX512(b, a0, n);
+        vals[1] = multiplySumRowAVX512(b, a1, n);
+        return;
+    }
+
+    head = ALIGN_HEAD(a0, 64, n);
+
+    for (x=0; x<head; ++x) {
+        val0 += a0[x]*b[x];
+        val1 += a1[x]*b[x];
+    }
+
+    s0 = s1 = n0 = n1 = _mm512_setzero_pd();
+
+    for (; x+16<=n; x+=16) {
+        bv = _mm512_loadu_pd(&b[x]);
+        s0 = _mm512_fmadd_pd(load8(&a0[x]), bv, s0);
+        n0 = _mm512_fmadd_pd(load8(&a1[x]), bv, n0);
+        bv = _mm512_loadu_pd(&b[x+8]);
+        s1 = _mm512_fmadd_pd(load8(&a0[x+8]), bv, s1);
+        n1 = _mm512_fmadd_pd(load8(&a1[x+8]), bv, n1);
+    }
+
+    for (; x<n; x+=8) {
+        mask = (n-x >= 8) ? 0xFF : (__mmask8)((1u<<(n-x))-1);
+        bv = _mm512_maskz_loadu_pd(mask, &b[x]);
+        s0 = _mm512_fmadd_pd(maskLoad8(mask, &a0[x]), bv, s0);
+        n0 = _mm512_fmadd_pd(maskLoad8(mask, &a1[x]), bv, n0);
+    }
+
+    vals[0] = val0 + _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+    vals[1] = val1 + _mm512_reduce_add_pd(_mm512_add_pd(n0, n1));
+}
+
+#endif
+
+// Set the full precision, single precision, quantized and run length versions of a kernel family
+#define SET_KERNELS(ISA)     \
+    _add_row = addRow##ISA;     \
+    _sum_row = sumRow##ISA;     \
+    _multiply_row = multiplyRow##ISA<GREEN_VAL>;        \
+    _multiply_sum_row = multiplySumRow##ISA<GREEN_VAL>;     \
+    _multiply_row_pair = multiplyRowPair##ISA<GREEN_VAL>;       \
+    _multiply_sum_row_pair = multiplySumRowPair##ISA<GREEN_VAL>;    \
+    _multiply_row_single = multiplyRow##ISA<float>;     \
+    _multiply_sum_row_single = multiplySumRow##ISA<float>;  \
+    _multiply_row_pair_single = multiplyRowPair##ISA<float>;    \
+    _multiply_sum_row_pair_single = multiplySumRowPair##ISA<float>;    \
+    _multiply_row_int16 = multiplyRow##ISA<int16_t>;    \
+    _multiply_sum_row_int16 = multiplySumRow##ISA<int16_t>; \
+    _multiply_row_int8 = multiplyRow##ISA<int8_t>;  \
+    _multiply_sum_row_int8 = multiplySumRow##ISA<int8_t>;
+
+GreensKernels::GreensKernels(void) {
+    select(KERNEL_SCALAR);
+}
+
+/*!
+ Returns whether the CPU (and OS) can run the specified kernel family.
+ */
+bool GreensKernels::supported(const MatVecKernel &kernel) {
+    switch (kernel) {
+        case KERNEL_SCALAR:
+            return true;
+#ifdef VQ_X86_KERNELS
+
+        case KERNEL_SSE2:
+            return __builtin_cpu_supports("sse2");
+
+        case KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+        case KERNEL_AVX512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+
+        default:
+            return false;
+    }
+}
+
+MatVecKernel GreensKernels::bestSupported(void) {
+#ifdef VQ_X86_KERNELS
+    __builtin_cpu_init();
+#endif
+
+    if (supported(KERNEL_AVX512)) return KERNEL_AVX512;
+
+    if (supported(KERNEL_AVX2)) return KERNEL_AVX2;
+
+    if (supported(KERNEL_SSE2)) return KERNEL_SSE2;
+
+    return KERNEL_SCALAR;
+}
+
+MatVecKernel GreensKernels::select(const MatVecKernel &requested) {
+    MatVecKernel    best = bestSupported();
+
+    // Kernels are ordered by capability, so anything past the best supported one won't run here
+    _type = (requested == KERNEL_AUTO || requested == KERNEL_UNDEFINED || requested > best) ? best : requested;
+
+    switch (_type) {
+#ifdef VQ_X86_KERNELS
+
+        case KERNEL_SSE2:
+            SET_KERNELS(SSE2);
+            break;
+
+        case KERNEL_AVX2:
+            SET_KERNELS(AVX2);
+            break;
+
+        case KERNEL_AVX512:
+            SET_KERNELS(AVX512);
+            break;
+#endif
+
+        default:
+            _type = KERNEL_SCALAR;
+            SET_KERNELS(Scalar);
+            break;
+    }
+
+    return _type;
+}
+
+MatVecKernel GreensKernels::parseName(const std::string &name) {
+    if (!name.compare("auto")) return KERNEL_AUTO;
+
+    if (!name.compare("scalar")) return KERNEL_SCALAR;
+
+    if (!name.compare("sse2")) return KERNEL_SSE2;
+
+    if (!name.compare("avx2")) return KERNEL_AVX2;
+
+    if (!name.compare("avx512")) return KERNEL_AVX512;
+
+    return KERNEL_UNDEFINED;
+}
+
+std::string GreensKernels::name(const MatVecKernel &kernel) {
+    switch (kernel) {
+        case KERNEL_AUTO:
+            return "auto";
+
+        case KERNEL_SCALAR:
+            return "scalar";
+
+        case KERNEL_SSE2:
+            return "sse2";
+
+        case KERNEL_AVX2:
+            return "avx2";
+
+        case KERNEL_AVX512:
+            return "avx512";
+
+        default:
+            return "undefined";
+    }
+}
@@ -0,0 +1,178 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "Block.h"
+
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+
+#ifndef _GREENS_KERNELS_H_
+#define _GREENS_KERNELS_H_
+
+// Green's matrix rows are padded to a multiple of this many values so the
+// vector kernels can run over whole rows without bounds checks. 16 doubles
+// is two unrolled AVX-512 iterations.
+#define GREEN_ROW_PAD       16
+
+enum MatVecKernel {
+    KERNEL_UNDEFINED,       // unknown kernel name
+    KERNEL_AUTO,            // pick the best kernel supported by this CPU
+    KERNEL_SCALAR,          // plain C++ loops
+    KERNEL_SSE2,            // 128 bit SSE2 (row updates bit identical to the scalar kernel)
+    KERNEL_AVX2,            // 256 bit AVX2 with FMA
+    KERNEL_AVX512           // 512 bit AVX-512F with FMA and masked tails
+};
+
+/*!
+ Family of vectorized kernels used in the Green's matrix-vector multiply.
+ The instruction set is chosen once at startup from the CPU features reported
+ by CPUID, so a single binary runs at full speed on any x86 node. All kernels
+ accept arbitrary pointers and lengths, unaligned heads and short tails are
+ handled separately from the vector body.
+ */
+class GreensKernels {
+    private:
+        MatVecKernel    _type;
+
+        void (*_multiply_row)(double *c, const double b, const GREEN_VAL *a, const int n);
+        double (*_multiply_sum_row)(const double *b, const GREEN_VAL *a, const int n);
+        void (*_multiply_row_single)(double *c, const double b, const float *a, const int n);
+        double (*_multiply_sum_row_single)(const double *b, const float *a, const int n);
+        void (*_multiply_row_pair)(double *c0, double *c1, const double b, const GREEN_VAL *a0, const GREEN_VAL *a1, const int n);
+        void (*_multiply_sum_row_pair)(double *vals, const double *b, const GREEN_VAL *a0, const GREEN_VAL *a1, const int n);
+        void (*_multiply_row_pair_single)(double *c0, double *c1, const double b, const float *a0, const float *a1, const int n);
+        void (*_multiply_sum_row_pair_single)(double *vals, const double *b, const float *a0, const float *a1, const int n);
+        void (*_multiply_row_int16)(double *c, const double b, const int16_t *a, const int n);
+        double (*_multiply_sum_row_int16)(const double *b, const int16_t *a, const int n);
+        void (*_multiply_row_int8)(double *c, const double b, const int8_t *a, const int n);
+        double (*_multiply_sum_row_int8)(const double *b, const int8_t *a, const int n);
+        void (*_add_row)(double *c, const double v, const int n);
+        double (*_sum_row)(const double *b, const int n);
+
+    public:
+        GreensKernels(void);
+
+        //! Select the kernel family to use. Requests the CPU can't run fall
+        //! back to the best supported kernel. Returns the selected kernel.
+        MatVecKernel select(const MatVecKernel &requested);
+
+        MatVecKernel type(void) const {
+            return _type;
+        };
+
+        //! c[0..n) += b*a[0..n)
+        void multiplyRow(double *c, const double b, const GREEN_VAL *a, const int n) const {
+            _multiply_row(c, b, a, n);
+        };
+
+        //! Returns the dot product of b[0..n) and a[0..n)
+        double multiplySumRow(const double *b, const GREEN_VAL *a, const int n) const {
+            return _multiply_sum_row(b, a, n);
+        };
+
+        //! Single precision matrix versions, values are widened and accumulated in double
+        void multiplyRow(double *c, const double b, const float *a, const int n) const {
+            _multiply_row_single(c, b, a, n);
+        };
+        double multiplySumRow(const double *b, const float *a, const int n) const {
+            return _multiply_sum_row_single(b, a, n);
+        };
+
+        //! Quantized matrix versions working on the integer codes, which are widened
+        //! to double in registers. The caller applies the scale and offset of the row.
+        void multiplyRow(double *c, const double b, const int16_t *a, const int n) const {
+            _multiply_row_int16(c, b, a, n);
+        };
+        double multiplySumRow(const double *b, const int16_t *a, const int n) const {
+            return _multiply_sum_row_int16(b, a, n);
+        };
+        void multiplyRow(double *c, const double b, const int8_t *a, const int n) const {
+            _multiply_row_int8(c, b, a, n);
+        };
+        double multiplySumRow(const double *b, const int8_t *a, const int n) const {
+            return _multiply_sum_row_int8(b, a, n);
+        };
+
+        //! Run length encoded versions working on quakelib::CompressedRow runs. Each
+        //! run is applied as a single broadcast value (or a single sum of b) times
+        //! the run value, so the row never has to be decompressed. Runs of zeros
+        //! are skipped.
+        //! c[first..last) += b*row[first..last)
+        template <class CELL_TYPE>
+        void multiplyRuns(double *c, const double b, const quakelib::RowRun<CELL_TYPE> *runs, const unsigned int num_runs, const int first, const int last) const {
+            int             start, end, p;
+            unsigned int    i;
+
+            for (i=0,p=0; i<num_runs && p<last; ++i,p=end) {
+                end = p+runs[i]._length;
+
+                if (!runs[i]._val || end <= first) continue;
+
+                start = std::max(p, first);
+                _add_row(&(c[start]), b*runs[i]._val, std::min(end, last)-start);
+            }
+        };
+
+        //! Returns the dot product of b[0..n) and the row
+        template <class CELL_TYPE>
+        double multiplySumRuns(const double *b, const quakelib::RowRun<CELL_TYPE> *runs, const unsigned int num_runs, const int n) const {
+            double          val = 0;
+            int             p;
+            unsigned int    i;
+
+            for (i=0,p=0; i<num_runs && p<n; p+=runs[i]._length,++i) {
+                if (runs[i]._val) val += runs[i]._val*_sum_row(&(b[p]), std::min(runs[i]._length, n-p));
+            }
+
+            return val;
+        };
+
+        //! Fused versions for two matrices sharing the same vector, used to compute
+        //! shear and normal stress in one pass. Each output gets exactly the same
+        //! result as the corresponding single row kernel.
+        //! c0[0..n) += b*a0[0..n), c1[0..n) += b*a1[0..n)
+        void multiplyRowPair(double *c0, double *c1, const double b, const GREEN_VAL *a0, const GREEN_VAL *a1, const int n) const {
+            _multiply_row_pair(c0, c1, b, a0, a1, n);
+        };
+        void multiplyRowPair(double *c0, double *c1, const double b, const float *a0, const float *a1, const int n) const {
+            _multiply_row_pair_single(c0, c1, b, a0, a1, n);
+        };
+
+        //! vals[0] = dot(b, a0), vals[1] = dot(b, a1)
+        void multiplySumRowPair(double *vals, const double *b, const GREEN_VAL *a0, const GREEN_VAL *a1, const int n) const {
+            _multiply_sum_row_pair(vals, b, a0, a1, n);
+        };
+        void multiplySumRowPair(double *vals, const double *b, const float *a0, const float *a1, const int n) const {
+            _multiply_sum_row_pair_single(vals, b, a0, a1, n);
+        };
+
+        static MatVecKernel bestSupported(void);
+        static bool supported(const MatVecKernel &kernel);
+        static MatVecKernel parseName(const std::string &name);
+        static std::string name(const MatVecKernel &kernel);
+
+        //! Round a row length up to the kernel padding.
+        static unsigned int padSize(const unsigned int &n) {
+            return (n/GREEN_ROW_PAD+1)*GREEN_ROW_PAD;
+        };
+};
+
+#endif
@@ -0,0 +1,190 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "GreensMatrix.h"
+
+/*!
+ Create a matrix of the specified storage type and layout.
+ */
+template <class CELL_TYPE>
+static quakelib::DenseMatrix<CELL_TYPE> *createMatrix(const unsigned int &ncols,
+                                                      const unsigned int &nrows,
+                                                      const bool &compressed,
+                                                      const bool &transposed,
+                                                      const bool &hierarchical,
+                                                      const bool &deferred_init) {
+    if (hierarchical) return new quakelib::HMatrix<CELL_TYPE>(ncols, nrows);
+
+    if (compressed) {
+        if (transposed) return new quakelib::CompressedRowMatrixTranspose<CELL_TYPE>(ncols, nrows);
+        else return new quakelib::CompressedRowMatrixStraight<CELL_TYPE>(ncols, nrows);
+    } else {
+        if (transposed) return new quakelib::DenseStdTranspose<CELL_TYPE>(ncols, nrows, !deferred_init);
+        else return new quakelib::DenseStdStraight<CELL_TYPE>(ncols, nrows, !deferred_init);
+    }
+}
+
+GreensMatrix::GreensMatrix(const GreensStorage &storage,
+                           const unsigned int &ncols,
+                           const unsigned int &nrows,
+                           const bool &compressed,
+                           const bool &transposed,
+                           const bool &hierarchical,
+                           const bool &deferred_init) : _storage(storage), _ncols(ncols), _nrows(nrows), _hierarchical(hierarchical), _sparse(false), _quantized(false), _full(NULL), _single(NULL) {
+    switch (storage) {
+        case GREENS_STORAGE_FLOAT:
+        case GREENS_STORAGE_INT16:
+        case GREENS_STORAGE_INT8:
+            _single = createMatrix<float>(ncols, nrows, compressed, transposed, hierarchical, deferred_init);
+            break;
+
+        case GREENS_STORAGE_DOUBLE:
+            _full = createMatrix<GREEN_VAL>(ncols, nrows, compressed, transposed, hierarchical, deferred_init);
+            break;
+
+        default:
+            assertThrow(false, "Unknown Greens matrix storage type.");
+    }
+}
+
+GreensMatrix::~GreensMatrix(void) {
+    if (_full) delete _full;
+
+    if (_single) delete _single;
+}
+
+/*!
+ Replace a matrix by a quakelib::SparseRowMatrix of its nonzero values with the same
+ layout, unless that would take more memory. Returns whether the matrix was replaced.
+ */
+template <class CELL_TYPE>
+static bool sparsifyMatrix(quakelib::DenseMatrix<CELL_TYPE> *&mat, const unsigned int &ncols, const unsigned int &nrows) {
+    quakelib::SparseRowMatrix<CELL_TYPE>    *sparse_mat;
+    std::vector<CELL_TYPE>                  buf(ncols);
+    const CELL_TYPE                         *row;
+    unsigned long                           num_nonzero;
+    unsigned int                            r, c;
+
+    // Count the nonzero values first so the sparse matrix is only allocated once
+    num_nonzero = 0;
+
+    for (r=0; r<nrows; ++r) {
+        row = (mat->transpose() ? mat->getCol(&buf[0], r) : mat->getRow(&buf[0], r));
+
+        for (c=0; c<ncols; ++c) if (row[c] != 0) num_nonzero++;
+    }
+
+    if (quakelib::SparseRowMatrix<CELL_TYPE>::mem_bytes(nrows, num_nonzero) >= mat->mem_bytes()) return false;
+
+    sparse_mat = new quakelib::SparseRowMatrix<CELL_TYPE>(ncols, nrows, mat->transpose(), num_nonzero);
+
+    for (r=0; r<nrows; ++r) {
+        sparse_mat->setRow(r, (mat->transpose() ? mat->getCol(&buf[0], r) : mat->getRow(&buf[0], r)));
+    }
+
+    delete mat;
+    mat = sparse_mat;
+
+    return true;
+}
+
+/*!
+ Store only the nonzero values of the matrix, for example after the interactions beyond
+ the kill distance were set to zero. The multiplication then uses a sparse kernel.
+ Hierarchical matrices are left as they are.
+ */
+bool GreensMatrix::sparsify(void) {
+    if (_hierarchical || _sparse) return _sparse;
+
+    if (_single) _sparse = sparsifyMatrix<float>(_single, _ncols, _nrows);
+    else _sparse = sparsifyMatrix<GREEN_VAL>(_full, _ncols, _nrows);
+
+    return _sparse;
+}
+
+/*!
+ Replace a single precision matrix of quantized storage type by integer codes with
+ a scale and offset per stored row. The value in column exact_cols[r] of each local
+ row r, normally the self interaction, keeps its full precision. Sparse and hierarchical
+ matrices are not quantized. Returns whether the matrix was quantized.
+ */
+bool GreensMatrix::quantize(const std::vector<unsigned int> &exact_cols) {
+    quakelib::DenseMatrix<double>   *quantized_mat;
+
+    if (_quantized) return true;
+
+    if (!_single || _sparse || _hierarchical) return false;
+
+    switch (_storage) {
+        case GREENS_STORAGE_INT16:
+            quantized_mat = new quakelib::QuantizedRowMatrix<int16_t>(*_single, _ncols, _nrows, exact_cols);
+            break;
+
+        case GREENS_STORAGE_INT8:
+            quantized_mat = new quakelib::QuantizedRowMatrix<int8_t>(*_single, _ncols, _nrows, exact_cols);
+            break;
+
+        default:
+            return false;
+    }
+
+    delete _single;
+    _single = NULL;
+    _full = quantized_mat;
+    _quantized = true;
+
+    return true;
+}
+
+/*!
+ Build a hierarchical matrix from the element locations and extents, see quakelib::HMatrix.
+ */
+void GreensMatrix::buildHierarchical(const std::vector<quakelib::Vec<3> > &row_pts,
+                                     const std::vector<double> &row_radii,
+                                     const std::vector<quakelib::Vec<3> > &col_pts,
+                                     const std::vector<double> &col_radii,
+                                     quakelib::HMatrixEntryGenerator *gen,
+                                     const double &tolerance,
+                                     const double &eta,
+                                     const unsigned int &leaf_size) {
+    assertThrow(_hierarchical, "Greens matrix is not hierarchical.");
+
+    if (_single) static_cast<quakelib::HMatrix<float> *>(_single)->build(row_pts, row_radii, col_pts, col_radii, gen, tolerance, eta, leaf_size);
+    else static_cast<quakelib::HMatrix<GREEN_VAL> *>(_full)->build(row_pts, row_radii, col_pts, col_radii, gen, tolerance, eta, leaf_size);
+}
+
+void GreensMatrix::multiplyAccumHierarchical(double *y, const double *x) const {
+    if (_single) static_cast<const quakelib::HMatrix<float> *>(_single)->multiplyAccum(y, x);
+    else static_cast<const quakelib::HMatrix<GREEN_VAL> *>(_full)->multiplyAccum(y, x);
+}
+
+void GreensMatrix::hierarchicalStats(unsigned int &num_dense, unsigned int &num_low_rank, unsigned int &max_rank) const {
+    if (_single) {
+        const quakelib::HMatrix<float> *m = static_cast<const quakelib::HMatrix<float> *>(_single);
+        num_dense = m->num_dense_blocks();
+        num_low_rank = m->num_low_rank_blocks();
+        max_rank = m->max_rank();
+    } else {
+        const quakelib::HMatrix<GREEN_VAL> *m = static_cast<const quakelib::HMatrix<GREEN_VAL> *>(_full);
+        num_dense = m->num_dense_blocks();
+        num_low_rank = m->num_low_rank_blocks();
+        max_rank = m->max_rank();
+    }
+}
@@ -0,0 +1,194 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "Block.h"
+#include "Params.h"
+
+#ifndef _GREENS_MATRIX_H_
+#define _GREENS_MATRIX_H_
+
+/*!
+ Green's function matrix with a storage precision chosen at runtime.
+ Values are always read and written as doubles, but the matrix-vector
+ multiplication runs directly on the stored values. With float storage this
+ halves the memory and bandwidth of the matrices while stresses are still
+ accumulated in double precision. Exactly one of the typed matrices is set.
+ Quantized (int16 or int8) matrices are filled in single precision and then
+ replaced by a quakelib::QuantizedRowMatrix in the full precision slot, see quantize().
+ */
+class GreensMatrix {
+    private:
+        GreensStorage                       _storage;
+        unsigned int                        _ncols, _nrows;
+        bool                                _hierarchical;
+        bool                                _sparse;
+        bool                                _quantized;
+        quakelib::DenseMatrix<GREEN_VAL>    *_full;
+        quakelib::DenseMatrix<float>        *_single;
+
+    public:
+        GreensMatrix(const GreensStorage &storage,
+                     const unsigned int &ncols,
+                     const unsigned int &nrows,
+                     const bool &compressed,
+                     const bool &transposed,
+                     const bool &hierarchical=false,
+                     const bool &deferred_init=false);
+        ~GreensMatrix(void);
+
+        GreensStorage storage(void) const {
+            return _storage;
+        };
+
+        //! The matrix if stored in full (GREEN_VAL) precision, otherwise NULL.
+        quakelib::DenseMatrix<GREEN_VAL> *fullMatrix(void) const {
+            return _full;
+        };
+        //! The matrix if stored in single precision, otherwise NULL.
+        quakelib::DenseMatrix<float> *singleMatrix(void) const {
+            return _single;
+        };
+
+        double val(const unsigned int &row, const unsigned int &col) const {
+            return (_single ? _single->val(row, col) : _full->val(row, col));
+        };
+        void setVal(const unsigned int &row, const unsigned int &col, const double &new_val) {
+            if (_single) _single->setVal(row, col, new_val);
+            else _full->setVal(row, col, new_val);
+        };
+
+        void allocateRow(const unsigned int &row) {
+            if (_single) _single->allocateRow(row);
+            else _full->allocateRow(row);
+        };
+        bool compressRow(const unsigned int &row, const float &ratio) {
+            return (_single ? _single->compressRow(row, ratio) : _full->compressRow(row, ratio));
+        };
+        bool decompressRow(const unsigned int &row) {
+            return (_single ? _single->decompressRow(row) : _full->decompressRow(row));
+        };
+
+        //! Whether the matrix is a quakelib::HMatrix. These are filled in with
+        //! buildHierarchical() and multiplied with multiplyAccumHierarchical().
+        bool hierarchical(void) const {
+            return _hierarchical;
+        };
+        void buildHierarchical(const std::vector<quakelib::Vec<3> > &row_pts,
+                               const std::vector<double> &row_radii,
+                               const std::vector<quakelib::Vec<3> > &col_pts,
+                               const std::vector<double> &col_radii,
+                               quakelib::HMatrixEntryGenerator *gen,
+                               const double &tolerance,
+                               const double &eta,
+                               const unsigned int &leaf_size);
+        //! y[local row] += sum of this[local row][global col]*x[global col]
+        void multiplyAccumHierarchical(double *y, const double *x) const;
+        void hierarchicalStats(unsigned int &num_dense, unsigned int &num_low_rank, unsigned int &max_rank) const;
+
+        //! Whether the matrix is a quakelib::SparseRowMatrix, see sparsify().
+        bool sparse(void) const {
+            return _sparse;
+        };
+        bool sparsify(void);
+        //! The sparse matrix if stored sparsely in full (GREEN_VAL) precision, otherwise NULL.
+        const quakelib::SparseRowMatrix<GREEN_VAL> *sparseFullMatrix(void) const {
+            return (_sparse && _full ? static_cast<const quakelib::SparseRowMatrix<GREEN_VAL> *>(_full) : NULL);
+        };
+        //! The sparse matrix if stored sparsely in single precision, otherwise NULL.
+        const quakelib::SparseRowMatrix<float> *sparseSingleMatrix(void) const {
+            return (_sparse && _single ? static_cast<const quakelib::SparseRowMatrix<float> *>(_single) : NULL);
+        };
+        //! Whether the matrix was quantized to integer codes, see quantize().
+        bool quantized(void) const {
+            return _quantized;
+        };
+        bool quantize(const std::vector<unsigned int> &exact_cols);
+        //! The quantized matrix if stored with 16 bit codes, otherwise NULL.
+        const quakelib::QuantizedRowMatrix<int16_t> *quantized16Matrix(void) const {
+            return (_quantized && _storage == GREENS_STORAGE_INT16 ? static_cast<const quakelib::QuantizedRowMatrix<int16_t> *>(_full) : NULL);
+        };
+        //! The quantized matrix if stored with 8 bit codes, otherwise NULL.
+        const quakelib::QuantizedRowMatrix<int8_t> *quantized8Matrix(void) const {
+            return (_quantized && _storage == GREENS_STORAGE_INT8 ? static_cast<const quakelib::QuantizedRowMatrix<int8_t> *>(_full) : NULL);
+        };
+        //! The matrix if stored as run length compressed rows in full (GREEN_VAL) precision, otherwise NULL.
+        const quakelib::CompressedRowMatrix<GREEN_VAL> *compressedFullMatrix(void) const {
+            return (_full && _full->compressed() ? static_cast<const quakelib::CompressedRowMatrix<GREEN_VAL> *>(_full) : NULL);
+        };
+        //! The matrix if stored as run length compressed rows in single precision, otherwise NULL.
+        const quakelib::CompressedRowMatrix<float> *compressedSingleMatrix(void) const {
+            return (_single && _single->compressed() ? static_cast<const quakelib::CompressedRowMatrix<float> *>(_single) : NULL);
+        };
+
+        //! Number of values stored by a sparse matrix, 0 if the matrix is not sparse.
+        unsigned long numNonzero(void) const {
+            if (!_sparse) return 0;
+
+            return (_single ? sparseSingleMatrix()->num_nonzero() : sparseFullMatrix()->num_nonzero());
+        };
+
+        //! Whether the matrix is an uncompressed quakelib::DenseStd.
+        bool dense(void) const {
+            return (!_hierarchical && !_sparse && !_quantized && !compressed());
+        };
+        //! Start of the values of a dense matrix, otherwise NULL.
+        void *denseData(void) const {
+            if (!dense()) return NULL;
+
+            return (_single ? (void *)static_cast<quakelib::DenseStd<float> *>(_single)->data() : (void *)static_cast<quakelib::DenseStd<GREEN_VAL> *>(_full)->data());
+        };
+        //! Zero local rows [first, last) of a dense matrix. Matrices created with
+        //! deferred_init must have every row cleared this way before they are used.
+        void clearRows(const unsigned int &first, const unsigned int &last) {
+            if (!dense()) return;
+
+            if (_single) static_cast<quakelib::DenseStd<float> *>(_single)->clearRows(first, last);
+            else static_cast<quakelib::DenseStd<GREEN_VAL> *>(_full)->clearRows(first, last);
+        };
+
+        bool transpose(void) const {
+            return (_single ? _single->transpose() : _full->transpose());
+        };
+        bool compressed(void) const {
+            return (_single ? _single->compressed() : _full->compressed());
+        };
+        unsigned long mem_bytes(void) const {
+            return (_single ? _single->mem_bytes() : _full->mem_bytes());
+        };
+
+        //! Number of bytes used to store each matrix value during the simulation.
+        static unsigned int valSize(const GreensStorage &storage) {
+            switch (storage) {
+                case GREENS_STORAGE_FLOAT:
+                    return sizeof(float);
+
+                case GREENS_STORAGE_INT16:
+                    return sizeof(int16_t);
+
+                case GREENS_STORAGE_INT8:
+                    return sizeof(int8_t);
+
+                default:
+                    return sizeof(GREEN_VAL);
+            }
+        };
+};
+
+#endif
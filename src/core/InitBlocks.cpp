@@ -42,6 +42,7 @@ void VCInitBlocks::dryRun(SimFramework *_sim) {
 void VCInitBlocks::init(SimFramework *_sim) {
     Simulation            *sim = static_cast<Simulation *>(_sim);
     BlockList::iterator     bit;
+    int                     lid;
 
     // this assertion can fail if the geometry (faults) file is corrupt. if you see this failing:
     // 1) check the config file; make sure the right files are selected, etc.
@@ -59,7 +60,14 @@ void VCInitBlocks::init(SimFramework *_sim) {
                      // use compressed array for Barnes Hut style Greens function calculations
                      sim->getGreensCalcMethod()==GREENS_CALC_BARNES_HUT,
                      // transposed array for faster sweep calculations
-                     sim->useTransposedMatrix());
+                     sim->useTransposedMatrix(),
+                     sim->getGreensStorage(),
+                     sim->useHMatrix(),
+                     // let placeGreens() touch the matrix pages from the threads using them
+                     sim->getNUMAPlacement() != NUMA_PLACEMENT_NONE);
+    sim->placeGreens();
+
+    for (lid=0; lid<sim->numLocalBlocks(); ++lid) sim->setLocalBlock(lid, sim->getGlobalBID(lid));
 
     // Set the starting year of the simulation
     // If it has already been set by reading in a stress file, do not overwrite it
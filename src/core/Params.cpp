@@ -60,6 +60,11 @@ void VCParams::read_params(const std::string &param_file_name) {
     // controls how much smoothing occurs in Barnes-Hut approximation
     params.readSet<double>("sim.greens.bh_theta", 0.0);
     params.readSet<string>("sim.greens.input", "");
+    params.readSet<string>("sim.greens.storage", "double");
+    params.readSet<bool>("sim.greens.use_hmatrix", false);
+    params.readSet<double>("sim.greens.hmatrix_tolerance", 1e-4);
+    params.readSet<double>("sim.greens.hmatrix_eta", 2.0);
+    params.readSet<unsigned int>("sim.greens.hmatrix_leaf_size", 32);
 
     params.readSet<unsigned int>("sim.bass.max_generations", 0);
     params.readSet<double>("sim.bass.mm", 4.0);
@@ -71,8 +76,22 @@ void VCParams::read_params(const std::string &param_file_name) {
     params.readSet<double>("sim.bass.q", 1.35);
 
     params.readSet<bool>("sim.system.sanity_check", false);
+    params.readSet<bool>("sim.system.sparse_sweep_updates", true);
     params.readSet<bool>("sim.greens.use_normal", true);
     params.readSet<bool>("sim.system.transpose_matrix", true);
+    params.readSet<string>("sim.system.matvec_kernel", "auto");
+    params.readSet<int>("sim.system.num_threads", 1);
+    params.readSet<string>("sim.system.numa_placement", "first_touch");
+    params.readSet<string>("sim.system.thread_affinity", "none");
+    params.readSet<string>("sim.system.partition_method", "rcb");
+    params.readSet<string>("sim.system.slip_solver", "lu");
+    params.readSet<bool>("sim.system.incremental_slip_solver", true);
+    params.readSet<int>("sim.system.krylov_min_size", 2000);
+    params.readSet<double>("sim.system.krylov_tolerance", 1e-10);
+    params.readSet<int>("sim.system.krylov_max_iterations", 1000);
+    params.readSet<double>("sim.system.sparse_exchange_threshold", 0.5);
+    params.readSet<bool>("sim.system.overlap_exchange", false);
+    params.readSet<bool>("sim.system.shared_greens", false);
 
     params.readSet<string>("sim.file.input", "");
     params.readSet<string>("sim.file.input_type", "");
@@ -35,6 +35,44 @@ enum GreensCalcMethod {
     GREENS_CALC_STANDARD        // use the new Okada class to calculate Greens functions
 };
 
+enum GreensStorage {
+    GREENS_STORAGE_UNDEFINED,   // undefined Greens matrix storage
+    GREENS_STORAGE_DOUBLE,      // store Greens matrices in double precision
+    GREENS_STORAGE_FLOAT,       // store Greens matrices in single precision, accumulate in double
+    GREENS_STORAGE_INT16,       // store Greens matrices as 16 bit codes with a scale and offset per row
+    GREENS_STORAGE_INT8         // store Greens matrices as 8 bit codes with a scale and offset per row
+};
+
+enum NUMAPlacement {
+    NUMA_PLACEMENT_UNDEFINED,   // undefined Greens matrix page placement
+    NUMA_PLACEMENT_NONE,        // pages are touched by the allocating thread
+    NUMA_PLACEMENT_FIRST_TOUCH, // each thread first touches the matrix rows it multiplies
+    NUMA_PLACEMENT_INTERLEAVE   // pages are interleaved over all NUMA nodes (requires libnuma)
+};
+
+enum SlipSolver {
+    SLIP_SOLVER_UNDEFINED,      // undefined secondary failure slip solver
+    SLIP_SOLVER_LU,             // blocked LU factorization with partial pivoting
+    SLIP_SOLVER_LAPACK,         // LAPACK dgetrf/dgetrs (requires LAPACK at compile time)
+    SLIP_SOLVER_KRYLOV          // restarted GMRES for large systems, LU for small ones
+};
+
+enum PartitionMethod {
+    PARTITION_UNDEFINED,        // undefined partitioning method
+    PARTITION_BLOCK,            // consecutive block IDs on each node
+    PARTITION_DISTANCE,         // blocks nearest to a starting block on the same fault
+    PARTITION_RCB,              // recursive coordinate bisection
+    PARTITION_SFC,              // Hilbert space filling curve
+    PARTITION_GRAPH             // coupling graph refinement of recursive coordinate bisection
+};
+
+enum ThreadAffinity {
+    THREAD_AFFINITY_UNDEFINED,  // undefined thread pinning
+    THREAD_AFFINITY_NONE,       // threads are not pinned
+    THREAD_AFFINITY_COMPACT,    // thread t is pinned to the t-th CPU available to the process
+    THREAD_AFFINITY_SPREAD      // threads are pinned evenly across the CPUs available to the process
+};
+
 /*!
  The set of possible parameters for a VC simulation.
  These are described in detail in the example/sample_params.d file.
@@ -97,9 +135,36 @@ class VCParams {
         double getBarnesHutTheta(void) const {
             return params.read<double>("sim.greens.bh_theta");
         };
+        GreensStorage getGreensStorage(void) const {
+            std::string greens_storage = params.read<string>("sim.greens.storage");
+
+            if (!greens_storage.compare("double")) return GREENS_STORAGE_DOUBLE;
+
+            if (!greens_storage.compare("float")) return GREENS_STORAGE_FLOAT;
+
+            if (!greens_storage.compare("int16")) return GREENS_STORAGE_INT16;
+
+            if (!greens_storage.compare("int8")) return GREENS_STORAGE_INT8;
+
+            return GREENS_STORAGE_UNDEFINED;
+        };
         std::string getGreensInputfile(void) const {
             return params.read<string>("sim.greens.input");
         };
+        bool useHMatrix(void) const {
+            return params.read<bool>("sim.greens.use_hmatrix");
+        };
+        //! Relative accuracy of the adaptive cross approximation of far-field blocks
+        double getHMatrixTolerance(void) const {
+            return params.read<double>("sim.greens.hmatrix_tolerance");
+        };
+        //! Admissibility parameter, clusters are far-field if min(diam) <= eta*dist
+        double getHMatrixEta(void) const {
+            return params.read<double>("sim.greens.hmatrix_eta");
+        };
+        unsigned int getHMatrixLeafSize(void) const {
+            return params.read<unsigned int>("sim.greens.hmatrix_leaf_size");
+        };
 
         unsigned int getBASSMaxGenerations(void) const {
             return params.read<unsigned int>("sim.bass.max_generations");
@@ -129,12 +194,107 @@ class VCParams {
         bool doSanityCheck(void) const {
             return params.read<bool>("sim.system.sanity_check");
         };
+        bool doSparseSweepUpdates(void) const {
+            return params.read<bool>("sim.system.sparse_sweep_updates");
+        };
         bool doNormalStress(void) const {
             return params.read<bool>("sim.greens.use_normal");
         };
         bool useTransposedMatrix(void) const {
             return params.read<bool>("sim.system.transpose_matrix");
         };
+        std::string getMatVecKernel(void) const {
+            return params.read<string>("sim.system.matvec_kernel");
+        };
+        int getNumThreads(void) const {
+            return params.read<int>("sim.system.num_threads");
+        };
+        std::string getNUMAPlacementName(void) const {
+            return params.read<string>("sim.system.numa_placement");
+        };
+        NUMAPlacement getNUMAPlacement(void) const {
+            std::string numa_placement = getNUMAPlacementName();
+
+            if (!numa_placement.compare("none")) return NUMA_PLACEMENT_NONE;
+
+            if (!numa_placement.compare("first_touch")) return NUMA_PLACEMENT_FIRST_TOUCH;
+
+            if (!numa_placement.compare("interleave")) return NUMA_PLACEMENT_INTERLEAVE;
+
+            return NUMA_PLACEMENT_UNDEFINED;
+        };
+        std::string getThreadAffinityName(void) const {
+            return params.read<string>("sim.system.thread_affinity");
+        };
+        ThreadAffinity getThreadAffinity(void) const {
+            std::string thread_affinity = getThreadAffinityName();
+
+            if (!thread_affinity.compare("none")) return THREAD_AFFINITY_NONE;
+
+            if (!thread_affinity.compare("compact")) return THREAD_AFFINITY_COMPACT;
+
+            if (!thread_affinity.compare("spread")) return THREAD_AFFINITY_SPREAD;
+
+            return THREAD_AFFINITY_UNDEFINED;
+        };
+
+        std::string getPartitionMethodName(void) const {
+            return params.read<string>("sim.system.partition_method");
+        };
+        PartitionMethod getPartitionMethod(void) const {
+            std::string partition_method = getPartitionMethodName();
+
+            if (!partition_method.compare("block")) return PARTITION_BLOCK;
+
+            if (!partition_method.compare("distance")) return PARTITION_DISTANCE;
+
+            if (!partition_method.compare("rcb")) return PARTITION_RCB;
+
+            if (!partition_method.compare("sfc")) return PARTITION_SFC;
+
+            if (!partition_method.compare("graph")) return PARTITION_GRAPH;
+
+            return PARTITION_UNDEFINED;
+        };
+
+        SlipSolver getSlipSolver(void) const {
+            std::string slip_solver = params.read<string>("sim.system.slip_solver");
+
+            if (!slip_solver.compare("lu")) return SLIP_SOLVER_LU;
+
+            if (!slip_solver.compare("lapack")) return SLIP_SOLVER_LAPACK;
+
+            if (!slip_solver.compare("krylov")) return SLIP_SOLVER_KRYLOV;
+
+            return SLIP_SOLVER_UNDEFINED;
+        };
+        //! Whether direct secondary failure solves extend the factors of the previous sweep
+        bool useIncrementalSlipSolver(void) const {
+            return params.read<bool>("sim.system.incremental_slip_solver");
+        };
+        //! Smallest secondary failure system solved with GMRES when the slip solver is krylov
+        int getKrylovMinSize(void) const {
+            return params.read<int>("sim.system.krylov_min_size");
+        };
+        //! Relative residual at which GMRES stops
+        double getKrylovTolerance(void) const {
+            return params.read<double>("sim.system.krylov_tolerance");
+        };
+        int getKrylovMaxIterations(void) const {
+            return params.read<int>("sim.system.krylov_max_iterations");
+        };
+        //! Whether stress recomputes multiply the local columns while the update field is exchanged
+        bool doOverlapExchange(void) const {
+            return params.read<bool>("sim.system.overlap_exchange");
+        };
+        //! Whether the standard Greens calculation keeps the unsymmetrized rows in memory shared on each node
+        bool useSharedGreens(void) const {
+            return params.read<bool>("sim.system.shared_greens");
+        };
+        //! Largest fraction of changed update field values exchanged as (block, value) pairs
+        double getSparseExchangeThreshold(void) const {
+            return params.read<double>("sim.system.sparse_exchange_threshold");
+        };
 
         std::string getModelFile(void) const {
             return params.read<string>("sim.file.input");
@@ -24,34 +24,35 @@
 /*!
  Allocate and initialize the arrays needed for a VC simulation.
  These include the shear and normal Greens function matrices
- and stress value arrays.
+ (stored with the specified precision, optionally as H-matrices) and stress value arrays.
  */
 void VCSimData::setupArrays(const unsigned int &global_sys_size,
                             const unsigned int &local_sys_size,
                             const bool &compressed,
-                            const bool &transposed) {
+                            const bool &transposed,
+                            const GreensStorage &storage,
+                            const bool &hierarchical,
+                            const bool &deferred_init) {
     deallocateArrays();
 
     global_size = global_sys_size;
-    // Make the local size a factor of 16 to allow SSE loop unrolling
-    local_size = local_sys_size+(16-local_sys_size%16);
-
-    if (compressed) {
-        if (transposed) {
-            green_shear = new quakelib::CompressedRowMatrixTranspose<GREEN_VAL>(local_size, global_size);
-            green_normal = new quakelib::CompressedRowMatrixTranspose<GREEN_VAL>(local_size, global_size);
-        } else {
-            green_shear = new quakelib::CompressedRowMatrixStraight<GREEN_VAL>(local_size, global_size);
-            green_normal = new quakelib::CompressedRowMatrixStraight<GREEN_VAL>(local_size, global_size);
-        }
+    // Pad the local size so the vector kernels can run over whole matrix columns
+    local_size = GreensKernels::padSize(local_sys_size);
+    // Straight matrices are stored by row, so their rows are padded instead
+    padded_global_size = GreensKernels::padSize(global_sys_size);
+
+    // Transposed matrices are stored by column, straight matrices by row.
+    // Hierarchical matrices have their own block layout. With deferred_init the
+    // dense matrices are left untouched so each thread can clear its own rows.
+    if (hierarchical) {
+        green_shear = new GreensMatrix(storage, global_size, local_size, false, false, true);
+        green_normal = new GreensMatrix(storage, global_size, local_size, false, false, true);
+    } else if (transposed) {
+        green_shear = new GreensMatrix(storage, local_size, global_size, compressed, transposed, false, deferred_init);
+        green_normal = new GreensMatrix(storage, local_size, global_size, compressed, transposed, false, deferred_init);
     } else {
-        if (transposed) {
-            green_shear = new quakelib::DenseStdTranspose<GREEN_VAL>(local_size, global_size);
-            green_normal = new quakelib::DenseStdTranspose<GREEN_VAL>(local_size, global_size);
-        } else {
-            green_shear = new quakelib::DenseStdStraight<GREEN_VAL>(local_size, global_size);
-            green_normal = new quakelib::DenseStdStraight<GREEN_VAL>(local_size, global_size);
-        }
+        green_shear = new GreensMatrix(storage, padded_global_size, local_size, compressed, transposed, false, deferred_init);
+        green_normal = new GreensMatrix(storage, padded_global_size, local_size, compressed, transposed, false, deferred_init);
     }
 
     shear_stress = (double *)malloc(sizeof(double)*global_size);
@@ -95,6 +96,35 @@ void VCSimData::setupArrays(const unsigned int &global_sys_size,
         shear_stress0[i] = normal_stress0[i] = dynamic_val[i] = std::numeric_limits<float>::quiet_NaN();
         failed[i] = false;
     }
+
+    // The local block values are aligned and padded to localSize() like the matrix columns
+    local_gid = (BlockID *)valloc(sizeof(BlockID)*local_size);
+    assertThrow(local_gid, "Not enough memory to allocate local block ID array.");
+    local_slip_rate = (double *)valloc(sizeof(double)*local_size);
+    assertThrow(local_slip_rate, "Not enough memory to allocate local slip rate array.");
+    local_aseismic = (double *)valloc(sizeof(double)*local_size);
+    assertThrow(local_aseismic, "Not enough memory to allocate local aseismic array.");
+    local_fault_id = (FaultID *)valloc(sizeof(FaultID)*local_size);
+    assertThrow(local_fault_id, "Not enough memory to allocate local fault ID array.");
+
+    for (unsigned int i=0; i<local_size; ++i) {
+        local_gid[i] = UNDEFINED_ELEMENT_ID;
+        local_slip_rate[i] = local_aseismic[i] = 0;
+        local_fault_id[i] = UNDEFINED_FAULT_ID;
+    }
+}
+
+/*!
+ Record the values of block gid used in the event loops at local index lid.
+ Must be called for each local block after setupArrays().
+ */
+void VCSimData::setLocalBlock(const int &lid, const BlockID &gid) {
+    const Block     &block = getBlock(gid);
+
+    local_gid[lid] = gid;
+    local_slip_rate[lid] = block.slip_rate();
+    local_aseismic[lid] = block.aseismic();
+    local_fault_id[lid] = block.getFaultID();
 }
 
 // bh_theta = 0.1
@@ -152,9 +182,20 @@ void VCSimData::deallocateArrays(void) {
 
     if (failed) free(failed);
 
+    if (local_gid) free(local_gid);
+
+    if (local_slip_rate) free(local_slip_rate);
+
+    if (local_aseismic) free(local_aseismic);
+
+    if (local_fault_id) free(local_fault_id);
+
     green_shear = green_normal = NULL;
     shear_stress = normal_stress = update_field = NULL;
     slip_deficit = rhogd = stress_drop = max_stress_drop = cff = friction = NULL;
     cff0 = self_shear = self_normal = shear_stress0 = normal_stress0 = dynamic_val = NULL;
     failed = NULL;
+    local_gid = NULL;
+    local_slip_rate = local_aseismic = NULL;
+    local_fault_id = NULL;
 }
@@ -20,6 +20,8 @@
 
 #include "SimDataBlocks.h"
 #include "SimDataEvents.h"
+#include "GreensMatrix.h"
+#include "GreensKernels.h"
 
 #ifndef _SIM_DATA_H_
 #define _SIM_DATA_H_
@@ -37,8 +39,8 @@
  */
 class VCSimData : public VCSimDataBlocks, public VCSimDataEvents {
     private:
-        unsigned int            global_size, local_size;
-        quakelib::DenseMatrix<GREEN_VAL>    *green_shear, *green_normal;
+        unsigned int            global_size, local_size, padded_global_size;
+        GreensMatrix            *green_shear, *green_normal;
 
     protected:
         double                  *shear_stress;
@@ -58,23 +60,51 @@ class VCSimData : public VCSimDataBlocks, public VCSimDataEvents {
         double                  *dynamic_val;
         bool                    *failed;
         double                  stress_drop_factor;
+        //! Block values read in the per event loops, packed by local block index
+        //! so the loops stream through them rather than looking up Block objects.
+        BlockID                 *local_gid;
+        double                  *local_slip_rate;
+        double                  *local_aseismic;
+        FaultID                 *local_fault_id;
         std::map<BlockID, double>   init_shear_stress;
         std::map<BlockID, double>   init_normal_stress;
         std::map<SectionID, double>   fault_lengths;
         std::map<SectionID, double>   fault_areas;
 
     public:
-        VCSimData(void) : global_size(0), local_size(0), green_shear(NULL), green_normal(NULL),
+        VCSimData(void) : global_size(0), local_size(0), padded_global_size(0), green_shear(NULL), green_normal(NULL),
             shear_stress(NULL), normal_stress(NULL), update_field(NULL), slip_deficit(NULL),
             rhogd(NULL), stress_drop(NULL), max_stress_drop(NULL), cff(NULL), friction(NULL), cff0(NULL),
             self_shear(NULL), self_normal(NULL), shear_stress0(NULL), normal_stress0(NULL),
-            dynamic_val(NULL), failed(NULL), stress_drop_factor(0) {};
+            dynamic_val(NULL), failed(NULL), stress_drop_factor(0),
+            local_gid(NULL), local_slip_rate(NULL), local_aseismic(NULL), local_fault_id(NULL) {};
 
         void setupArrays(const unsigned int &global_sys_size,
                          const unsigned int &local_sys_size,
                          const bool &compressed,
-                         const bool &transposed);
+                         const bool &transposed,
+                         const GreensStorage &storage,
+                         const bool &hierarchical,
+                         const bool &deferred_init);
         void deallocateArrays(void);
+        void setLocalBlock(const int &lid, const BlockID &gid);
+
+        //! Global ID of the block with local index lid.
+        BlockID localGID(const int &lid) const {
+            return local_gid[lid];
+        };
+        //! Slip rate of the block with local index lid.
+        double localSlipRate(const int &lid) const {
+            return local_slip_rate[lid];
+        };
+        //! Aseismic fraction of the block with local index lid.
+        double localAseismic(const int &lid) const {
+            return local_aseismic[lid];
+        };
+        //! Fault ID of the block with local index lid.
+        FaultID localFaultID(const int &lid) const {
+            return local_fault_id[lid];
+        };
 
         unsigned int localSize(void) const {
             return local_size;
@@ -82,11 +112,14 @@ class VCSimData : public VCSimDataBlocks, public VCSimDataEvents {
         unsigned int globalSize(void) const {
             return global_size;
         };
+        unsigned int paddedGlobalSize(void) const {
+            return padded_global_size;
+        };
 
-        quakelib::DenseMatrix<GREEN_VAL> *greenShear(void) const {
+        GreensMatrix *greenShear(void) const {
             return green_shear;
         };
-        quakelib::DenseMatrix<GREEN_VAL> *greenNormal(void) const {
+        GreensMatrix *greenNormal(void) const {
             return green_normal;
         };
         double *getUpdateFieldPtr(void) const {
@@ -20,3 +20,43 @@
 
 #include "SimDataEvents.h"
 
+#include <algorithm>
+
+//! Whether two aftershocks happen at the same time, and so are equivalent in time order.
+static bool sameAftershockTime(const EventAftershock &a, const EventAftershock &b) {
+    return !(a < b) && !(b < a);
+}
+
+/*!
+ Add a batch of aftershocks to the pending aftershocks. The batch is sorted
+ and merged with the pending aftershocks in one pass. As with the set of
+ aftershocks this replaces, an aftershock at the same time as an earlier one
+ (pending or earlier in the batch) is discarded.
+ */
+void VCSimDataEvents::addAftershocks(const AftershockVector &aftershocks) {
+    unsigned int    i, j;
+
+    new_aftershocks.assign(aftershocks.begin(), aftershocks.end());
+    std::stable_sort(new_aftershocks.begin(), new_aftershocks.end());
+    new_aftershocks.erase(std::unique(new_aftershocks.begin(), new_aftershocks.end(), sameAftershockTime), new_aftershocks.end());
+
+    merged_aftershocks.clear();
+    merged_aftershocks.reserve(numAftershocksToProcess()+new_aftershocks.size());
+    i = next_aftershock;
+    j = 0;
+
+    while (i < cur_aftershocks.size() || j < new_aftershocks.size()) {
+        if (j == new_aftershocks.size() || (i < cur_aftershocks.size() && cur_aftershocks[i] < new_aftershocks[j])) {
+            merged_aftershocks.push_back(cur_aftershocks[i++]);
+        } else if (i == cur_aftershocks.size() || new_aftershocks[j] < cur_aftershocks[i]) {
+            merged_aftershocks.push_back(new_aftershocks[j++]);
+        } else {
+            // Keep the pending aftershock, drop the new one at the same time
+            merged_aftershocks.push_back(cur_aftershocks[i++]);
+            j++;
+        }
+    }
+
+    cur_aftershocks.swap(merged_aftershocks);
+    next_aftershock = 0;
+}
@@ -29,14 +29,18 @@ class VCSimDataEvents {
         //! Current event in the simulation (older events are discarded)
         quakelib::ModelEvent        cur_event;
 
-        //! Current set of aftershocks to be processed
-        AftershockSet               cur_aftershocks;
+        //! Aftershocks to be processed, sorted by time from index next_aftershock onward.
+        //! Processed aftershocks before next_aftershock are dropped on the next merge.
+        AftershockVector            cur_aftershocks;
+        unsigned int                next_aftershock;
+        //! Buffers reused between merges so adding aftershocks does not allocate per element
+        AftershockVector            new_aftershocks, merged_aftershocks;
 
         //! Current count of events
         unsigned int                event_cnt;
 
     public:
-        VCSimDataEvents(void) : event_cnt(0) {};
+        VCSimDataEvents(void) : next_aftershock(0), event_cnt(0) {};
 
         int getEventCount(void) const {
             return event_cnt;
@@ -48,23 +52,19 @@ class VCSimDataEvents {
             cur_event = new_event;
             event_cnt++;
         };
-        void addAftershock(const EventAftershock &new_aftershock) {
-            cur_aftershocks.insert(new_aftershock);
-        };
+        void addAftershocks(const AftershockVector &aftershocks);
         double nextAftershockTime(void) const {
-            if (cur_aftershocks.size() > 0) {
-                return cur_aftershocks.begin()->t;
+            if (numAftershocksToProcess() > 0) {
+                return cur_aftershocks[next_aftershock].t;
             } else {
                 return DBL_MAX;
             }
         };
         EventAftershock popAftershock(void) {
-            EventAftershock next_aftershock = *(cur_aftershocks.begin());
-            cur_aftershocks.erase(cur_aftershocks.begin());
-            return next_aftershock;
+            return cur_aftershocks[next_aftershock++];
         };
         unsigned int numAftershocksToProcess(void) const {
-            return cur_aftershocks.size();
+            return cur_aftershocks.size() - next_aftershock;
         };
 };
 
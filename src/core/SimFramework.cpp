@@ -61,7 +61,13 @@ SimFramework::SimFramework(int argc, char **argv) {
 
 #ifdef MPI_C_FOUND
     // node_rank and world_size (defined in header) set by MPI_Comm_rank/_size.
+#ifdef _OPENMP
+    // Only the main thread makes MPI calls, OpenMP threads are used in computation
+    int     thread_support;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_support);
+#else
     MPI_Init(&argc, &argv);
+#endif
     MPI_Comm_rank(MPI_COMM_WORLD, &node_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
 
@@ -20,6 +20,7 @@
 
 #include "Simulation.h"
 #include "SimFramework.h"
+#include "Partitioner.h"
 
 #ifdef VQ_HAVE_STDLIB_H
 #include <stdlib.h>
@@ -30,6 +31,7 @@
 #endif
 
 #include <list>
+#include <algorithm>
 #include <vector>
 #include <sstream>
 
@@ -37,10 +39,18 @@
 #include <omp.h>
 #endif
 
+#ifdef VQ_HAVE_SCHED_SETAFFINITY_FUNC
+#include <sched.h>
+#endif
+
+#ifdef VQ_HAVE_NUMA
+#include <numa.h>
+#endif
+
 /*!
  Initialize the simulation by reading the parameter file and checking the validity of parameters.
  */
-Simulation::Simulation(int argc, char **argv) : SimFramework(argc, argv) {
+Simulation::Simulation(int argc, char **argv) : SimFramework(argc, argv), mult_buffer(NULL), num_threads(1), pin_shared_procs(1), greens_version(0) {
     srand(time(0));
 
     // Ensure we are given the parameter file name
@@ -56,6 +66,36 @@ Simulation::Simulation(int argc, char **argv) : SimFramework(argc, argv) {
                 "sim.start_year: Start year must be before end year.");
     assertThrow(getGreensCalcMethod() != GREENS_CALC_UNDEFINED,
                 "Greens calculation method must be either standard, Barnes Hut or file based.");
+    assertThrow(getGreensStorage() != GREENS_STORAGE_UNDEFINED,
+                "sim.greens.storage: Greens storage must be one of double, float, int16 or int8.");
+    assertThrow(GreensKernels::parseName(getMatVecKernel()) != KERNEL_UNDEFINED,
+                "sim.system.matvec_kernel: Kernel must be one of auto, scalar, sse2, avx2 or avx512.");
+    assertThrow(getNumThreads() >= 0,
+                "sim.system.num_threads: Number of threads must be at least 0.");
+    assertThrow(getNUMAPlacement() != NUMA_PLACEMENT_UNDEFINED,
+                "sim.system.numa_placement: NUMA placement must be one of none, first_touch or interleave.");
+    assertThrow(getThreadAffinity() != THREAD_AFFINITY_UNDEFINED,
+                "sim.system.thread_affinity: Thread affinity must be one of none, compact or spread.");
+    assertThrow(getPartitionMethod() != PARTITION_UNDEFINED,
+                "sim.system.partition_method: Partitioning method must be one of block, distance, rcb, sfc or graph.");
+    assertThrow(getSlipSolver() != SLIP_SOLVER_UNDEFINED,
+                "sim.system.slip_solver: Slip solver must be one of lu, lapack or krylov.");
+    assertThrow(getKrylovMinSize() >= 0,
+                "sim.system.krylov_min_size: Minimum system size must be at least 0.");
+    assertThrow(getKrylovTolerance() > 0,
+                "sim.system.krylov_tolerance: Tolerance must be greater than 0.");
+    assertThrow(getKrylovMaxIterations() > 0,
+                "sim.system.krylov_max_iterations: Maximum iterations must be greater than 0.");
+    assertThrow(getSparseExchangeThreshold() >= 0 && getSparseExchangeThreshold() <= 1,
+                "sim.system.sparse_exchange_threshold: Threshold must be between 0 and 1.");
+    assertThrow(!useHMatrix() || getGreensCalcMethod() == GREENS_CALC_STANDARD,
+                "sim.greens.use_hmatrix: H-matrices require the standard Greens calculation method.");
+    assertThrow(getHMatrixTolerance() > 0,
+                "sim.greens.hmatrix_tolerance: Tolerance must be greater than 0.");
+    assertThrow(getHMatrixEta() > 0,
+                "sim.greens.hmatrix_eta: Admissibility parameter must be greater than 0.");
+    assertThrow(!useHMatrix() || getGreensStorage() == GREENS_STORAGE_DOUBLE || getGreensStorage() == GREENS_STORAGE_FLOAT,
+                "sim.greens.use_hmatrix: H-matrices must be stored as double or float.");
 
     // Now that we have the parameters, write them out to a file
     // on the root node for record keeping purposes
@@ -240,8 +280,6 @@ Simulation::~Simulation(void) {
 
     if (mult_buffer) free( mult_buffer );
 
-    if (decompress_buf) free( decompress_buf );
-
     //
     deallocateArrays();
 }
@@ -250,6 +288,9 @@ Simulation::~Simulation(void) {
  Initialize the VC specific part of the simulation by creating communication timers.
  */
 void Simulation::init(void) {
+    unsigned int    i;
+    MatVecKernel    requested_kernel;
+
 #ifdef DEBUG
     reduce_comm_timer = initTimer("Reduce Comm", false, false);
     fail_comm_timer = initTimer("Fail Synch Comm", false, false);
@@ -258,8 +299,75 @@ void Simulation::init(void) {
     mult_timer = initTimer("Vec-Mat Mults", false, false);
     num_mults = 0;
 #endif
+    // Pick the matrix-vector kernels and threads before the plugins are
+    // initialized, so the Greens matrices are placed for the threads using them
+    requested_kernel = GreensKernels::parseName(getMatVecKernel());
+    kernels.select(requested_kernel);
+
+    // Set the number of threads per process, combined with the MPI process
+    // count this gives a hybrid ranks x threads decomposition. A value of 0
+    // leaves the choice to OpenMP (e.g. OMP_NUM_THREADS).
+#ifdef _OPENMP
+
+    if (getNumThreads() > 0) omp_set_num_threads(getNumThreads());
+
+    num_threads = omp_get_max_threads();
+#else
+    num_threads = 1;
+#endif
+    pinThreads();
+
     SimFramework::init();
 
+    if (kernels.type() != requested_kernel && requested_kernel != KERNEL_AUTO) {
+        console() << "# WARNING: " << GreensKernels::name(requested_kernel) << " kernel not supported on this CPU." << std::endl;
+    }
+
+    console() << "# Using " << GreensKernels::name(kernels.type()) << " matrix-vector kernel." << std::endl;
+
+#ifndef _OPENMP
+
+    if (getNumThreads() > 1) {
+        console() << "# WARNING: OpenMP not enabled, ignoring sim.system.num_threads." << std::endl;
+    }
+
+#endif
+    console() << "# Using " << num_threads << " thread(s) per process for matrix-vector multiplication." << std::endl;
+
+    // Report where the Greens matrices and threads were placed
+#ifndef VQ_HAVE_NUMA
+
+    if (getNUMAPlacement() == NUMA_PLACEMENT_INTERLEAVE) {
+        console() << "# WARNING: Compiled without libnuma, using first_touch Greens matrix placement." << std::endl;
+    }
+
+#endif
+    console() << "# Greens matrix NUMA placement: " << getNUMAPlacementName();
+#ifdef VQ_HAVE_NUMA
+
+    if (numa_available() >= 0) console() << " over " << numa_num_configured_nodes() << " node(s)";
+
+#endif
+    console() << "." << std::endl;
+
+    if (getThreadAffinity() != THREAD_AFFINITY_NONE) {
+        if (thread_cpus.empty() && pin_shared_procs > 1) {
+            console() << "# WARNING: " << pin_shared_procs << " processes on the node share too few CPUs to split, threads are not pinned." << std::endl;
+        } else if (thread_cpus.empty()) {
+            console() << "# WARNING: Could not set thread affinity, threads are not pinned." << std::endl;
+        } else {
+            if (pin_shared_procs > 1) {
+                console() << "# " << pin_shared_procs << " processes on the node share the same CPU set, each is pinned to its own part of it." << std::endl;
+            }
+
+            console() << "# Threads pinned " << getThreadAffinityName() << " to CPU(s)";
+
+            for (i=0; i<thread_cpus.size(); ++i) console() << " " << thread_cpus[i];
+
+            console() << "." << std::endl;
+        }
+    }
+
     if (getStressOutfileType() == "text") {
         if (getStressOutfile() == "" || getStressIndexOutfile() == "") {
             errConsole() << "ERROR: Stress file names cannot be blank." << std::endl;
@@ -381,6 +489,19 @@ void Simulation::printTimers(void) {
     if (!dry_run) printAllTimers(console(), world_size, node_rank, ROOT_NODE_RANK);
 }
 
+/*!
+ Print how many update field exchanges were sparse or dense and how many bytes
+ the sparse exchanges saved compared to always exchanging all values.
+ */
+void Simulation::printExchangeStats(void) {
+    if (!isRootNode() || num_dense_exchanges+num_sparse_exchanges == 0) return;
+
+    console() << "# Update field exchanges: " << num_sparse_exchanges << " sparse, "
+              << num_dense_exchanges << " dense, " << exchange_bytes << " of "
+              << exchange_dense_bytes << " bytes gathered per process ("
+              << 100.0*(1.0-double(exchange_bytes)/exchange_dense_bytes) << "% saved)" << std::endl;
+}
+
 // Schultz: This is not used.
 //void Simulation::determineBlockNeighbors(void) {
 //    BlockList::iterator     bit, iit;
@@ -421,16 +542,44 @@ void Simulation::printTimers(void) {
 void Simulation::computeCFFs(void) {
     int         i;
 
-    for (i=0; i<numLocalBlocks(); ++i) {
-        BlockID gid = getGlobalBID(i);
-        calcCFF(gid);
-    }
+    for (i=0; i<numLocalBlocks(); ++i) calcCFF(localGID(i));
 }
 
 //! Calculates and stores the CFF of this block.
 // Schultz: We do not want absolute values here.
 void Simulation::calcCFF(const BlockID gid) {
-    cff[gid] = shear_stress[gid] - friction[gid]*normal_stress[gid];
+    double      new_cff = shear_stress[gid] - friction[gid]*normal_stress[gid];
+
+    if (new_cff != cff[gid]) markCFFChanged(gid);
+
+    cff[gid] = new_cff;
+}
+
+/*!
+ Record that the CFF of a local block changed, so users of values derived
+ from the CFF (like the failure times) only need to update those blocks.
+ */
+void Simulation::markCFFChanged(const BlockID gid) {
+    int         lid;
+
+    if (!isLocalToNode(gid)) return;
+
+    lid = getLocalInd(gid);
+
+    if ((int)cff_changed.size() <= lid) cff_changed.resize(numLocalBlocks(), false);
+
+    if (!cff_changed[lid]) {
+        cff_changed[lid] = true;
+        cff_changed_lids.push_back(lid);
+    }
+}
+
+void Simulation::clearChangedCFFs(void) {
+    unsigned int    i;
+
+    for (i=0; i<cff_changed_lids.size(); ++i) cff_changed[cff_changed_lids[i]] = false;
+
+    cff_changed_lids.clear();
 }
 
 /*!
@@ -438,17 +587,87 @@ void Simulation::calcCFF(const BlockID gid) {
  This directly accesses the matrix A and assumes it is stored in transpose format.
  It assumes c should be referenced by the local-global map.
  dense specifies whether the vector is likely mostly non-zero and just used for accounting purposes.
- The SSE version of this function is still under testing and should not yet be used since it assumes
- certain things about memory alignment and matrix padding that are not true for all models.
+ The inner loops are run by the vector kernels selected in init(). Columns are padded
+ to localSize() so the kernels run over whole columns, including the zero padding.
+ With OpenMP the output rows are split into contiguous chunks, one per thread. Chunk
+ boundaries are multiples of GREEN_ROW_PAD so threads never write to the same cache
+ line of mult_buffer, and each element is summed in the same order as a serial run.
  */
 
 // Whether to perform sparse multiplications - these have no effect on the simulation
 // and will only slow things down, generally used for testing purposes
 //#define PERFORM_SPARSE_MULTIPLIES
 
-void Simulation::matrixVectorMultiplyAccum(double *c, const quakelib::DenseMatrix<GREEN_VAL> *a, const double *b, const bool dense) {
-    int         x, y, l, width, height, array_dim;
-    double      val;
+// Minimum number of output rows given to each thread, below this the
+// threading overhead outweighs the gain
+#define MIN_THREAD_ROWS     256
+
+//! Number of threads to use for a matrix-vector multiplication producing array_dim rows.
+int Simulation::matVecThreads(const int &array_dim) const {
+    // Use fewer threads for small matrices
+    return std::max(1, std::min(num_threads, array_dim/MIN_THREAD_ROWS));
+}
+
+/*!
+ Rows [first, last) handled by thread t of nt. The rows are split into contiguous
+ chunks padded to multiples of GREEN_ROW_PAD. placeGreens() uses the same split
+ so each thread first touches the matrix rows it later multiplies.
+ */
+void Simulation::threadRows(const int &t, const int &nt, const int &array_dim, int &first, int &last) {
+    int         chunk;
+
+    chunk = (array_dim+nt-1)/nt;
+    chunk = ((chunk+GREEN_ROW_PAD-1)/GREEN_ROW_PAD)*GREEN_ROW_PAD;
+    first = std::min(t*chunk, array_dim);
+    last = std::min(first+chunk, array_dim);
+}
+
+void Simulation::matrixVectorMultiplyAccum(double *c, const GreensMatrix *a, const double *b, const bool dense) {
+    matrixVectorMultiplyAccum(c, a, NULL, NULL, b, dense, NULL, false);
+}
+
+/*!
+ Performs a matrix-vector multiply (C += A * B) using only the listed columns of A,
+ treating all other elements of B as zero. This is a rank-k update costing O(k*N)
+ rather than O(N^2), used to apply the stress changes from a few slipped blocks.
+ */
+void Simulation::matrixVectorMultiplyAccum(double *c, const GreensMatrix *a, const double *b, const BlockIDList &cols) {
+    matrixVectorMultiplyAccum(c, a, NULL, NULL, b, false, &cols, false);
+}
+
+/*!
+ Adds the shear (and if enabled normal) stress caused by b to shear and normal,
+ streaming b and both Greens matrices in a single pass.
+ */
+void Simulation::stressMatrixVectorMultiplyAccum(double *shear, double *normal, const double *b, const bool dense) {
+    if (doNormalStress()) {
+        matrixVectorMultiplyAccum(shear, greenShear(), normal, greenNormal(), b, dense, NULL, false);
+    } else {
+        matrixVectorMultiplyAccum(shear, greenShear(), NULL, NULL, b, dense, NULL, false);
+    }
+}
+
+/*!
+ Adds the stress changes caused by the update field to the shear and normal stress
+ of the local blocks and recomputes their CFFs. This is the fused equivalent of
+ multiplying by greenShear() and greenNormal() followed by computeCFFs().
+ */
+void Simulation::updateStressesAndCFFs(const bool dense) {
+    matrixVectorMultiplyAccum(getShearStressPtr(), greenShear(),
+                              (doNormalStress() ? getNormalStressPtr() : NULL),
+                              (doNormalStress() ? greenNormal() : NULL),
+                              getUpdateFieldPtr(), dense, NULL, true);
+}
+
+//! As above, but only the update field values of the listed blocks are applied.
+void Simulation::updateStressesAndCFFs(const BlockIDList &cols) {
+    matrixVectorMultiplyAccum(getShearStressPtr(), greenShear(),
+                              (doNormalStress() ? getNormalStressPtr() : NULL),
+                              (doNormalStress() ? greenNormal() : NULL),
+                              getUpdateFieldPtr(), false, &cols, true);
+}
+
+void Simulation::matrixVectorMultiplyAccum(double *c, const GreensMatrix *a, double *c2, const GreensMatrix *a2, const double *b, const bool dense, const BlockIDList *cols, const bool update_cff) {
 #ifdef DEBUG
 
     if (dense) {
@@ -458,77 +677,448 @@ void Simulation::matrixVectorMultiplyAccum(double *c, const quakelib::DenseMatri
 
 #endif
 
+    // Results for the first and second matrix, each padded to localSize()
+    if (!mult_buffer) mult_buffer = (double *)valloc(sizeof(double)*localSize()*2);
+
+    if (a->hierarchical()) {
+        hierarchicalMultiplyAccum(c, a, c2, a2, b, cols, update_cff);
+    } else if (a2 && (a2->storage() != a->storage() || a2->sparse() != a->sparse() || a2->quantized() != a->quantized() || a2->compressed() != a->compressed())) {
+        // The fused multiply needs both matrices in the same precision and layout
+        matrixVectorMultiplyAccum(c, a, NULL, NULL, b, dense, cols, false);
+        matrixVectorMultiplyAccum(c2, a2, NULL, NULL, b, dense, cols, update_cff);
+    } else if (a->quantized16Matrix()) {
+        quantizedMultiplyAccum(c, a->quantized16Matrix(), c2, (a2 ? a2->quantized16Matrix() : NULL), b, dense, cols, update_cff);
+    } else if (a->quantized8Matrix()) {
+        quantizedMultiplyAccum(c, a->quantized8Matrix(), c2, (a2 ? a2->quantized8Matrix() : NULL), b, dense, cols, update_cff);
+    } else if (a->compressedSingleMatrix()) {
+        compressedMultiplyAccum(c, a->compressedSingleMatrix(), c2, (a2 ? a2->compressedSingleMatrix() : NULL), b, dense, cols, update_cff);
+    } else if (a->compressedFullMatrix()) {
+        compressedMultiplyAccum(c, a->compressedFullMatrix(), c2, (a2 ? a2->compressedFullMatrix() : NULL), b, dense, cols, update_cff);
+    } else if (a->sparse() && a->singleMatrix()) {
+        sparseMultiplyAccum(c, a->sparseSingleMatrix(), c2, (a2 ? a2->sparseSingleMatrix() : NULL), b, dense, cols, update_cff);
+    } else if (a->sparse()) {
+        sparseMultiplyAccum(c, a->sparseFullMatrix(), c2, (a2 ? a2->sparseFullMatrix() : NULL), b, dense, cols, update_cff);
+    } else if (a->singleMatrix()) {
+        matrixVectorMultiplyAccum(c, a->singleMatrix(), c2, (a2 ? a2->singleMatrix() : NULL), b, dense, cols, update_cff);
+    } else {
+        matrixVectorMultiplyAccum(c, a->fullMatrix(), c2, (a2 ? a2->fullMatrix() : NULL), b, dense, cols, update_cff);
+    }
+
+#ifdef DEBUG
+
+    if (dense) stopTimer(mult_timer);
+
+#endif
+}
+
+/*!
+ If a2 is given, c2 += A2 * B is computed in the same pass over B, with the
+ results of the second matrix kept in the second half of mult_buffer.
+ If update_cff is set the CFFs of the local blocks are recomputed while the
+ results are added in, saving a separate pass over the blocks.
+ */
+template <class CELL_TYPE>
+void Simulation::matrixVectorMultiplyAccum(double *c, const quakelib::DenseMatrix<CELL_TYPE> *a, double *c2, const quakelib::DenseMatrix<CELL_TYPE> *a2, const double *b, const bool dense, const BlockIDList *cols, const bool update_cff) {
+    int         height, width, array_dim, nthreads;
+    double      *mult_buffer2;
+
     height = numLocalBlocks();
-    width = numGlobalBlocks();
+    // Number of columns to go through, either all of them or the listed ones
+    width = (cols ? cols->size() : numGlobalBlocks());
     array_dim = localSize();
+    mult_buffer2 = &(mult_buffer[array_dim]);
 
-    //
-    if (!decompress_buf) decompress_buf = (GREEN_VAL *)valloc(sizeof(GREEN_VAL)*array_dim);
+    // Use fewer threads for small matrices
+    nthreads = matVecThreads(array_dim);
 
-    //decompress_buf = (GREEN_VAL *)valloc(sizeof(GREEN_VAL)*array_dim);
+    #pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+    {
+        int         t, nt, r, i, y, first, last;
+        double      val, vals[2];
+        CELL_TYPE   *row, *row2;
 
-    /*if (!mult_buffer) mult_buffer = (double *)valloc(sizeof(double)*array_dim);
-    for (x=0;x<height;++x) mult_buffer[x] = 0;
-    for (y=0;y<width;++y) {
-        if (b[y]) {
-            for (x=0;x<height;++x) mult_buffer[x] += a->val(x,y)*b[y];
-        }
-    }
-    for (x=0;x<height;++x) {
-        l = getGlobalBID(x);
-        c[l] += mult_buffer[x];
-    }*/
-
-    if (a->transpose()) {
-        // This works by calculating the contribution of each input vector (b) element
-        // to the final answer rather than calculating each element of the answer
-        // individually. In the case where most of the vector elements are zero this
-        // will be much faster than normal multiplication techniques. For VC about
-        // 80% or more of the matrix-vector multiplications have sparse vectors.
-        //
-        // TODO:
-        if (!mult_buffer) mult_buffer = (double *)valloc(sizeof(double)*array_dim);
-
-        //mult_buffer = (double *)valloc(sizeof(double)*array_dim);    //??
-
-        // Reset the temporary buffer
-        for (x=0; x<height; ++x) mult_buffer[x] = 0;
-
-        // Perform the multiplication
-        if (dense) {
-            for (y=0; y<width; ++y) {
-                multiplyRow(mult_buffer, &(b[y]), a->getCol(decompress_buf, y), array_dim);
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+        nt = omp_get_num_threads();
+#else
+        t = 0;
+        nt = 1;
+#endif
+        // Split the rows into padded chunks based on the actual team size
+        threadRows(t, nt, array_dim, first, last);
+
+        if (a->transpose()) {
+            // This works by calculating the contribution of each input vector (b) element
+            // to the final answer rather than calculating each element of the answer
+            // individually. In the case where most of the vector elements are zero this
+            // will be much faster than normal multiplication techniques. For VC about
+            // 80% or more of the matrix-vector multiplications have sparse vectors.
+
+            // Reset this thread's part of the temporary buffers, including the padding the kernels write to
+            for (r=first; r<last; ++r) mult_buffer[r] = 0;
+
+            if (a2) for (r=first; r<last; ++r) mult_buffer2[r] = 0;
+
+            // Perform the multiplication on this thread's rows
+            for (i=0; first<last && i<width; ++i) {
+                y = (cols ? (*cols)[i] : i);
+                val = b[y];
+#ifndef PERFORM_SPARSE_MULTIPLIES
+
+                if (!dense && !val) continue;
+
+#endif
+
+                if (a2) {
+                    kernels.multiplyRowPair(&(mult_buffer[first]), &(mult_buffer2[first]), val,
+                                            &(a->getCol(NULL, y)[first]), &(a2->getCol(NULL, y)[first]), last-first);
+                } else {
+                    multiplyRow(&(mult_buffer[first]), &val, &(a->getCol(NULL, y)[first]), last-first);
+                }
             }
         } else {
-            for (y=0; y<width; ++y) {
-                val = b[y];
+            for (r=first; r<last && r<height; ++r) {
+                vals[0] = vals[1] = 0;
+                row = a->getRow(NULL, r);
+                row2 = (a2 ? a2->getRow(NULL, r) : NULL);
+
+                if (cols) {
+                    for (i=0; i<width; ++i) {
+                        y = (*cols)[i];
+                        vals[0] += row[y]*b[y];
+
+                        if (row2) vals[1] += row2[y]*b[y];
+                    }
+                } else if (row2) {
+                    kernels.multiplySumRowPair(vals, b, row, row2, width);
+                } else {
+                    multiplySumRow(&(vals[0]), b, row, width, dense);
+                }
+
+                mult_buffer[r] = vals[0];
+
+                if (row2) mult_buffer2[r] = vals[1];
+            }
+        }
+    }
+
+    addMultBuffer(c, c2, update_cff);
+}
+
+/*!
+ Matrix-vector multiply for run length compressed Greens matrices (Barnes-Hut). Compressed
+ rows are multiplied run by run without being decompressed, rows which were not worth
+ compressing use the dense kernels on their raw values.
+ */
+template <class CELL_TYPE>
+void Simulation::compressedMultiplyAccum(double *c, const quakelib::CompressedRowMatrix<CELL_TYPE> *a, double *c2, const quakelib::CompressedRowMatrix<CELL_TYPE> *a2, const double *b, const bool dense, const BlockIDList *cols, const bool update_cff) {
+    const quakelib::CompressedRowMatrix<CELL_TYPE>  *mats[2] = {a, a2};
+    const double    *x = b;
+    int             i, height, width, array_dim, num_mats, nthreads;
+
+    height = numLocalBlocks();
+    width = (cols ? cols->size() : numGlobalBlocks());
+    array_dim = localSize();
+    num_mats = (a2 ? 2 : 1);
+
+    // Runs span columns which may not be used, so straight matrices use b with those masked out
+    if (!a->transpose() && cols) {
+        masked_vec.assign(numGlobalBlocks(), 0.0);
+
+        for (i=0; i<width; ++i) masked_vec[(*cols)[i]] = b[(*cols)[i]];
+
+        x = &(masked_vec[0]);
+    }
+
+    nthreads = matVecThreads(array_dim);
+
+    #pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+    {
+        int                                         t, nt, m, r, n, y, first, last;
+        double                                      val, *out;
+        const quakelib::CompressedRow<CELL_TYPE>    *row;
+
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+        nt = omp_get_num_threads();
+#else
+        t = 0;
+        nt = 1;
+#endif
+        threadRows(t, nt, array_dim, first, last);
+
+        for (m=0; m<num_mats; ++m) {
+            out = &(mult_buffer[m*array_dim]);
+
+            if (mats[m]->transpose()) {
+                for (r=first; r<last; ++r) out[r] = 0;
+
+                for (n=0; first<last && n<width; ++n) {
+                    y = (cols ? (*cols)[n] : n);
+                    val = b[y];
 #ifndef PERFORM_SPARSE_MULTIPLIES
 
-                if (!val) continue;
+                    if (!dense && !val) continue;
 
 #endif
-                multiplyRow(mult_buffer, &val, a->getCol(decompress_buf, y), array_dim);
+                    row = mats[m]->storedRow(y);
+
+                    if (row->isCompressed()) {
+                        kernels.multiplyRuns(out, val, row->getRuns(), row->dataDim(), first, last);
+                    } else {
+                        multiplyRow(&(out[first]), &val, &(row->getRawData()[first]), last-first);
+                    }
+                }
+            } else {
+                for (r=first; r<last && r<height; ++r) {
+                    row = mats[m]->storedRow(r);
+                    out[r] = 0;
+
+                    if (row->isCompressed()) {
+                        out[r] = kernels.multiplySumRuns(x, row->getRuns(), row->dataDim(), numGlobalBlocks());
+                    } else if (cols) {
+                        for (n=0; n<width; ++n) {
+                            y = (*cols)[n];
+                            out[r] += row->getRawData()[y]*b[y];
+                        }
+                    } else {
+                        multiplySumRow(&(out[r]), b, row->getRawData(), width, dense);
+                    }
+                }
             }
         }
+    }
+
+    addMultBuffer(c, c2, update_cff);
+}
+
+/*!
+ Matrix-vector multiply for quantized Greens matrices. The kernels run directly on the
+ integer codes, with b scaled by the scale of each stored row. The row offsets and the
+ full precision corrections are added separately, so nothing is dequantized to a buffer.
+ */
+template <class CODE_TYPE>
+void Simulation::quantizedMultiplyAccum(double *c, const quakelib::QuantizedRowMatrix<CODE_TYPE> *a, double *c2, const quakelib::QuantizedRowMatrix<CODE_TYPE> *a2, const double *b, const bool dense, const BlockIDList *cols, const bool update_cff) {
+    const quakelib::QuantizedRowMatrix<CODE_TYPE>   *mats[2] = {a, a2};
+    const double    *x = b;
+    double          b_sum;
+    int             i, height, width, array_dim, num_mats, nthreads;
 
-        // Add the temporary buffer values into the result array
-        for (x=0; x<height; ++x) {
-            l = getGlobalBID(x);
-            c[l] += mult_buffer[x];
+    height = numLocalBlocks();
+    width = (cols ? cols->size() : numGlobalBlocks());
+    array_dim = localSize();
+    num_mats = (a2 ? 2 : 1);
+    b_sum = 0;
+
+    // Straight matrices need the sum of the used b values for the row offsets,
+    // and b with the unused columns masked out for the corrections
+    if (!a->transpose()) {
+        if (cols) {
+            masked_vec.assign(numGlobalBlocks(), 0.0);
+
+            for (i=0; i<width; ++i) masked_vec[(*cols)[i]] = b[(*cols)[i]];
+
+            x = &(masked_vec[0]);
         }
-    } else {
-        for (x=0; x<height; ++x) {
-            val = 0;
-            multiplySumRow(&val, b, a->getRow(decompress_buf, x), width, dense);
-            c[x] += val;
+
+        for (i=0; i<numGlobalBlocks(); ++i) b_sum += x[i];
+    }
+
+    nthreads = matVecThreads(array_dim);
+
+    #pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+    {
+        int                 t, nt, m, r, y, n, p, first, last;
+        double              val, sum, offset_sum, *out;
+        const CODE_TYPE     *row;
+
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+        nt = omp_get_num_threads();
+#else
+        t = 0;
+        nt = 1;
+#endif
+        threadRows(t, nt, array_dim, first, last);
+
+        for (m=0; m<num_mats; ++m) {
+            out = &(mult_buffer[m*array_dim]);
+
+            if (mats[m]->transpose()) {
+                // The offsets of the columns add the same amount to every row
+                offset_sum = 0;
+
+                for (r=first; r<last; ++r) out[r] = 0;
+
+                for (n=0; first<last && n<width; ++n) {
+                    y = (cols ? (*cols)[n] : n);
+                    val = b[y];
+
+                    if (!dense && !val) continue;
+
+                    kernels.multiplyRow(&(out[first]), val*mats[m]->scale(y), &(mats[m]->codes(y)[first]), last-first);
+                    offset_sum += val*mats[m]->offset(y);
+                    p = mats[m]->exact_pos(y);
+
+                    if (p >= first && p < last) out[p] += val*mats[m]->correction(y);
+                }
+
+                for (r=first; r<last; ++r) out[r] += offset_sum;
+            } else {
+                for (r=first; r<last && r<height; ++r) {
+                    row = mats[m]->codes(r);
+
+                    if (cols) {
+                        sum = 0;
+
+                        for (n=0; n<width; ++n) {
+                            y = (*cols)[n];
+                            sum += row[y]*x[y];
+                        }
+                    } else {
+                        sum = kernels.multiplySumRow(x, row, width);
+                    }
+
+                    out[r] = mats[m]->scale(r)*sum + mats[m]->offset(r)*b_sum;
+                    p = mats[m]->exact_pos(r);
+
+                    if (p >= 0) out[r] += x[p]*mats[m]->correction(r);
+                }
+            }
         }
     }
 
-#ifdef DEBUG
+    addMultBuffer(c, c2, update_cff);
+}
 
-    if (dense) stopTimer(mult_timer);
+/*!
+ Matrix-vector multiply for sparse Greens matrices, which only store the interactions
+ within the kill distance. Transposed matrices go through the stored columns of the
+ nonzero b values like the dense version, with each thread updating its own rows.
+ Straight matrices take the dot product of each stored row, so if only some columns
+ are used the other elements of b are masked out first.
+ */
+template <class CELL_TYPE>
+void Simulation::sparseMultiplyAccum(double *c, const quakelib::SparseRowMatrix<CELL_TYPE> *a, double *c2, const quakelib::SparseRowMatrix<CELL_TYPE> *a2, const double *b, const bool dense, const BlockIDList *cols, const bool update_cff) {
+    const quakelib::SparseRowMatrix<CELL_TYPE>  *mats[2] = {a, a2};
+    const double    *x = b;
+    int             i, height, width, array_dim, num_mats, nthreads;
+
+    height = numLocalBlocks();
+    width = (cols ? cols->size() : numGlobalBlocks());
+    array_dim = localSize();
+    num_mats = (a2 ? 2 : 1);
+
+    if (cols && !a->transpose()) {
+        masked_vec.assign(numGlobalBlocks(), 0.0);
+
+        for (i=0; i<width; ++i) masked_vec[(*cols)[i]] = b[(*cols)[i]];
+
+        x = &(masked_vec[0]);
+    }
+
+    nthreads = matVecThreads(array_dim);
 
+    #pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+    {
+        int                 t, nt, m, r, y, n, first, last;
+        unsigned int        k, end;
+        double              val, sum, *out;
+        const unsigned int  *starts, *inds;
+        const CELL_TYPE     *vals;
+
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+        nt = omp_get_num_threads();
+#else
+        t = 0;
+        nt = 1;
 #endif
+        // Split the rows into padded chunks based on the actual team size
+        threadRows(t, nt, array_dim, first, last);
+
+        for (m=0; m<num_mats; ++m) {
+            starts = mats[m]->row_starts();
+            inds = mats[m]->cols();
+            vals = mats[m]->vals();
+            out = &(mult_buffer[m*array_dim]);
+
+            if (mats[m]->transpose()) {
+                for (r=first; r<last; ++r) out[r] = 0;
+
+                for (n=0; first<last && n<width; ++n) {
+                    y = (cols ? (*cols)[n] : n);
+                    val = x[y];
+
+                    if (!dense && !val) continue;
+
+                    k = starts[y];
+                    end = starts[y+1];
+
+                    // The rows of each column are in order, so skip to this thread's rows
+                    if (first > 0) k = std::lower_bound(&inds[k], &inds[end], (unsigned int)first)-inds;
+
+                    for (; k<end && inds[k]<(unsigned int)last; ++k) out[inds[k]] += val*vals[k];
+                }
+            } else {
+                for (r=first; r<last && r<height; ++r) {
+                    sum = 0;
+
+                    for (k=starts[r]; k<starts[r+1]; ++k) sum += vals[k]*x[inds[k]];
+
+                    out[r] = sum;
+                }
+            }
+        }
+    }
+
+    addMultBuffer(c, c2, update_cff);
+}
+
+/*!
+ Add the temporary buffer values into the result arrays, the second half of
+ mult_buffer goes into c2 if it is set.
+ */
+void Simulation::addMultBuffer(double *c, double *c2, const bool update_cff) {
+    int         x;
+    double      *mult_buffer2 = &(mult_buffer[localSize()]);
+
+    for (x=0; x<numLocalBlocks(); ++x) {
+        BlockID gid = localGID(x);
+        c[gid] += mult_buffer[x];
+
+        if (c2) c2[gid] += mult_buffer2[x];
+
+        if (update_cff) calcCFF(gid);
+    }
+}
+
+/*!
+ Matrix-vector multiply for hierarchical Greens matrices. These are multiplied
+ block by block in O(N log N) rather than by rows or columns. If only some
+ columns are used the other elements of b are masked out first.
+ */
+void Simulation::hierarchicalMultiplyAccum(double *c, const GreensMatrix *a, double *c2, const GreensMatrix *a2, const double *b, const BlockIDList *cols, const bool update_cff) {
+    const double    *x = b;
+    int             i, array_dim;
+
+    if (cols) {
+        masked_vec.assign(numGlobalBlocks(), 0.0);
+
+        for (i=0; i<(int)cols->size(); ++i) masked_vec[(*cols)[i]] = b[(*cols)[i]];
+
+        x = &(masked_vec[0]);
+    }
+
+    array_dim = localSize();
+
+    for (i=0; i<2*array_dim; ++i) mult_buffer[i] = 0;
+
+    a->multiplyAccumHierarchical(mult_buffer, x);
+
+    if (a2) a2->multiplyAccumHierarchical(&(mult_buffer[array_dim]), x);
+
+    addMultBuffer(c, (a2 ? c2 : NULL), update_cff);
 }
 
 // SSE old execution notes
@@ -576,211 +1166,234 @@ void Simulation::matrixVectorMultiplyAccum(double *c, const quakelib::DenseMatri
 // NOTES: the SSE version is mostly memory bound. Performance could be improved by
 // changing to floats.
 
-//#define USE_SSE
-//#define PREFETCH_A_VEC
-//#define PREFETCH_B_VEC
-//#define PREFETCH_C_VEC
-#define SSE_LOOP_UNROLL     8
+// NOTES: the vector kernels (GreensKernels.cpp) replace the old hand-unrolled SSE
+// version, which required aligned and padded rows. They are selected at startup
+// from the CPU features and sim.system.matvec_kernel.
 
-#ifdef USE_SSE  // SSE version
-#include <xmmintrin.h>
+/*!
+ Multiplies each value in a by b and sums the result into c.
+ The vector kernels do not skip zero entries of b, the scalar kernel does
+ so for sparse vectors.
+ */
+template <class CELL_TYPE>
+void Simulation::multiplySumRow(double *c, const double *b, const CELL_TYPE *a, const int n, const bool dense) {
+    double val = 0;
 
-void Simulation::multiplySumRow(double *c, const double *b, const GREEN_VAL *a, const int n, const bool dense) {
-    __m128d     aval, bval, cval, tmpval;
-    double      tmp[2];
-#if SSE_LOOP_UNROLL != 16 && SSE_LOOP_UNROLL != 8 && SSE_LOOP_UNROLL != 6 && SSE_LOOP_UNROLL != 4 && SSE_LOOP_UNROLL != 2
-#error "Invalid value of SSE_LOOP_UNROLL"
-#endif
-    cval = _mm_setzero_pd();
+    if (dense || kernels.type() != KERNEL_SCALAR) {
+        c[0] += kernels.multiplySumRow(b, a, n);
+        return;
+    }
 
-    for (int x=0; x<n; x+=SSE_LOOP_UNROLL) {
-#ifdef PREFETCH_A_VEC
-        _mm_prefetch(&a[x+SSE_LOOP_UNROLL], _MM_HINT_T0);
-#endif
-#ifdef PREFETCH_B_VEC
-        _mm_prefetch(&b[x+SSE_LOOP_UNROLL], _MM_HINT_T0);
-#endif
-        aval = _mm_load_pd(&a[x]);
-        bval = _mm_load_pd(&b[x]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-
-#if SSE_LOOP_UNROLL > 2
-        aval = _mm_load_pd(&a[x+2]);
-        bval = _mm_load_pd(&b[x+2]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-#endif
+    for (int x=0; x<n; ++x) {
+#ifndef PERFORM_SPARSE_MULTIPLIES
 
-#if SSE_LOOP_UNROLL > 4
-        aval = _mm_load_pd(&a[x+4]);
-        bval = _mm_load_pd(&b[x+4]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-#endif
+        if (!b[x]) continue;
 
-#if SSE_LOOP_UNROLL > 6
-        aval = _mm_load_pd(&a[x+6]);
-        bval = _mm_load_pd(&b[x+6]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
 #endif
+        val += a[x]*b[x];
     }
 
-    _mm_store_pd(tmp, cval);
-    c[0] += tmp[0] + tmp[1];
+    c[0] += val;
+}
+
+/*!
+ Multiplies each value in a by b and adds the result to c.
+ Using this function is faster than leaving the code in matrixVectorMultiplyAccum.
+ */
+template <class CELL_TYPE>
+void Simulation::multiplyRow(double *c, const double *b, const CELL_TYPE *a, const int n) {
+    kernels.multiplyRow(c, b[0], a, n);
 }
 
-#else   // Non-SSE version
+/*!
+ Distributes the local part of the update field to other nodes and
+ receives their local update fields.
+ */
+void Simulation::distributeUpdateField(void) {
+#ifdef MPI_C_FOUND
+#ifdef DEBUG
+    startTimer(dist_comm_timer);
+#endif
+    int     i, p, num_changed, total_changed;
+    BlockID bid;
 
-void Simulation::multiplySumRow(double *c, const double *b, const GREEN_VAL *a, const int n, const bool dense) {
-    double val = 0;
+    // Find the local update field values that changed since the last exchange.
+    // Compare the bits so that NaN and signed zero values are sent exactly.
+    for (num_changed=0,i=0; i<numLocalBlocks(); ++i) {
+        bid = updateFieldSendIDs[i];
 
-    if (dense) {
-        for (int x=0; x<n; ++x) {
-            val += a[x]*b[x];
+        if (memcmp(&getUpdateFieldPtr()[bid], &updateFieldLast[bid], sizeof(double))) {
+            updateFieldDeltaSendBuf[num_changed].val = getUpdateFieldPtr()[bid];
+            updateFieldDeltaSendBuf[num_changed].block_id = bid;
+            ++num_changed;
         }
-    } else {
-        for (int x=0; x<n; ++x) {
-#ifndef PERFORM_SPARSE_MULTIPLIES
+    }
 
-            if (!b[x]) continue;
+    // Let all nodes know how many values changed on the others
+    MPI_Allgather(&num_changed, 1, MPI_INT, updateFieldDeltaCounts, 1, MPI_INT, MPI_COMM_WORLD);
 
-#endif
-            val += a[x]*b[x];
+    for (total_changed=0,p=0; p<world_size; ++p) {
+        updateFieldDeltaDisps[p] = total_changed;
+        total_changed += updateFieldDeltaCounts[p];
+    }
+
+    exchange_bytes += world_size*sizeof(int);
+    exchange_dense_bytes += numGlobalBlocks()*sizeof(double);
+
+    if (total_changed <= getSparseExchangeThreshold()*numGlobalBlocks()) {
+        // Few values changed, so only exchange the changed (block, value) pairs
+        MPI_Allgatherv(updateFieldDeltaSendBuf,
+                       num_changed,
+                       block_val_type,
+                       updateFieldDeltaRecvBuf,
+                       updateFieldDeltaCounts,
+                       updateFieldDeltaDisps,
+                       block_val_type,
+                       MPI_COMM_WORLD);
+
+        for (i=0; i<total_changed; ++i) {
+            updateFieldLast[updateFieldDeltaRecvBuf[i].block_id] = updateFieldDeltaRecvBuf[i].val;
+        }
+
+        exchange_bytes += total_changed*sizeof(BlockVal);
+        num_sparse_exchanges++;
+    } else {
+        // Copy the local update field values to the send buffer
+        for (i=0; i<numLocalBlocks(); ++i) {
+            bid = updateFieldSendIDs[i];
+            updateFieldSendBuf[i] = getUpdateFieldPtr()[bid];       // getUpdateField{Send/Recv}Buff[] declared in core/Comm.h as double * . note that it is "new"
         }
+
+        // check the buffer allocations for correct size. what about numLocalBlocks() what if this is 0?
+        MPI_Allgatherv(updateFieldSendBuf,
+                       numLocalBlocks(),
+                       MPI_DOUBLE,
+                       updateFieldRecvBuf,
+                       updateFieldCounts,
+                       updateFieldDisps,
+                       MPI_DOUBLE,
+                       MPI_COMM_WORLD);
+
+        // Copy the received values from the buffer
+        for (i=0; i<numGlobalBlocks(); ++i) {
+            bid = updateFieldRecvIDs[i];
+            updateFieldLast[bid] = updateFieldRecvBuf[i];
+        }
+
+        exchange_bytes += numGlobalBlocks()*sizeof(double);
+        num_dense_exchanges++;
     }
 
-    c[0] += val;
-}
+    // The last exchanged values are now the current values of all blocks
+    memcpy(getUpdateFieldPtr(), updateFieldLast, numGlobalBlocks()*sizeof(double));
 
+#ifdef DEBUG
+    stopTimer(dist_comm_timer);
+#endif
 #endif
+}
+
+// Number of local columns multiplied between tests of the nonblocking update field exchange
+#define OVERLAP_CHUNK_COLUMNS   256
 
 /*!
- Multiplies each value in a by b and adds the result to c.
- Using this function is faster than leaving the code in matrixVectorMultiplyAccum.
+ Distributes the update field and adds the stress changes it causes to the local
+ blocks, equivalent to distributeUpdateField() followed by updateStressesAndCFFs(true).
+ With sim.system.overlap_exchange the update field is gathered with a nonblocking
+ collective. The columns of the local blocks are multiplied in chunks while it is
+ in transit, testing it between chunks so MPI can progress, and the columns of the
+ other nodes once it completes. This is only done for dense Greens matrices, the
+ other formats multiply by a masked copy of the whole update field for each column
+ subset so splitting the multiply would cost more than it hides.
  */
-#ifdef USE_SSE
-void Simulation::multiplyRow(double *c, const double *b, const GREEN_VAL *a, const int n) {
-    __m128d     aval, bval, cval, tmpval;
-#if SSE_LOOP_UNROLL != 16 && SSE_LOOP_UNROLL != 8 && SSE_LOOP_UNROLL != 6 && SSE_LOOP_UNROLL != 4 && SSE_LOOP_UNROLL != 2
-#error "Invalid value of SSE_LOOP_UNROLL"
-#endif
-    bval = _mm_load1_pd(b);
+void Simulation::distributeUpdateFieldAndStresses(void) {
+#if defined(MPI_C_FOUND) && MPI_VERSION >= 3
+    MPI_Request     request;
+    BlockIDList     chunk;
+    double          *normal;
+    const GreensMatrix  *normal_greens;
+    int             i, done;
+    BlockID         bid;
+
+    if (!doOverlapExchange() || world_size == 1 || greenShear()->hierarchical() || greenShear()->sparse() ||
+            greenShear()->quantized() || greenShear()->compressed()) {
+        distributeUpdateField();
+        updateStressesAndCFFs(true);
+        return;
+    }
 
-    for (int x=0; x<n; x+=SSE_LOOP_UNROLL) {
-#ifdef PREFETCH_A_VEC
-        _mm_prefetch(&a[x+SSE_LOOP_UNROLL], _MM_HINT_T0);
-#endif
-#ifdef PREFETCH_C_VEC
-        _mm_prefetch(&c[x+SSE_LOOP_UNROLL], _MM_HINT_T0);
-#endif
-        aval = _mm_load_pd(&a[x]);
-        cval = _mm_load_pd(&c[x]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-        _mm_store_pd(&c[x], cval);
-
-#if SSE_LOOP_UNROLL > 2
-        aval = _mm_load_pd(&a[x+2]);
-        cval = _mm_load_pd(&c[x+2]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-        _mm_store_pd(&c[x+2], cval);
-#endif
+    normal = (doNormalStress() ? getNormalStressPtr() : NULL);
+    normal_greens = (doNormalStress() ? greenNormal() : NULL);
 
-#if SSE_LOOP_UNROLL > 4
-        aval = _mm_load_pd(&a[x+4]);
-        cval = _mm_load_pd(&c[x+4]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-        _mm_store_pd(&c[x+4], cval);
-#endif
+    // The columns of local and remote blocks, in ascending order
+    if (overlap_local_cols.size()+overlap_remote_cols.size() != numGlobalBlocks()) {
+        overlap_local_cols.clear();
+        overlap_remote_cols.clear();
 
-#if SSE_LOOP_UNROLL > 6
-        aval = _mm_load_pd(&a[x+6]);
-        cval = _mm_load_pd(&c[x+6]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-        _mm_store_pd(&c[x+6], cval);
-#endif
+        for (bid=0; bid<numGlobalBlocks(); ++bid) {
+            if (isLocalBlockID(bid)) overlap_local_cols.push_back(bid);
+            else overlap_remote_cols.push_back(bid);
+        }
+    }
 
-#if SSE_LOOP_UNROLL > 8
-        aval = _mm_load_pd(&a[x+8]);
-        cval = _mm_load_pd(&c[x+8]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-        _mm_store_pd(&c[x+8], cval);
+#ifdef DEBUG
+    startTimer(dist_comm_timer);
 #endif
 
-#if SSE_LOOP_UNROLL > 10
-        aval = _mm_load_pd(&a[x+10]);
-        cval = _mm_load_pd(&c[x+10]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-        _mm_store_pd(&c[x+10], cval);
-#endif
+    for (i=0; i<numLocalBlocks(); ++i) {
+        updateFieldSendBuf[i] = getUpdateFieldPtr()[updateFieldSendIDs[i]];
+    }
 
-#if SSE_LOOP_UNROLL > 12
-        aval = _mm_load_pd(&a[x+12]);
-        cval = _mm_load_pd(&c[x+12]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-        _mm_store_pd(&c[x+12], cval);
+    MPI_Iallgatherv(updateFieldSendBuf,
+                    numLocalBlocks(),
+                    MPI_DOUBLE,
+                    updateFieldRecvBuf,
+                    updateFieldCounts,
+                    updateFieldDisps,
+                    MPI_DOUBLE,
+                    MPI_COMM_WORLD,
+                    &request);
+#ifdef DEBUG
+    stopTimer(dist_comm_timer);
 #endif
 
-#if SSE_LOOP_UNROLL > 14
-        aval = _mm_load_pd(&a[x+14]);
-        cval = _mm_load_pd(&c[x+14]);
-        tmpval = _mm_mul_pd(aval, bval);
-        cval = _mm_add_pd(tmpval, cval);
-        _mm_store_pd(&c[x+14], cval);
-#endif
+    // Multiply the local columns while the other values arrive
+    for (done=0,i=0; i<(int)overlap_local_cols.size(); i+=OVERLAP_CHUNK_COLUMNS) {
+        chunk.assign(overlap_local_cols.begin()+i,
+                     overlap_local_cols.begin()+std::min(i+OVERLAP_CHUNK_COLUMNS, (int)overlap_local_cols.size()));
+        matrixVectorMultiplyAccum(getShearStressPtr(), greenShear(), normal, normal_greens,
+                                  getUpdateFieldPtr(), false, &chunk, false);
+
+        if (!done) MPI_Test(&request, &done, MPI_STATUS_IGNORE);
     }
-}
-#else
-void Simulation::multiplyRow(double *c, const double *b, const GREEN_VAL *a, const int n) {
-    for (int x=0; x<n; ++x) c[x] += b[0]*a[x];
-}
-#endif
 
-/*!
- Distributes the local part of the update field to other nodes and
- receives their local update fields.
- */
-void Simulation::distributeUpdateField(void) {
-#ifdef MPI_C_FOUND
 #ifdef DEBUG
     startTimer(dist_comm_timer);
 #endif
-    int     i;
-    BlockID bid;
 
-    // Copy the local update field values to the send buffer
-    for (i=0; i<numLocalBlocks(); ++i) {
-        bid = updateFieldSendIDs[i];
-        updateFieldSendBuf[i] = getUpdateFieldPtr()[bid];       // getUpdateField{Send/Recv}Buff[] declared in core/Comm.h as double * . note that it is "new"
-    }
+    if (!done) MPI_Wait(&request, MPI_STATUS_IGNORE);
 
-    // check the buffer allocations for correct size. what about numLocalBlocks() what if this is 0?
-    MPI_Allgatherv(updateFieldSendBuf,
-                   numLocalBlocks(),
-                   MPI_DOUBLE,
-                   updateFieldRecvBuf,
-                   updateFieldCounts,
-                   updateFieldDisps,
-                   MPI_DOUBLE,
-                   MPI_COMM_WORLD);
+#ifdef DEBUG
+    stopTimer(dist_comm_timer);
+#endif
 
-    // Copy the received values from the buffer to the update field
+    // Copy the received values to the update field, keeping the values
+    // of the last exchange up to date for sparse exchanges
     for (i=0; i<numGlobalBlocks(); ++i) {
         bid = updateFieldRecvIDs[i];
-        getUpdateFieldPtr()[bid] = updateFieldRecvBuf[i];
+        updateFieldLast[bid] = getUpdateFieldPtr()[bid] = updateFieldRecvBuf[i];
     }
 
-#ifdef DEBUG
-    stopTimer(dist_comm_timer);
-#endif
+    exchange_bytes += numGlobalBlocks()*sizeof(double);
+    exchange_dense_bytes += numGlobalBlocks()*sizeof(double);
+    num_dense_exchanges++;
+
+    // Add the remote columns and recompute the CFFs
+    matrixVectorMultiplyAccum(getShearStressPtr(), greenShear(), normal, normal_greens,
+                              getUpdateFieldPtr(), false, &overlap_remote_cols, true);
+#else
+    distributeUpdateField();
+    updateStressesAndCFFs(true);
 #endif
 }
 
@@ -990,47 +1603,57 @@ void Simulation::collectEventSweep(quakelib::ModelSweeps &sweeps) {
 void Simulation::partitionBlocks(void) {
     int                     i;
 #ifdef MPI_C_FOUND
-    PartitionMethod                 part_method = PARTITION_DISTANCE;
+    PartitionMethod                 part_method = getPartitionMethod();
     int                             world_size, num_global_blocks, num_local_blocks, local_rank, j, n;
-    std::multimap<int, BlockID>::iterator   it, it_start, it_end;
     std::set<BlockID>               cur_assigns;
     std::set<BlockID>::iterator     bit;
     std::set<BlockID>               avail_ids;
-    //BlockID                         *assign_array;        // declare in line?
-    int                             num_assign;
     BlockList::iterator             git;
     bool                            more_to_assign;
     FaultID                         cur_fault;
     std::multimap<double, BlockID>  dist_map;
     BlockID                         base_id;
+    PartitionInput                  part_input;
+    CouplingGraph                   coupling;
+    Partitioner                     *partitioner;
+    std::vector<int>                block_parts;
+    std::vector<BlockIDList>        node_blocks;
+    double                          imbalance, cut_fraction;
 
     world_size = getWorldSize();
     num_global_blocks = numGlobalBlocks();
     num_local_blocks = num_global_blocks/world_size;
     local_rank = getNodeRank();
+    clearPartition(num_global_blocks);
 
-    //
-    // Make a set of available BlockIDs
-    for (git=begin(); git!=end(); ++git) avail_ids.insert(git->getBlockID());
+    // The node of each block, decided on the root node and then transmitted to other nodes
+    block_parts.assign(num_global_blocks, -1);
 
-    // Segment->Node assignment is made at the root node, then transmitted to other nodes
-    // Since it is relatively simple, it won't take much time
-    for (i=0; i<world_size; ++i) {
-        cur_assigns.clear();
+    for (git=begin(); git!=end(); ++git) {
+        part_input.centers.push_back(git->center());
+        part_input.areas.push_back(git->area());
+    }
 
-        if (isRootNode()) {
-            switch (part_method) {
-                case PARTITION_BLOCK:
+    switch (part_method) {
+        case PARTITION_BLOCK:
+        case PARTITION_DISTANCE:
+            if (!isRootNode()) break;
+
+            //
+            // Make a set of available BlockIDs
+            for (git=begin(); git!=end(); ++git) avail_ids.insert(git->getBlockID());
+
+            for (i=0; i<world_size; ++i) {
+                cur_assigns.clear();
+
+                if (part_method == PARTITION_BLOCK) {
                     if (i == world_size-1) num_local_blocks = avail_ids.size();
 
                     for (n=0; n<num_local_blocks; ++n) {
                         cur_assigns.insert(*(avail_ids.begin()));
                         avail_ids.erase(avail_ids.begin());
                     }
-
-                    break;
-
-                case PARTITION_DISTANCE:
+                } else {
                     base_id = UNDEFINED_ELEMENT_ID;
 
                     if (i == world_size-1) num_local_blocks = avail_ids.size();
@@ -1065,53 +1688,63 @@ void Simulation::partitionBlocks(void) {
                         // If we're out of blocks to assign, start another fault
                         if (dist_map.size() == 0) base_id = UNDEFINED_ELEMENT_ID;
                     }
+                }
 
-                    break;
-
-                default:
-                    throw std::logic_error("Unknown partitioning method.");
-                    break;
+                for (bit=cur_assigns.begin(); bit!=cur_assigns.end(); ++bit) block_parts[*bit] = i;
             }
-        }
 
-        // Send the BlockIDs to all nodes
-        num_assign = cur_assigns.size();
-        MPI_Bcast(&num_assign, 1, MPI_INT, ROOT_NODE_RANK, MPI_COMM_WORLD);
-        //
-        // try delclaring/deleting inline...
-        //assign_array = new BlockID[num_assign];
-        BlockID *assign_array = new BlockID[num_assign];
+            assertThrow(avail_ids.size()==0, "Did not assign all blocks in partitioning.");
+            break;
 
-        //
-        // Put the assigned IDs into the array on the root node
-        if (isRootNode()) {
-            //
-            for (n=0,bit=cur_assigns.begin(); bit!=cur_assigns.end(); ++n,++bit) {
-                assign_array[n] = *bit;
-            }
-        }
+        case PARTITION_RCB:
+        case PARTITION_SFC:
+            if (!isRootNode()) break;
 
+            if (part_method == PARTITION_RCB) partitioner = new RCBPartitioner;
+            else partitioner = new SFCPartitioner;
 
-        // Broadcast the assignments to all nodes
-        // what is the correct MPI data type to use here? int has size 4; MPI_INT 8.
-        //MPI_Bcast(assign_array, num_assign, MPI_INT, ROOT_NODE_RANK, MPI_COMM_WORLD);
-        MPI_Bcast(assign_array, num_assign, MPI_UNSIGNED, ROOT_NODE_RANK, MPI_COMM_WORLD);
+            partitioner->partition(part_input, world_size, block_parts);
+            delete partitioner;
+            break;
 
-        //
-        for (n=0; n<num_assign; ++n) {
-            if (local_rank == i) {
-                local_block_ids.push_back(assign_array[n]);
-                global_block_ids.insert(std::make_pair(assign_array[n], n));
-            }
+        case PARTITION_GRAPH:
+            // All nodes take part in building and refining the graph
+            partitioner = new GraphPartitioner(local_rank, world_size);
+            partitioner->partition(part_input, world_size, block_parts);
+            delete partitioner;
+            break;
 
-            block_node_map.insert(std::make_pair(assign_array[n], i));
-            node_block_map.insert(std::make_pair(i, assign_array[n]));
-        }
+        default:
+            throw std::logic_error("Unknown partitioning method.");
+            break;
+    }
 
-        delete [] assign_array;
+    // Send the assignments to all nodes
+    MPI_Bcast(block_parts.data(), num_global_blocks, MPI_INT, ROOT_NODE_RANK, MPI_COMM_WORLD);
+
+    // Assign the blocks of each node in order of block ID
+    node_blocks.resize(world_size);
+
+    for (n=0; n<num_global_blocks; ++n) {
+        assertThrow(block_parts[n] >= 0 && block_parts[n] < world_size, "Did not assign all blocks in partitioning.");
+        node_blocks[block_parts[n]].push_back(n);
     }
 
-    if (isRootNode()) assertThrow(avail_ids.size()==0, "Did not assign all blocks in partitioning.");
+    for (i=0; i<world_size; ++i) {
+        for (n=0; n<(int)node_blocks[i].size(); ++n) assignBlock(node_blocks[i][n], i, local_rank == i);
+    }
+
+    finishPartition(world_size);
+
+    // Report how balanced the nodes are and how much of the coupling between neighboring blocks crosses nodes
+    buildCouplingGraph(part_input, local_rank, world_size, coupling);
+    evaluatePartition(coupling, block_parts, world_size, imbalance, cut_fraction);
+
+    if (isRootNode() && world_size > 1) {
+        console() << "# Partitioned " << num_global_blocks << " elements over " << world_size << " processes with "
+                  << getPartitionMethodName() << ": imbalance " << imbalance << ", coupling cut "
+                  << 100.0*cut_fraction << "%." << std::endl;
+    }
 
     //
     // these are declared and deallocated in core/Comm.h.
@@ -1129,23 +1762,33 @@ void Simulation::partitionBlocks(void) {
     failBlockCounts = new int[world_size];
     failBlockDisps = new int[world_size];
 
+    // No values have been exchanged yet, so the first exchange sends all values that are not NaN
+    updateFieldLast = new double[num_global_blocks];
+    updateFieldDeltaSendBuf = new BlockVal[numLocalBlocks()];
+    updateFieldDeltaRecvBuf = new BlockVal[num_global_blocks];
+    updateFieldDeltaCounts = new int[world_size];
+    updateFieldDeltaDisps = new int[world_size];
+
+    for (i=0; i<num_global_blocks; ++i) updateFieldLast[i] = std::numeric_limits<double>::quiet_NaN();
+
     // Get the counts of elements from each node and order them in the receive ID list
     for (j=0,i=0; i<world_size; ++i) {
-        updateFieldCounts[i] = node_block_map.count(i);
-        failBlockCounts[i] = node_block_map.count(i);
-
-        it_start = node_block_map.equal_range(i).first;
-        it_end = node_block_map.equal_range(i).second;
+        updateFieldCounts[i] = numNodeBlocks(i);
+        failBlockCounts[i] = numNodeBlocks(i);
 
         // Figure out what IDs we will get in the receive buffer
-        for (it=it_start; it!=it_end; ++it,++j) updateFieldRecvIDs[j] = it->second;
+        for (n=0; n<numNodeBlocks(i); ++n,++j) updateFieldRecvIDs[j] = getNodeBlock(i, n);
 
         // If we're on the local node, also record the order of IDs for the send buffer
         if (i == local_rank) {
-            for (n=0,it=it_start; it!=it_end; ++it,++n) updateFieldSendIDs[n] = it->second;
+            for (n=0; n<numNodeBlocks(i); ++n) updateFieldSendIDs[n] = getNodeBlock(i, n);
         }
     }
 
+    blockFieldWorldSize = world_size;
+    blockFieldNumLocal = numLocalBlocks();
+    blockFieldNumGlobal = num_global_blocks;
+
     // Create the displacement map for receiving update field and block failure values
     updateFieldDisps[0] = failBlockDisps[0] = 0;
 
@@ -1155,17 +1798,14 @@ void Simulation::partitionBlocks(void) {
     }
 
 #else
+    clearPartition(numGlobalBlocks());
 
-    for (i=0; i<numGlobalBlocks(); ++i) {
-        local_block_ids.push_back(i);
-        global_block_ids.insert(std::make_pair(i, i));
-        block_node_map.insert(std::make_pair(i, 0));
-    }
+    for (i=0; i<numGlobalBlocks(); ++i) assignBlock(i, 0, true);
 
+    finishPartition(1);
 #endif
     //
     mult_buffer = NULL;
-    decompress_buf = NULL;
 }
 
 // yoder:
@@ -1183,15 +1823,12 @@ void Simulation::setGreens(const BlockID &r, const BlockID &c, const double &new
     // yoder: ... and now, specify blockID values in max/min() to distinguish (off)diag greens elements.
     //
 
-    // Schultz:: Add a factor from 0 to 1 that multiplies off diagonal
-    double factor = getGreenOffDiagMultiplier();
+    double shear = new_green_shear, normal = new_green_normal;
 
-    if (r == c || factor < 0 || factor > 1) {
-        factor = 1.0;
-    }
-
-    greenShear()->setVal(getLocalInd(r), c, std::max(getGreenShearMin(r,c), std::min(new_green_shear*factor, getGreenShearMax(r,c))));
-    greenNormal()->setVal(getLocalInd(r), c, std::max(getGreenNormalMin(r,c), std::min(new_green_normal*factor, getGreenNormalMax(r,c))));
+    clipGreens(r, c, shear, normal);
+    greenShear()->setVal(getLocalInd(r), c, shear);
+    greenNormal()->setVal(getLocalInd(r), c, normal);
+    ++greens_version;
 
     // original update code:
     /*
@@ -1205,6 +1842,184 @@ void Simulation::setGreens(const BlockID &r, const BlockID &c, const double &new
     if (r == c) setSelfStresses(r, std::max(getGreenShearMin(r,c), std::min(new_green_shear, getGreenShearMax(r,c))), std::max(getGreenNormalMin(r,c), std::min(new_green_normal, getGreenNormalMax(r,c))));
 };
 
+/*!
+ Apply the off diagonal multiplier and the min/max limits to a pair of Greens values,
+ giving the values setGreens() would store.
+ */
+void Simulation::clipGreens(const BlockID &r, const BlockID &c, double &shear, double &normal) const {
+    // Schultz:: Add a factor from 0 to 1 that multiplies off diagonal
+    double factor = getGreenOffDiagMultiplier();
+
+    if (r == c || factor < 0 || factor > 1) {
+        factor = 1.0;
+    }
+
+    shear = std::max(getGreenShearMin(r,c), std::min(shear*factor, getGreenShearMax(r,c)));
+    normal = std::max(getGreenNormalMin(r,c), std::min(normal*factor, getGreenNormalMax(r,c)));
+}
+
+/*!
+ Convert the Greens matrices to integer codes if int16 or int8 storage was requested.
+ The self interaction of each local block is kept in full precision.
+ */
+void Simulation::quantizeGreens(void) {
+    std::vector<unsigned int>   exact_cols(numLocalBlocks());
+    int                         lid, bits;
+
+    if (getGreensStorage() != GREENS_STORAGE_INT16 && getGreensStorage() != GREENS_STORAGE_INT8) return;
+
+    for (lid=0; lid<numLocalBlocks(); ++lid) exact_cols[lid] = getGlobalBID(lid);
+
+    bits = (getGreensStorage() == GREENS_STORAGE_INT16 ? 16 : 8);
+
+    if (greenShear()->quantize(exact_cols)) {
+        console() << "# Greens shear matrix quantized to " << bits << " bit codes in "
+                  << greenShear()->mem_bytes()/(1024.0*1024.0) << " megabytes" << std::endl;
+    }
+
+    if (greenNormal()->quantize(exact_cols)) {
+        console() << "# Greens normal matrix quantized to " << bits << " bit codes in "
+                  << greenNormal()->mem_bytes()/(1024.0*1024.0) << " megabytes" << std::endl;
+    }
+
+    ++greens_version;
+}
+
+/*!
+ Place the pages of the dense Greens matrices on NUMA systems. Each matrix-vector
+ multiplication thread zeroes, and so first touches, the rows it will multiply,
+ which puts them in the memory of the node it is running on. With interleave the
+ pages are instead spread round robin over all nodes. Must be called after
+ setupArrays() and before the matrices are filled. Compressed, hierarchical,
+ sparse and quantized matrices are not affected.
+ */
+void Simulation::placeGreens(void) {
+    GreensMatrix    *mats[2];
+    int             m, nthreads;
+
+    if (getNUMAPlacement() == NUMA_PLACEMENT_NONE) return;
+
+    mats[0] = greenShear();
+    mats[1] = greenNormal();
+
+#ifdef VQ_HAVE_NUMA
+
+    if (getNUMAPlacement() == NUMA_PLACEMENT_INTERLEAVE && numa_available() >= 0) {
+        for (m=0; m<2; ++m) {
+            if (mats[m]->denseData()) numa_interleave_memory(mats[m]->denseData(), mats[m]->mem_bytes(), numa_all_nodes_ptr);
+        }
+    }
+
+#endif
+
+    // Touch the rows with the same threads and split as the multiplication
+    nthreads = matVecThreads(localSize());
+
+    #pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+    {
+        int         t, nt, n, first, last;
+
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+        nt = omp_get_num_threads();
+#else
+        t = 0;
+        nt = 1;
+#endif
+        threadRows(t, nt, localSize(), first, last);
+
+        for (n=0; n<2; ++n) mats[n]->clearRows(first, last);
+    }
+}
+
+/*!
+ Pin each thread to a CPU according to sim.system.thread_affinity. Only the CPUs the
+ process is allowed to run on are used. Processes on the same node that the MPI launcher
+ did not bind to separate CPU sets all see the same set, which is then split between
+ them. Records the CPU of each thread in thread_cpus, which is left empty if the threads
+ could not be pinned.
+ */
+void Simulation::pinThreads(void) {
+#ifdef VQ_HAVE_SCHED_SETAFFINITY_FUNC
+    cpu_set_t           allowed;
+    std::vector<int>    cpus;
+    int                 i, failures, shared_rank, first, last;
+
+    thread_cpus.clear();
+    pin_shared_procs = 1;
+
+    if (getThreadAffinity() == THREAD_AFFINITY_NONE) return;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) CPU_ZERO(&allowed);
+
+    // Find the other processes on this node with exactly the same CPU set
+    shared_rank = 0;
+#if defined(MPI_C_FOUND) && MPI_VERSION >= 3
+    std::vector<cpu_set_t>  node_sets;
+    MPI_Comm                node_comm;
+    int                     node_rank, node_size;
+
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, getNodeRank(), MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+    node_sets.resize(node_size);
+    MPI_Allgather(&allowed, sizeof(cpu_set_t), MPI_BYTE, &node_sets[0], sizeof(cpu_set_t), MPI_BYTE, node_comm);
+    MPI_Comm_free(&node_comm);
+
+    pin_shared_procs = 0;
+
+    for (i=0; i<node_size; ++i) {
+        if (!CPU_EQUAL(&node_sets[i], &allowed)) continue;
+
+        if (i < node_rank) shared_rank++;
+
+        pin_shared_procs++;
+    }
+
+#endif
+
+    for (i=0; i<CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &allowed)) cpus.push_back(i);
+    }
+
+    // Give each process sharing the set its own contiguous part of it
+    first = ((unsigned long)shared_rank*cpus.size())/pin_shared_procs;
+    last = ((unsigned long)(shared_rank+1)*cpus.size())/pin_shared_procs;
+    cpus = std::vector<int>(cpus.begin()+first, cpus.begin()+last);
+
+    if (cpus.empty()) return;
+
+    // Compact puts neighboring threads on neighboring CPUs, spread leaves even gaps between them
+    thread_cpus.resize(num_threads);
+
+    for (i=0; i<num_threads; ++i) {
+        if (getThreadAffinity() == THREAD_AFFINITY_COMPACT) thread_cpus[i] = cpus[i%cpus.size()];
+        else thread_cpus[i] = cpus[((unsigned long)i*cpus.size())/num_threads];
+    }
+
+    failures = 0;
+
+    #pragma omp parallel num_threads(num_threads) reduction(+:failures)
+    {
+        cpu_set_t   mask;
+        int         t;
+
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#else
+        t = 0;
+#endif
+        CPU_ZERO(&mask);
+        CPU_SET(thread_cpus[t], &mask);
+
+        if (sched_setaffinity(0, sizeof(mask), &mask)) failures++;
+    }
+
+    if (failures) thread_cpus.clear();
+
+#endif
+}
+
 // yoder:
 void Simulation::debug_out(std::string str_in) {
     // simple debug output code; print the inout string plus the process_id, node_rank.
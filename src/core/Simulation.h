@@ -25,6 +25,7 @@
 #include "SimData.h"
 #include "Comm.h"
 #include "CommPartition.h"
+#include "GreensKernels.h"
 #include "HDF5Data.h"
 
 #ifdef VQ_HAVE_LIMITS_H
@@ -46,12 +47,6 @@
 #include <sstream>
 #include <iomanip>
 
-enum PartitionMethod {
-    PARTITION_UNDEFINED,
-    PARTITION_BLOCK,
-    PARTITION_DISTANCE
-};
-
 /*!
  Simulation is an instantiation of a Virtual California simulation using the SimFramework.
  It contains functions related to the simulation, parameter retrieval functions and basic
@@ -91,6 +86,13 @@ class Simulation : public SimFramework, public VCParams, public VCSimData, publi
         };
         // yoder: move content to Simulation.cpp (enforcing min/max values for greens values).
         void setGreens(const BlockID &r, const BlockID &c, const double &new_green_shear, const double &new_green_normal);
+        void clipGreens(const BlockID &r, const BlockID &c, double &shear, double &normal) const;
+        void quantizeGreens(void);
+        void placeGreens(void);
+        //! Counter incremented whenever a Greens value is set, used to invalidate values derived from the matrices.
+        unsigned int getGreensVersion(void) const {
+            return greens_version;
+        };
         // yoder:
         void debug_out(std::string str_in);
 
@@ -117,19 +119,32 @@ class Simulation : public SimFramework, public VCParams, public VCSimData, publi
         void determineBlockNeighbors(void);
         void computeCFFs(void);
         void calcCFF(const BlockID gid);
-        void matrixVectorMultiplyAccum(double *c, const quakelib::DenseMatrix<GREEN_VAL> *a, const double *b, const bool dense);
-        void multiplySumRow(double *c, const double *b, const GREEN_VAL *a, const int n, const bool dense);
-        void multiplyRow(double *c, const double *b, const GREEN_VAL *a, const int n);
+        //! Local indices of the blocks whose CFF changed since the last clearChangedCFFs()
+        const std::vector<int> &changedCFFs(void) const {
+            return cff_changed_lids;
+        };
+        void clearChangedCFFs(void);
+        void matrixVectorMultiplyAccum(double *c, const GreensMatrix *a, const double *b, const bool dense);
+        void matrixVectorMultiplyAccum(double *c, const GreensMatrix *a, const double *b, const BlockIDList &cols);
+        void stressMatrixVectorMultiplyAccum(double *shear, double *normal, const double *b, const bool dense);
+        void updateStressesAndCFFs(const bool dense);
+        void updateStressesAndCFFs(const BlockIDList &cols);
+        template <class CELL_TYPE>
+        void multiplySumRow(double *c, const double *b, const CELL_TYPE *a, const int n, const bool dense);
+        template <class CELL_TYPE>
+        void multiplyRow(double *c, const double *b, const CELL_TYPE *a, const int n);
         void distributeUpdateField(void);
+        void distributeUpdateFieldAndStresses(void);
         void broadcastUpdateField(void);
         void distributeBlocks(const quakelib::ElementIDSet &local_id_list, BlockIDProcMapping &global_id_list);
         void collectEventSweep(quakelib::ModelSweeps &sweeps);
 
         std::pair<quakelib::ElementIDSet::const_iterator, quakelib::ElementIDSet::const_iterator> getNeighbors(const BlockID &bid) const;
         void printTimers(void);
+        void printExchangeStats(void);
 
         bool isLocalBlockID(const BlockID &block_id) const {
-            return (block_node_map.at(block_id) == node_rank);
+            return (block_node_map[block_id] == node_rank);
         };
 
         double getSlipDeficit(const BlockID gid) {
@@ -143,6 +158,8 @@ class Simulation : public SimFramework, public VCParams, public VCSimData, publi
             return cff[gid];
         };
         void setCFF(const BlockID gid, const double new_cff) {
+            if (new_cff != cff[gid]) markCFFChanged(gid);
+
             cff[gid] = new_cff;
         };
         double getCFF0(const BlockID gid) {
@@ -169,8 +186,11 @@ class Simulation : public SimFramework, public VCParams, public VCSimData, publi
         //! This occurs if the block is on the same fault as the trigger
         //! and it undergoes a significant CFF shift during this event
         //! (where significant is defined in terms of dynamic_val).
-        bool dynamicFailure(const BlockID gid, const FaultID event_fault) const {
-            return (getBlock(gid).getFaultID() == event_fault &&
+        //! The block is given by its local index lid.
+        bool dynamicFailure(const int lid, const FaultID event_fault) const {
+            BlockID gid = localGID(lid);
+
+            return (localFaultID(lid) == event_fault &&
                     cff[gid] > cff0[gid] && fabs(cff[gid]-cff0[gid])/fabs(cff0[gid]) > dynamic_val[gid]);
             //// Schultz: Adding absolute value since we also check that the CFF has increased,
             // the absolute value will enable handling of CFF>0 or CFF<0.
@@ -363,9 +383,48 @@ class Simulation : public SimFramework, public VCParams, public VCSimData, publi
         //! Current simulation year
         double                      year;
 
-        //! Temporary buffer used to speed up calculations
+        //! Temporary buffer used to speed up calculations, with room for the results of two matrices
         double                      *mult_buffer;
-        GREEN_VAL                   *decompress_buf;
+        //! Update field with all but the used columns set to zero, for matrices without a per-column multiply
+        std::vector<double>         masked_vec;
+        //! Columns of the local and the other nodes' blocks, multiplied separately to overlap the update field exchange
+        BlockIDList                 overlap_local_cols, overlap_remote_cols;
+
+        void matrixVectorMultiplyAccum(double *c, const GreensMatrix *a, double *c2, const GreensMatrix *a2, const double *b, const bool dense, const BlockIDList *cols, const bool update_cff);
+        void addMultBuffer(double *c, double *c2, const bool update_cff);
+        void hierarchicalMultiplyAccum(double *c, const GreensMatrix *a, double *c2, const GreensMatrix *a2, const double *b, const BlockIDList *cols, const bool update_cff);
+        template <class CODE_TYPE>
+        void quantizedMultiplyAccum(double *c, const quakelib::QuantizedRowMatrix<CODE_TYPE> *a, double *c2, const quakelib::QuantizedRowMatrix<CODE_TYPE> *a2, const double *b, const bool dense, const BlockIDList *cols, const bool update_cff);
+        template <class CELL_TYPE>
+        void compressedMultiplyAccum(double *c, const quakelib::CompressedRowMatrix<CELL_TYPE> *a, double *c2, const quakelib::CompressedRowMatrix<CELL_TYPE> *a2, const double *b, const bool dense, const BlockIDList *cols, const bool update_cff);
+        template <class CELL_TYPE>
+        void sparseMultiplyAccum(double *c, const quakelib::SparseRowMatrix<CELL_TYPE> *a, double *c2, const quakelib::SparseRowMatrix<CELL_TYPE> *a2, const double *b, const bool dense, const BlockIDList *cols, const bool update_cff);
+        template <class CELL_TYPE>
+        void matrixVectorMultiplyAccum(double *c, const quakelib::DenseMatrix<CELL_TYPE> *a, double *c2, const quakelib::DenseMatrix<CELL_TYPE> *a2, const double *b, const bool dense, const BlockIDList *cols, const bool update_cff);
+
+        //! Number of threads used in the matrix-vector multiplication
+        int                         num_threads;
+
+        //! CPU each thread was pinned to, empty if the threads are not pinned
+        std::vector<int>            thread_cpus;
+        //! Number of processes on this node sharing the CPU set the threads were pinned from
+        int                         pin_shared_procs;
+
+        int matVecThreads(const int &array_dim) const;
+        static void threadRows(const int &t, const int &nt, const int &array_dim, int &first, int &last);
+        void pinThreads(void);
+
+        //! Number of times Greens values have been set
+        unsigned int                greens_version;
+
+        //! Local blocks whose CFF changed since the last clearChangedCFFs(), with a flag per local block
+        std::vector<int>            cff_changed_lids;
+        std::vector<bool>           cff_changed;
+
+        void markCFFChanged(const BlockID gid);
+
+        //! Vector kernels used in the matrix-vector multiplication
+        GreensKernels               kernels;
 
         //! Files to write stress records to
         std::ofstream       stress_index_outfile, stress_outfile;
@@ -0,0 +1,279 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "DenseSolver.h"
+
+#include <algorithm>
+#include <vector>
+
+#ifdef VQ_HAVE_MATH_H
+#include <math.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef VQ_HAVE_LAPACK
+extern "C" {
+    void dgetrf_(const int *m, const int *n, double *a, const int *lda, int *ipiv, int *info);
+    void dgetrs_(const char *trans, const int *n, const int *nrhs, const double *a, const int *lda, const int *ipiv, double *b, const int *ldb, int *info);
+}
+#endif
+
+// Number of columns factored together before the trailing matrix is updated
+#define LU_BLOCK_COLS       64
+// Number of trailing columns updated at a time, so the used rows of U stay in cache
+#define LU_TILE_COLS        512
+// Minimum number of rows to update before the work is split over threads
+#define LU_MIN_THREAD_ROWS  64
+
+/*!
+ Solve A x = b by LU factorization with partial pivoting. The columns are
+ factored in panels of LU_BLOCK_COLS. Each panel is factored
+ column by column, then the rows of U to its right are solved, and finally
+ the trailing matrix is updated with the whole panel at once. The updates
+ are split over OpenMP threads by row. Every element is still updated in the
+ same order as in column by column elimination, so the result does not
+ depend on the block size or thread count. Rows are only swapped if a pivot
+ is strictly larger in magnitude than the diagonal, so diagonally dominant
+ systems are solved exactly as by unpivoted Gaussian elimination.
+ */
+void solveLU(const int &n, double *x, double *A, double *b) {
+    std::vector<int>    piv(n);
+
+    factorLU(n, A, &piv[0], 0);
+    solveFactoredLU(n, x, A, &piv[0], b);
+}
+
+/*!
+ Factor the columns [first, n) of A in place. The columns before first must
+ already be factored and the trailing rows and columns updated with them, as
+ is the case for a bordered system whose Schur complement has been formed.
+ Row interchanges swap whole rows, so they also reorder the multipliers of
+ the already factored columns.
+ */
+void factorLU(const int &n, double *A, int *piv, const int &first) {
+    int                 i, j, k, p, kb, ke, kk, kt;
+    double              v, f, max_val;
+
+    for (kb=first; kb<n; kb+=LU_BLOCK_COLS) {
+        ke = std::min(kb+LU_BLOCK_COLS, n);
+
+        // Factor the panel of columns [kb, ke)
+        for (i=kb; i<ke; ++i) {
+            // Find the pivot row
+            p = i;
+            max_val = fabs(A[i*n+i]);
+
+            for (j=i+1; j<n; ++j) {
+                if (fabs(A[j*n+i]) > max_val) {
+                    max_val = fabs(A[j*n+i]);
+                    p = j;
+                }
+            }
+
+            piv[i] = p;
+
+            if (p != i) {
+                for (k=0; k<n; ++k) std::swap(A[i*n+k], A[p*n+k]);
+            }
+
+            v = A[i*n+i];
+
+            // Compute the multipliers and update the rest of the panel
+            #pragma omp parallel for private(f, k) schedule(static) if(n-i > LU_MIN_THREAD_ROWS)
+
+            for (j=i+1; j<n; ++j) {
+                f = A[j*n+i]/v;
+                A[j*n+i] = f;
+
+                for (k=i+1; k<ke; ++k) A[j*n+k] -= f*A[i*n+k];
+            }
+        }
+
+        if (ke == n) break;
+
+        // Solve for the rows of U to the right of the panel
+        for (i=kb; i<ke; ++i) {
+            for (j=i+1; j<ke; ++j) {
+                f = A[j*n+i];
+
+                for (k=ke; k<n; ++k) A[j*n+k] -= f*A[i*n+k];
+            }
+        }
+
+        // Update the trailing matrix one tile of columns at a time
+        #pragma omp parallel for private(i, f, k, kk, kt) schedule(static) if(n-ke > LU_MIN_THREAD_ROWS)
+
+        for (j=ke; j<n; ++j) {
+            for (kk=ke; kk<n; kk+=LU_TILE_COLS) {
+                kt = std::min(kk+LU_TILE_COLS, n);
+
+                for (i=kb; i<ke; ++i) {
+                    f = A[j*n+i];
+
+                    for (k=kk; k<kt; ++k) A[j*n+k] -= f*A[i*n+k];
+                }
+            }
+        }
+    }
+
+}
+
+/*!
+ Solve A x = b given the LU factors of A from factorLU. b is overwritten.
+ */
+void solveFactoredLU(const int &n, double *x, const double *A, const int *piv, double *b) {
+    int                 i, j;
+    double              sum;
+
+    // Apply the row swaps to b, then solve L y = b and U x = y
+    for (i=0; i<n; ++i) {
+        if (piv[i] != i) std::swap(b[i], b[piv[i]]);
+    }
+
+    for (i=0; i<n; ++i) {
+        for (j=i+1; j<n; ++j) b[j] -= A[j*n+i]*b[i];
+    }
+
+    for (i=n-1; i>=0; --i) {
+        sum = b[i];
+
+        for (j=i+1; j<n; ++j) sum -= A[i*n+j]*x[j];
+
+        x[i] = sum/A[i*n+i];
+    }
+}
+
+void IncrementalLU::clear(void) {
+    n = 0;
+    lu.clear();
+    piv.clear();
+}
+
+void IncrementalLU::factor(const int &new_n, const double *A) {
+    n = new_n;
+    lu.assign(A, A+n*n);
+    piv.resize(n);
+
+    if (n > 0) factorLU(n, &lu[0], &piv[0], 0);
+}
+
+/*!
+ Extend the factors P A11 = L11 U11 of the current n by n system to the
+ bordered system [A11 A12; A21 A22] with k new rows and columns:
+ U12 = L11^-1 P A12, L21 = A21 U11^-1, and the Schur complement
+ A22 - L21 U12 is then factored with pivoting among the new rows only.
+ A12 is n by k, A21 is k by n and A22 is k by k, all stored by row.
+ */
+void IncrementalLU::extend(const int &k, const double *A12, const double *A21, const double *A22) {
+    std::vector<double>     old_lu;
+    int                     i, j, l, m;
+    double                  f, sum;
+
+    if (k == 0) return;
+
+    m = n+k;
+    old_lu.swap(lu);
+    lu.resize(m*m);
+    piv.resize(m);
+
+    for (i=0; i<n; ++i) {
+        std::copy(&old_lu[i*n], &old_lu[i*n]+n, &lu[i*m]);
+        std::copy(&A12[i*k], &A12[i*k]+k, &lu[i*m+n]);
+    }
+
+    for (i=0; i<k; ++i) {
+        std::copy(&A21[i*n], &A21[i*n]+n, &lu[(n+i)*m]);
+        std::copy(&A22[i*k], &A22[i*k]+k, &lu[(n+i)*m+n]);
+    }
+
+    // Apply the previous row swaps to A12, then U12 = L11^-1 A12
+    for (i=0; i<n; ++i) {
+        if (piv[i] != i) {
+            for (l=n; l<m; ++l) std::swap(lu[i*m+l], lu[piv[i]*m+l]);
+        }
+    }
+
+    for (i=0; i<n; ++i) {
+        #pragma omp parallel for private(f, l) schedule(static) if(n-i > LU_MIN_THREAD_ROWS)
+
+        for (j=i+1; j<n; ++j) {
+            f = lu[j*m+i];
+
+            for (l=n; l<m; ++l) lu[j*m+l] -= f*lu[i*m+l];
+        }
+    }
+
+    // L21 = A21 U11^-1 and the Schur complement, one new row at a time
+    #pragma omp parallel for private(i, l, f, sum) schedule(static)
+
+    for (j=n; j<m; ++j) {
+        for (i=0; i<n; ++i) {
+            sum = lu[j*m+i];
+
+            for (l=0; l<i; ++l) sum -= lu[j*m+l]*lu[l*m+i];
+
+            lu[j*m+i] = sum/lu[i*m+i];
+        }
+
+        for (i=0; i<n; ++i) {
+            f = lu[j*m+i];
+
+            for (l=n; l<m; ++l) lu[j*m+l] -= f*lu[i*m+l];
+        }
+    }
+
+    n = m;
+    factorLU(n, &lu[0], &piv[0], n-k);
+}
+
+void IncrementalLU::solve(double *x, double *b) const {
+    if (n > 0) solveFactoredLU(n, x, &lu[0], &piv[0], b);
+}
+
+#ifdef VQ_HAVE_LAPACK
+/*!
+ Solve A x = b with LAPACK. LAPACK stores matrices by column, so A is passed
+ as its transpose and the transposed system is solved.
+ */
+bool solveLAPACK(const int &n, double *x, double *A, double *b) {
+    std::vector<int>    piv(n);
+    int                 i, info, nrhs;
+    char                trans;
+
+    if (n == 0) return true;
+
+    nrhs = 1;
+    trans = 'T';
+    dgetrf_(&n, &n, A, &n, &piv[0], &info);
+
+    if (info != 0) return false;
+
+    dgetrs_(&trans, &n, &nrhs, A, &n, &piv[0], b, &n, &info);
+
+    if (info != 0) return false;
+
+    for (i=0; i<n; ++i) x[i] = b[i];
+
+    return true;
+}
+#endif
@@ -0,0 +1,77 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "config.h"
+
+#include <vector>
+
+#ifndef _DENSE_SOLVER_H_
+#define _DENSE_SOLVER_H_
+
+/*
+ Solvers for the dense linear systems A x = b of the secondary failure slips.
+ A is an n by n matrix stored by row (A[row*n+col]). Both A and b are
+ overwritten by the solvers.
+ */
+
+// Solve with a blocked LU factorization with partial pivoting
+void solveLU(const int &n, double *x, double *A, double *b);
+
+// Factor the columns [first, n) of A in place, recording the row interchanges in piv
+void factorLU(const int &n, double *A, int *piv, const int &first);
+
+// Solve using the factors and row interchanges computed by factorLU, b is overwritten
+void solveFactoredLU(const int &n, double *x, const double *A, const int *piv, double *b);
+
+/*
+ LU factors of a system that can grow by bordering it with new rows and
+ columns, so the factors of the previous system are reused and only the new
+ rows and columns cost O(n^2 k) to factor. The new rows and columns are
+ ordered after the existing ones.
+ */
+class IncrementalLU {
+    private:
+        int                 n;
+        std::vector<double> lu;
+        std::vector<int>    piv;
+
+    public:
+        IncrementalLU(void) : n(0) {};
+
+        int size(void) const {
+            return n;
+        };
+
+        void clear(void);
+        // Factor the n by n system A from scratch
+        void factor(const int &new_n, const double *A);
+        // Add k rows and columns to the factored system
+        void extend(const int &k, const double *A12, const double *A21, const double *A22);
+        // Solve the factored system, b is overwritten
+        void solve(double *x, double *b) const;
+};
+
+#ifdef VQ_HAVE_LAPACK
+// Solve with the LAPACK dgetrf/dgetrs routines. Returns false, leaving x unset,
+// if A is singular or the solve failed. A and b are overwritten either way.
+bool solveLAPACK(const int &n, double *x, double *A, double *b);
+#endif
+
+#endif
@@ -45,12 +45,17 @@ void GreensFuncCalc::progressBar(Simulation *sim, const int &thread_num, const i
 void GreensFuncCalcStandard::CalculateGreens(Simulation *sim) {
     std::vector<int>        row_sizes;
     int                     num_blocks, t_num, n;
+    NodeSharedArray         *shared_shear = NULL;
 
     num_blocks = sim->numGlobalBlocks();
 
     row_sizes.clear();
 
-    for (n=0; n<sim->numGlobalBlocks(); ++n) row_sizes.push_back(sim->isLocalBlockID(n)?num_blocks:sim->numLocalBlocks());
+    // With shared Greens the unsymmetrized shear rows are kept in memory shared on each node instead
+    for (n=0; n<sim->numGlobalBlocks(); ++n) {
+        if (sim->useSharedGreens()) row_sizes.push_back(0);
+        else row_sizes.push_back(sim->isLocalBlockID(n)?num_blocks:sim->numLocalBlocks());
+    }
 
     GreensValsSparseMatrix ssh = GreensValsSparseMatrix(row_sizes);
 
@@ -60,6 +65,8 @@ void GreensFuncCalcStandard::CalculateGreens(Simulation *sim) {
 
     GreensValsSparseMatrix snorm = GreensValsSparseMatrix(row_sizes);
 
+    if (sim->useSharedGreens()) shared_shear = new NodeSharedArray(sizeof(GREEN_VAL)*sim->numLocalBlocks()*num_blocks);
+
     // Get the current thread # for OpenMP to avoid printing multiple progress bars.
 #ifdef _OPENMP
     t_num = omp_get_thread_num();
@@ -72,9 +79,21 @@ void GreensFuncCalcStandard::CalculateGreens(Simulation *sim) {
     #pragma omp parallel for schedule(static,1)
 
     for (n=0; n<sim->numLocalBlocks(); ++n) {
+        BlockID     gid = sim->getGlobalBID(n);
+        GREEN_VAL   *shear_row = (shared_shear ? (GREEN_VAL *)shared_shear->local()+(size_t)n*num_blocks : &ssh[gid][0]);
+
         progressBar(sim, t_num, n);
 
-        InnerCalcStandard(sim, sim->getGlobalBID(n), ssh, snorm);
+        InnerCalcStandard(sim, gid, shear_row, &snorm[gid][0]);
+    }
+
+    if (shared_shear) {
+        symmetrizeShared(sim, *shared_shear, snorm);
+
+        sim->console() << std::endl << "# Shared the shear rows of " << shared_shear->nodeSize()
+                       << " processes on the first node (" << shared_shear->nodeBytes()/1048576.0 << " MB)." << std::flush;
+        delete shared_shear;
+        return;
     }
 
     // Symmetrize the shear stress matrix
@@ -97,8 +116,8 @@ void GreensFuncCalcStandard::CalculateGreens(Simulation *sim) {
 
 void GreensFuncCalcStandard::InnerCalcStandard(Simulation *sim,
                                                const BlockID &bnum,
-                                               GreensValsSparseMatrix &ssh,
-                                               GreensValsSparseMatrix &snorm) {
+                                               GREEN_VAL *shear_row,
+                                               GREEN_VAL *normal_row) {
     Block source_block = sim->getBlock(bnum);
     BlockIDList                         target_blocks;
     BlockIDList::const_iterator         bit;
@@ -114,8 +133,105 @@ void GreensFuncCalcStandard::InnerCalcStandard(Simulation *sim,
 
         target_block.get_rake_and_normal_stress_due_to_block(stress_values, sim->getGreensSampleDistance(), source_block);
 
-        ssh[bnum][*bit] = stress_values[0];
-        snorm[bnum][*bit] = stress_values[1];
+        shear_row[*bit] = stress_values[0];
+        normal_row[*bit] = stress_values[1];
+    }
+}
+
+// **************************************************************************
+// *** H-matrix Okada code
+// **************************************************************************
+/*!
+ Calculate the unclipped Greens values for source row block r and target column block c.
+ The normal value is always calculated, the symmetrized shear value only if need_shear is set.
+ */
+void GreensHMatrixEntries::rawValues(Simulation *sim,
+                                     const BlockID &r,
+                                     const BlockID &c,
+                                     const bool &need_shear,
+                                     double &shear,
+                                     double &normal) {
+    double      stress_values[2], reverse_values[2], r_area, c_area;
+
+    shear = normal = 0;
+
+    //// Schultz, excluding zero slip rate elements from sim by setting Greens to zero
+    if (sim->getBlock(r).slip_rate()==0 || sim->getBlock(c).slip_rate()==0) return;
+
+    Block target_block = sim->getBlock(c);
+    target_block.get_rake_and_normal_stress_due_to_block(stress_values, sim->getGreensSampleDistance(), sim->getBlock(r));
+    normal = stress_values[1];
+
+    if (!need_shear) return;
+
+    // Symmetrize the shear value the same way as symmetrizeMatrix
+    if (r == c) {
+        reverse_values[0] = stress_values[0];
+    } else {
+        Block reverse_block = sim->getBlock(r);
+        reverse_block.get_rake_and_normal_stress_due_to_block(reverse_values, sim->getGreensSampleDistance(), sim->getBlock(c));
+    }
+
+    r_area = sim->getBlock(r).area();
+    c_area = sim->getBlock(c).area();
+    assertThrow(r_area > 0 && c_area > 0, "Blocks cannot have negative area.");
+    shear = 0.5*(reverse_values[0]*r_area + stress_values[0]*c_area)/c_area;
+}
+
+double GreensHMatrixEntries::entry(const unsigned int &row, const unsigned int &col) {
+    BlockID     r = _sim->getGlobalBID(row);
+    double      shear = 0, normal = 0;
+
+    if (_sim->getGreensKillDistance() <= 0 || _sim->getBlock(r).center_distance(_sim->getBlock(col)) <= _sim->getGreensKillDistance()) {
+        rawValues(_sim, r, col, _shear, shear, normal);
+    }
+
+    _sim->clipGreens(r, col, shear, normal);
+
+    return (_shear ? shear : normal);
+}
+
+// Radius of the sphere around the block center containing the whole block
+static double blockRadius(const Block &block) {
+    double      radius = 0;
+
+    for (unsigned int i=0; i<3; ++i) radius = fmax(radius, block.center().dist(block.vert(i)));
+
+    if (block.is_quad()) radius = fmax(radius, block.center().dist(block.implicit_vert()));
+
+    return radius;
+}
+
+void GreensFuncCalcHMatrix::CalculateGreens(Simulation *sim) {
+    std::vector<quakelib::Vec<3> >  row_pts, col_pts;
+    std::vector<double>             row_radii, col_radii;
+    BlockList::iterator             it;
+    GreensHMatrixEntries            shear_entries(sim, true), normal_entries(sim, false);
+    double                          shear, normal;
+    int                             lid;
+
+    for (lid=0; lid<sim->numLocalBlocks(); ++lid) {
+        Block &block = sim->getBlock(sim->getGlobalBID(lid));
+        row_pts.push_back(block.center());
+        row_radii.push_back(blockRadius(block));
+    }
+
+    for (it=sim->begin(); it!=sim->end(); ++it) {
+        col_pts.push_back(it->center());
+        col_radii.push_back(blockRadius(*it));
+    }
+
+    sim->greenShear()->buildHierarchical(row_pts, row_radii, col_pts, col_radii, &shear_entries,
+                                         sim->getHMatrixTolerance(), sim->getHMatrixEta(), sim->getHMatrixLeafSize());
+    sim->console() << "." << std::flush;
+    sim->greenNormal()->buildHierarchical(row_pts, row_radii, col_pts, col_radii, &normal_entries,
+                                          sim->getHMatrixTolerance(), sim->getHMatrixEta(), sim->getHMatrixLeafSize());
+
+    // The diagonal is always in a dense block, set it again so the self stresses are recorded
+    for (lid=0; lid<sim->numLocalBlocks(); ++lid) {
+        BlockID gid = sim->getGlobalBID(lid);
+        GreensHMatrixEntries::rawValues(sim, gid, gid, true, shear, normal);
+        sim->setGreens(gid, gid, shear, normal);
     }
 }
 
@@ -285,6 +401,146 @@ void GreensFuncCalc::symmetrizeMatrix(Simulation *sim, GreensValsSparseMatrix &s
     }
 }
 
+/*!
+ The symmetrized shear value of (r, c) from the unsymmetrized values rc of (r, c) and cr of (c, r).
+ symmetrizeMatrix visits each off diagonal pair twice, first in the row of the lower block ID
+ and then in the row of the higher one. This repeats both visits so the values are identical.
+ */
+static GREEN_VAL symmetricShear(const BlockID &r,
+                                const BlockID &c,
+                                const GREEN_VAL &rc,
+                                const GREEN_VAL &cr,
+                                const double &r_area,
+                                const double &c_area) {
+    GREEN_VAL   lo_hi, hi_lo;
+    double      lo_area, hi_area, sxrl, sxru;
+
+    if (r == c) return 0.5*(cr*r_area + rc*c_area)/c_area;
+
+    lo_hi = (r < c ? rc : cr);
+    hi_lo = (r < c ? cr : rc);
+    lo_area = (r < c ? r_area : c_area);
+    hi_area = (r < c ? c_area : r_area);
+
+    sxru = lo_hi*hi_area;
+    sxrl = hi_lo*lo_area;
+    lo_hi = 0.5*(sxrl + sxru)/hi_area;
+    hi_lo = 0.5*(sxrl + sxru)/lo_area;
+
+    sxru = hi_lo*lo_area;
+    sxrl = lo_hi*hi_area;
+
+    return (r < c ? 0.5*(sxrl + sxru)/hi_area : 0.5*(sxrl + sxru)/lo_area);
+}
+
+/*!
+ Symmetrize the shear values like symmetrizeMatrix and set the simulation Greens values.
+ The unsymmetrized local shear rows are in memory shared by the processes on each node,
+ so the values (c, r) of rows calculated on the same node are read directly. Only rows
+ calculated on other nodes are exchanged, and only the pieces other nodes need are stored.
+ */
+void GreensFuncCalc::symmetrizeShared(Simulation *sim,
+                                      NodeSharedArray &shear_rows,
+                                      GreensValsSparseMatrix &snorm) {
+    std::vector<int>        row_sizes, owner_lids;
+    GREEN_VAL               *local_rows, *owner_rows, rc, cr;
+    double                  r_area, c_area;
+    int                     num_local_blocks, num_global_blocks, node, lid, c, i;
+    BlockID                 gid;
+
+    num_local_blocks = sim->numLocalBlocks();
+    num_global_blocks = sim->numGlobalBlocks();
+    local_rows = (GREEN_VAL *)shear_rows.local();
+
+    // Wait until the rows of all processes on this node are calculated
+    shear_rows.sync();
+
+    // Local index of each block on the node that calculated its row,
+    // and the rows from other nodes that must be exchanged
+    owner_lids.resize(num_global_blocks);
+    row_sizes.resize(num_global_blocks);
+
+    for (node=0; node<sim->getWorldSize(); ++node) {
+        for (i=0; i<sim->numNodeBlocks(node); ++i) {
+            gid = sim->getNodeBlock(node, i);
+            owner_lids[gid] = i;
+            row_sizes[gid] = (shear_rows.segment(node) ? 0 : num_local_blocks);
+        }
+    }
+
+    GreensValsSparseMatrix off_node = GreensValsSparseMatrix(row_sizes);
+
+#ifdef MPI_C_FOUND
+    int                     root_node, n;
+    std::vector<int>        local_counts, displs, global_ids;
+    std::vector<GREEN_VAL>  send_buf, recv_buf;
+    MPI_Datatype            data_type;
+
+    // Every process needs rows from other nodes if there is more than one node
+    if (shear_rows.nodeSize() < sim->getWorldSize()) {
+        if (sizeof(GREEN_VAL)==4) data_type = MPI_FLOAT;
+        else if (sizeof(GREEN_VAL)==8) data_type = MPI_DOUBLE;
+
+        for (node=0; node<sim->getWorldSize(); ++node) {
+            local_counts.push_back(sim->numNodeBlocks(node));
+            displs.push_back(global_ids.size());
+
+            for (i=0; i<sim->numNodeBlocks(node); ++i) global_ids.push_back(sim->getNodeBlock(node, i));
+        }
+
+        send_buf.resize(num_global_blocks);
+        recv_buf.resize(num_local_blocks);
+
+        // Scatter the pieces of each row like symmetrizeMatrix, but only keep those from other nodes
+        for (i=0; i<num_global_blocks; ++i) {
+            root_node = sim->getBlockNode(i);
+
+            if (root_node == sim->getNodeRank()) {
+                owner_rows = local_rows+(size_t)sim->getLocalInd(i)*num_global_blocks;
+
+                for (n=0; n<num_global_blocks; ++n) send_buf[n] = owner_rows[global_ids[n]];
+            }
+
+            MPI_Scatterv(&send_buf[0], &local_counts[0], &displs[0], data_type,
+                         &recv_buf[0], num_local_blocks, data_type,
+                         root_node, MPI_COMM_WORLD);
+
+            if (row_sizes[i]) {
+                for (n=0; n<num_local_blocks; ++n) off_node[i][n] = recv_buf[n];
+            }
+        }
+    }
+
+#endif
+
+    // Set the simulation Greens values to the symmetrized local ones
+    for (lid=0; lid<num_local_blocks; ++lid) {
+        gid = sim->getGlobalBID(lid);
+        r_area = sim->getBlock(gid).area();
+
+        for (c=0; c<num_global_blocks; ++c) {
+            //// Schultz, excluding zero slip rate elements from sim by setting Greens to zero
+            if (sim->getBlock(gid).slip_rate()==0  ||  sim->getBlock(c).slip_rate()==0) {
+                sim->setGreens(gid, c, 0, 0);
+                continue;
+            }
+
+            c_area = sim->getBlock(c).area();
+            assertThrow(r_area > 0 && c_area > 0, "Blocks cannot have negative area.");
+
+            owner_rows = (GREEN_VAL *)shear_rows.segment(sim->getBlockNode(c));
+            rc = local_rows[(size_t)lid*num_global_blocks+c];
+            cr = (owner_rows ? owner_rows[(size_t)owner_lids[c]*num_global_blocks+gid] : off_node[c][lid]);
+
+            sim->setGreens(gid, c, symmetricShear(gid, c, rc, cr, r_area, c_area), snorm[gid][c]);
+        }
+    }
+
+    // Keep the rows until the other processes on this node are done reading them
+    shear_rows.sync();
+}
+
+
 void GreensFuncCalcBarnesHut::CalculateGreens(Simulation *sim) {
     BlockList::iterator     bit;
     quakelib::Octree<3>     *tree;
@@ -335,7 +591,7 @@ void GreensFuncCalcBarnesHut::bhInnerCalc(Simulation *sim, quakelib::Octree<3> *
     BlockID                             start_id, end_id;
     std::set<std::pair<BlockID, BlockID> >::const_iterator  sbit;
     unsigned int                        i;
-    quakelib::Vec<3>                    mean_center, mean_normal, rake_vec, up_vec, v0, v1, v2, v3;
+    quakelib::Vec<3>                    mean_center, mean_normal, rake_vec, up_vec, v0, v1, v3;
     double                              mean_dip, mean_rake, mean_area, side_length;
     double                              mean_lambda, mean_mu, mean_unit_slip;
     Block                               repr_block;
@@ -362,7 +618,8 @@ void GreensFuncCalcBarnesHut::bhInnerCalc(Simulation *sim, quakelib::Octree<3> *
         // Make a list of target blocks
         target_blocks.clear();
 
-        for (i=start_id; i!=end_id; ++i) target_blocks.push_back(i);
+        // The run bounds are inclusive
+        for (i=start_id; i<=end_id; ++i) target_blocks.push_back(i);
 
         // Reset mean values/vectors
         mean_center = rake_vec = mean_normal = quakelib::Vec<3>();
@@ -396,14 +653,14 @@ void GreensFuncCalcBarnesHut::bhInnerCalc(Simulation *sim, quakelib::Octree<3> *
 
         v0 = mean_center + rake_vec*(side_length/2) + up_vec*(side_length/2);
         v1 = mean_center + rake_vec*(side_length/2) - up_vec*(side_length/2);
-        v2 = mean_center - rake_vec*(side_length/2) - up_vec*(side_length/2);
         v3 = mean_center - rake_vec*(side_length/2) + up_vec*(side_length/2);
 
         repr_block.set_rake(mean_rake);
+        // Elements store three vertices, the fourth corner is implied by the quad
         repr_block.set_vert(0, v0);
         repr_block.set_vert(1, v1);
-        repr_block.set_vert(2, v2);
-        repr_block.set_vert(3, v3);
+        repr_block.set_vert(2, v3);
+        repr_block.set_is_quad(true);
         repr_block.set_lame_lambda(mean_lambda);
         repr_block.set_lame_mu(mean_mu);
         repr_block.set_slip_rate(mean_unit_slip);
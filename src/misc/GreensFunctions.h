@@ -114,6 +114,9 @@ class GreensFuncCalc {
 
         void symmetrizeMatrix(Simulation *sim,
                               GreensValsSparseMatrix &ssh);
+        void symmetrizeShared(Simulation *sim,
+                              NodeSharedArray &shear_rows,
+                              GreensValsSparseMatrix &snorm);
 };
 
 class GreensFuncFileParse : public GreensFuncCalc {
@@ -132,8 +135,42 @@ class GreensFuncCalcStandard : public GreensFuncCalc {
         void CalculateGreens(Simulation *sim);
         void InnerCalcStandard(Simulation *sim,
                                const BlockID &bnum,
-                               GreensValsSparseMatrix &ssh,
-                               GreensValsSparseMatrix &snorm);
+                               GREEN_VAL *shear_row,
+                               GREEN_VAL *normal_row);
+};
+
+/*!
+ Computes individual Greens values on demand, for building H-matrices. The values
+ match what the standard method stores: shear values are symmetrized by area,
+ elements without slip rate don't interact, and the kill distance, off diagonal
+ multiplier and limits are applied. Rows are local block indices.
+ */
+class GreensHMatrixEntries : public quakelib::HMatrixEntryGenerator {
+    private:
+        Simulation      *_sim;
+        bool            _shear;
+
+    public:
+        GreensHMatrixEntries(Simulation *sim, const bool &shear) : _sim(sim), _shear(shear) {};
+
+        double entry(const unsigned int &row, const unsigned int &col);
+
+        static void rawValues(Simulation *sim,
+                              const BlockID &r,
+                              const BlockID &c,
+                              const bool &need_shear,
+                              double &shear,
+                              double &normal);
+};
+
+/*!
+ Standard Okada Greens functions stored as H-matrices. Only the entries needed
+ by the cluster tree blocks and the adaptive cross approximation are calculated,
+ so the full N^2 matrices are never formed.
+ */
+class GreensFuncCalcHMatrix : public GreensFuncCalc {
+    public:
+        void CalculateGreens(Simulation *sim);
 };
 
 #endif
@@ -0,0 +1,124 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <algorithm>
+#include <vector>
+
+#ifndef _INDEXED_HEAP_H_
+#define _INDEXED_HEAP_H_
+
+/*
+ Binary min-heap of the items 0..n-1 ordered by (key, id). The heap position of
+ each item is tracked so the key of any item can be changed in O(log n).
+ */
+class IndexedMinHeap {
+    private:
+        std::vector<int>        heap;       // items in heap order
+        std::vector<int>        pos;        // heap position of each item
+        std::vector<double>     keys;
+        std::vector<int>        ids;        // ids used to break ties between equal keys
+
+        bool before(const int &a, const int &b) const {
+            return (keys[a] < keys[b] || (keys[a] == keys[b] && ids[a] < ids[b]));
+        };
+
+        void swapNodes(const int &i, const int &j) {
+            std::swap(heap[i], heap[j]);
+            pos[heap[i]] = i;
+            pos[heap[j]] = j;
+        };
+
+        void siftUp(int i) {
+            while (i > 0 && before(heap[i], heap[(i-1)/2])) {
+                swapNodes(i, (i-1)/2);
+                i = (i-1)/2;
+            }
+        };
+
+        void siftDown(int i) {
+            int     c, n = heap.size();
+
+            while ((c = 2*i+1) < n) {
+                if (c+1 < n && before(heap[c+1], heap[c])) c++;
+
+                if (!before(heap[c], heap[i])) break;
+
+                swapNodes(i, c);
+                i = c;
+            }
+        };
+
+    public:
+        //! Build the heap from the key and id of every item in O(n)
+        void init(const std::vector<double> &new_keys, const std::vector<int> &new_ids) {
+            int     i, n = new_keys.size();
+
+            keys = new_keys;
+            ids = new_ids;
+            heap.resize(n);
+            pos.resize(n);
+
+            for (i=0; i<n; ++i) heap[i] = pos[i] = i;
+
+            for (i=n/2-1; i>=0; --i) siftDown(i);
+        };
+
+        void update(const int &item, const double &new_key) {
+            double  old_key = keys[item];
+
+            keys[item] = new_key;
+
+            if (new_key < old_key) siftUp(pos[item]);
+            else siftDown(pos[item]);
+        };
+
+        int size(void) const {
+            return heap.size();
+        };
+        int top(void) const {
+            return heap[0];
+        };
+        double key(const int &item) const {
+            return keys[item];
+        };
+
+        //! Append the items with key at most max_key, in no particular order
+        void itemsUpTo(const double &max_key, std::vector<int> &items) const {
+            std::vector<int>    stack;
+            int                 i;
+
+            if (!heap.empty()) stack.push_back(0);
+
+            while (!stack.empty()) {
+                i = stack.back();
+                stack.pop_back();
+
+                if (keys[heap[i]] > max_key) continue;
+
+                items.push_back(heap[i]);
+
+                if (2*i+1 < (int)heap.size()) stack.push_back(2*i+1);
+
+                if (2*i+2 < (int)heap.size()) stack.push_back(2*i+2);
+            }
+        };
+};
+
+#endif
@@ -0,0 +1,161 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "KDTree.h"
+
+#include <algorithm>
+
+#ifdef VQ_HAVE_MATH_H
+#include <math.h>
+#endif
+
+// Maximum number of points in a leaf of the tree
+#define KD_LEAF_SIZE        8
+
+// Node distances are shrunk by this fraction so rounding can never make a node
+// look farther away than one of its points
+#define KD_DIST_MARGIN      1e-12
+
+// Orders point indices by one coordinate, then by index so the tree does not depend on the sort
+struct KDCoordLess {
+    const std::vector<quakelib::Vec<3> >    &points;
+    unsigned int                            axis;
+
+    KDCoordLess(const std::vector<quakelib::Vec<3> > &p, const unsigned int &a) : points(p), axis(a) {};
+    bool operator()(const int &a, const int &b) const {
+        if (points[a][axis] != points[b][axis]) return points[a][axis] < points[b][axis];
+
+        return a < b;
+    };
+};
+
+void KDTree::build(const std::vector<quakelib::Vec<3> > &new_points, const std::vector<unsigned int> &new_ids) {
+    int     i;
+
+    points = new_points;
+    ids = new_ids;
+    order.resize(points.size());
+    nodes.clear();
+
+    for (i=0; i<(int)points.size(); ++i) order[i] = i;
+
+    if (!points.empty()) buildNode(0, points.size());
+}
+
+/*!
+ Build the node holding points [first, last) of order, splitting at the median
+ of the widest dimension of the node bound. Returns the index of the node.
+ */
+int KDTree::buildNode(const int &first, const int &last) {
+    quakelib::RectBound<3>  bound;
+    quakelib::Vec<3>        extent;
+    unsigned int            axis, i;
+    int                     n, mid, left, right;
+
+    for (n=first; n<last; ++n) bound.extend_bound(points[order[n]]);
+
+    n = nodes.size();
+    nodes.push_back(Node());
+    nodes[n].bound = bound;
+    nodes[n].first = first;
+    nodes[n].last = last;
+    nodes[n].left = nodes[n].right = -1;
+
+    if (last-first <= KD_LEAF_SIZE) return n;
+
+    extent = bound.max_bound() - bound.min_bound();
+    axis = 0;
+
+    for (i=1; i<3; ++i) {
+        if (extent[i] > extent[axis]) axis = i;
+    }
+
+    mid = (first+last)/2;
+    std::nth_element(order.begin()+first, order.begin()+mid, order.begin()+last, KDCoordLess(points, axis));
+
+    // Children are built after the push_back above, so refer to the node by index
+    left = buildNode(first, mid);
+    right = buildNode(mid, last);
+    nodes[n].left = left;
+    nodes[n].right = right;
+
+    return n;
+}
+
+KDTreeNearest::KDTreeNearest(const KDTree &search_tree, const quakelib::Vec<3> &search_pt) : tree(search_tree), pt(search_pt) {
+    if (!tree.nodes.empty()) pushNode(0);
+}
+
+//! Queue a node at the smallest possible distance from the search point to any of its points.
+void KDTreeNearest::pushNode(const int &node) {
+    quakelib::Vec<3>    min_bound, max_bound;
+    Entry               e;
+    double              gap, sum;
+    unsigned int        i;
+
+    min_bound = tree.nodes[node].bound.min_bound();
+    max_bound = tree.nodes[node].bound.max_bound();
+    sum = 0;
+
+    for (i=0; i<3; ++i) {
+        gap = std::max(0.0, std::max(min_bound[i]-pt[i], pt[i]-max_bound[i]));
+        sum += gap*gap;
+    }
+
+    e.dist = sqrt(sum)*(1-KD_DIST_MARGIN);
+    e.is_point = false;
+    e.id = 0;
+    e.ind = node;
+    queue.push(e);
+}
+
+bool KDTreeNearest::next(unsigned int &id, double &dist) {
+    Entry   e, p;
+    int     n;
+
+    while (!queue.empty()) {
+        e = queue.top();
+        queue.pop();
+
+        if (e.is_point) {
+            id = e.id;
+            dist = e.dist;
+            return true;
+        }
+
+        const KDTree::Node &node = tree.nodes[e.ind];
+
+        if (node.left < 0) {
+            // Queue the points of the leaf at their exact distances
+            for (n=node.first; n<node.last; ++n) {
+                p.ind = tree.order[n];
+                p.id = tree.ids[p.ind];
+                p.dist = tree.points[p.ind].dist(pt);
+                p.is_point = true;
+                queue.push(p);
+            }
+        } else {
+            pushNode(node.left);
+            pushNode(node.right);
+        }
+    }
+
+    return false;
+}
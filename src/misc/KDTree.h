@@ -0,0 +1,97 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "QuakeLibUtil.h"
+
+#include <queue>
+#include <vector>
+
+#ifndef _KD_TREE_H_
+#define _KD_TREE_H_
+
+/*
+ Static k-d tree over a set of 3D points, each with an ID. The tree is built
+ once and then searched with KDTreeNearest to visit the points in order of
+ increasing distance from a query point.
+ */
+class KDTree {
+    private:
+        struct Node {
+            quakelib::RectBound<3>  bound;
+            int                     first, last;    // range of points in order
+            int                     left, right;    // child nodes, -1 for leaves
+        };
+
+        std::vector<quakelib::Vec<3> >  points;
+        std::vector<unsigned int>       ids;
+        std::vector<int>                order;
+        std::vector<Node>               nodes;
+
+        int buildNode(const int &first, const int &last);
+
+        friend class KDTreeNearest;
+
+    public:
+        void build(const std::vector<quakelib::Vec<3> > &new_points, const std::vector<unsigned int> &new_ids);
+
+        int size(void) const {
+            return points.size();
+        };
+};
+
+/*
+ Incremental nearest neighbor search of a KDTree. Each call to next() returns
+ the closest point not yet returned, so a search for the points near a
+ location can stop as soon as it has enough of them. Points at equal distance
+ are returned in order of ID.
+ */
+class KDTreeNearest {
+    private:
+        struct Entry {
+            double          dist;
+            bool            is_point;
+            unsigned int    id;
+            int             ind;        // node index, or point index in the tree
+        };
+        struct EntryLater {
+            bool operator()(const Entry &a, const Entry &b) const {
+                if (a.dist != b.dist) return a.dist > b.dist;
+
+                // Expand nodes before returning points at the same distance so ties are ordered by ID
+                if (a.is_point != b.is_point) return a.is_point;
+
+                return a.id > b.id;
+            };
+        };
+
+        const KDTree                                                &tree;
+        quakelib::Vec<3>                                            pt;
+        std::priority_queue<Entry, std::vector<Entry>, EntryLater>  queue;
+
+        void pushNode(const int &node);
+
+    public:
+        KDTreeNearest(const KDTree &search_tree, const quakelib::Vec<3> &search_pt);
+
+        // Get the next closest point, returns false once all points have been returned
+        bool next(unsigned int &id, double &dist);
+};
+
+#endif
@@ -0,0 +1,156 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "KrylovSolver.h"
+
+#include <vector>
+
+#ifdef VQ_HAVE_MATH_H
+#include <math.h>
+#endif
+
+static double dot(const int &n, const double *u, const double *v) {
+    double      sum;
+    int         i;
+
+    sum = 0;
+
+    for (i=0; i<n; ++i) sum += u[i]*v[i];
+
+    return sum;
+}
+
+/*!
+ Restarted GMRES(restart) with modified Gram-Schmidt orthogonalization and
+ Givens rotations. The system is preconditioned on the right with the
+ Jacobi preconditioner M = diag(A), so the residual being minimized is that
+ of the original system. The vector operations are done serially so the
+ result only depends on the operator, not the number of threads.
+ */
+int solveGMRES(KrylovOperator &op, const int &n, double *x, const double *b, const double *diag,
+               const int &restart, const int &max_iters, const double &tol, double &rel_res) {
+    std::vector<double>     V, H, cs, sn, g, y, w, z;
+    double                  b_norm, beta, h, t, r;
+    int                     i, j, k, iters;
+
+    rel_res = 0;
+    b_norm = sqrt(dot(n, b, b));
+
+    if (n == 0 || b_norm == 0) {
+        for (i=0; i<n; ++i) x[i] = 0;
+
+        return 0;
+    }
+
+    // Nothing can be solved with non-finite values, this is reported with a non-finite rel_res
+    if (!isfinite(b_norm)) {
+        rel_res = b_norm;
+
+        return 0;
+    }
+
+    V.resize((restart+1)*n);
+    H.resize((restart+1)*restart);
+    cs.resize(restart);
+    sn.resize(restart);
+    g.resize(restart+1);
+    y.resize(restart);
+    w.resize(n);
+    z.resize(n);
+    iters = 0;
+
+    while (true) {
+        // Residual of the current solution
+        op.apply(x, &w[0]);
+
+        for (i=0; i<n; ++i) w[i] = b[i] - w[i];
+
+        beta = sqrt(dot(n, &w[0], &w[0]));
+        rel_res = beta/b_norm;
+
+        if (!isfinite(beta) || rel_res <= tol || iters >= max_iters) break;
+
+        for (i=0; i<n; ++i) V[i] = w[i]/beta;
+
+        for (i=0; i<=restart; ++i) g[i] = 0;
+
+        g[0] = beta;
+
+        // Build the Krylov basis, reducing the Hessenberg matrix to triangular form as it grows
+        for (k=0; k<restart && iters<max_iters; ++k) {
+            for (i=0; i<n; ++i) z[i] = V[k*n+i]/diag[i];
+
+            op.apply(&z[0], &w[0]);
+
+            for (j=0; j<=k; ++j) {
+                h = dot(n, &w[0], &V[j*n]);
+                H[j*restart+k] = h;
+
+                for (i=0; i<n; ++i) w[i] -= h*V[j*n+i];
+            }
+
+            h = sqrt(dot(n, &w[0], &w[0]));
+            H[(k+1)*restart+k] = h;
+
+            if (h != 0) {
+                for (i=0; i<n; ++i) V[(k+1)*n+i] = w[i]/h;
+            }
+
+            for (j=0; j<k; ++j) {
+                t = cs[j]*H[j*restart+k] + sn[j]*H[(j+1)*restart+k];
+                H[(j+1)*restart+k] = -sn[j]*H[j*restart+k] + cs[j]*H[(j+1)*restart+k];
+                H[j*restart+k] = t;
+            }
+
+            r = sqrt(H[k*restart+k]*H[k*restart+k] + h*h);
+            cs[k] = H[k*restart+k]/r;
+            sn[k] = h/r;
+            H[k*restart+k] = r;
+            H[(k+1)*restart+k] = 0;
+            g[k+1] = -sn[k]*g[k];
+            g[k] = cs[k]*g[k];
+            iters++;
+
+            if (fabs(g[k+1])/b_norm <= tol || h == 0 || !isfinite(h)) {
+                k++;
+                break;
+            }
+        }
+
+        // Solve the triangular system and update the solution with the preconditioned basis
+        for (j=k-1; j>=0; --j) {
+            t = g[j];
+
+            for (i=j+1; i<k; ++i) t -= H[j*restart+i]*y[i];
+
+            y[j] = t/H[j*restart+j];
+        }
+
+        for (i=0; i<n; ++i) {
+            t = 0;
+
+            for (j=0; j<k; ++j) t += y[j]*V[j*n+i];
+
+            x[i] += t/diag[i];
+        }
+    }
+
+    return iters;
+}
@@ -0,0 +1,47 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "config.h"
+
+#ifndef _KRYLOV_SOLVER_H_
+#define _KRYLOV_SOLVER_H_
+
+/*
+ Iterative solver for large linear systems A x = b where A is only available
+ as an operator. Every process calling the solver must pass identical
+ vectors, so the iterations are repeated redundantly on each process and only
+ the operator needs to communicate.
+ */
+
+// Linear operator y = A x applied to vectors of the full system length
+class KrylovOperator {
+    public:
+        virtual ~KrylovOperator(void) {};
+        virtual void apply(const double *x, double *y) = 0;
+};
+
+// Solve with restarted GMRES preconditioned on the right by the diagonal of A.
+// x holds the initial guess on entry. Returns the number of iterations and sets
+// rel_res to the final residual norm relative to the norm of b. rel_res is not finite
+// if b or the operator produced non-finite values, GMRES stops as soon as it sees them.
+int solveGMRES(KrylovOperator &op, const int &n, double *x, const double *b, const double *diag,
+               const int &restart, const int &max_iters, const double &tol, double &rel_res);
+
+#endif
@@ -0,0 +1,394 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "Partitioner.h"
+#include "KDTree.h"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef VQ_HAVE_MATH_H
+#include <math.h>
+#endif
+
+#ifdef MPI_C_FOUND
+#include "mpi.h"
+#endif
+
+// Number of nearest neighbors of each element in the coupling graph
+#define PARTITION_NEIGHBORS         12
+
+// Largest allowed ratio of a part size to the average part size when refining
+#define PARTITION_IMBALANCE         1.03
+
+// Maximum number of refinement passes of the graph partitioner
+#define PARTITION_REFINE_PASSES     20
+
+// Bits per coordinate of the Hilbert curve keys
+#define HILBERT_BITS                21
+
+// Orders element indices by one coordinate of their centers, then by index so partitions do not depend on the sort
+struct PartitionCoordLess {
+    const std::vector<quakelib::Vec<3> >    &centers;
+    unsigned int                            axis;
+
+    PartitionCoordLess(const std::vector<quakelib::Vec<3> > &c, const unsigned int &a) : centers(c), axis(a) {};
+    bool operator()(const int &a, const int &b) const {
+        if (centers[a][axis] != centers[b][axis]) return centers[a][axis] < centers[b][axis];
+
+        return a < b;
+    };
+};
+
+// The share of n elements each process works on, the elements [first, last) on rank
+static void rankShare(const int &n, const int &rank, const int &num_ranks, int &first, int &last) {
+    first = (int)((long long)n*rank/num_ranks);
+    last = (int)((long long)n*(rank+1)/num_ranks);
+}
+
+// Gather the values of all processes in rank order
+static void allGatherInts(const std::vector<int> &local, std::vector<int> &all, const int &num_ranks) {
+#ifdef MPI_C_FOUND
+    std::vector<int>    counts(num_ranks), disps(num_ranks);
+    int                 i, total, local_count = local.size();
+
+    MPI_Allgather(&local_count, 1, MPI_INT, counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+
+    for (total=0,i=0; i<num_ranks; ++i) {
+        disps[i] = total;
+        total += counts[i];
+    }
+
+    all.resize(total);
+    MPI_Allgatherv(const_cast<int *>(local.data()), local_count, MPI_INT,
+                   all.data(), counts.data(), disps.data(), MPI_INT, MPI_COMM_WORLD);
+#else
+    all = local;
+#endif
+}
+
+/*!
+ Builds the graph connecting each element to its PARTITION_NEIGHBORS nearest
+ neighbors. Greens function values decay with the cube of the distance and grow
+ with the area of the source element, so the coupling weight of an edge is
+ estimated as the mean area of its elements over the cubed distance between
+ them. Distances are limited to half the element size so coincident elements
+ get a finite weight.
+ */
+void buildCouplingGraph(const PartitionInput &input, const int &rank, const int &num_ranks, CouplingGraph &graph) {
+    KDTree                                  tree;
+    std::vector<unsigned int>               ids;
+    std::vector<int>                        local_nbrs, nbrs;
+    std::vector<std::pair<int, int> >       edges;
+    unsigned int                            id;
+    double                                  dist, min_dist;
+    int                                     n, k, i, j, e, first, last, found;
+
+    n = input.centers.size();
+    k = std::min(PARTITION_NEIGHBORS, n-1);
+
+    graph.xadj.assign(n+1, 0);
+    graph.adj.clear();
+    graph.wgt.clear();
+
+    if (k <= 0) return;
+
+    ids.resize(n);
+
+    for (i=0; i<n; ++i) ids[i] = i;
+
+    tree.build(input.centers, ids);
+
+    // Find the neighbors of this process' share of the elements
+    rankShare(n, rank, num_ranks, first, last);
+    local_nbrs.reserve((last-first)*k);
+
+    for (i=first; i<last; ++i) {
+        KDTreeNearest   search(tree, input.centers[i]);
+
+        for (found=0; found<k && search.next(id, dist);) {
+            if ((int)id == i) continue;
+
+            local_nbrs.push_back(id);
+            found++;
+        }
+    }
+
+    allGatherInts(local_nbrs, nbrs, num_ranks);
+
+    // Make the graph symmetric and remove duplicate edges
+    edges.reserve(2*n*k);
+
+    for (i=0; i<n; ++i) {
+        for (j=0; j<k; ++j) {
+            edges.push_back(std::make_pair(i, nbrs[i*k+j]));
+            edges.push_back(std::make_pair(nbrs[i*k+j], i));
+        }
+    }
+
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    graph.adj.resize(edges.size());
+    graph.wgt.resize(edges.size());
+
+    for (e=0; e<(int)edges.size(); ++e) {
+        i = edges[e].first;
+        j = edges[e].second;
+        graph.xadj[i+1]++;
+        graph.adj[e] = j;
+        dist = input.centers[i].dist(input.centers[j]);
+        min_dist = 0.5*sqrt(std::max(input.areas[i], input.areas[j]));
+        dist = std::max(dist, min_dist);
+        graph.wgt[e] = 0.5*(input.areas[i]+input.areas[j])/(dist*dist*dist);
+    }
+
+    for (i=0; i<n; ++i) graph.xadj[i+1] += graph.xadj[i];
+}
+
+void evaluatePartition(const CouplingGraph &graph, const std::vector<int> &parts, const int &num_parts,
+                       double &imbalance, double &cut_fraction) {
+    std::vector<int>    sizes(num_parts, 0);
+    double              total_wgt, cut_wgt;
+    int                 i, e, n;
+
+    n = parts.size();
+
+    for (i=0; i<n; ++i) sizes[parts[i]]++;
+
+    imbalance = (n > 0 ? double(*std::max_element(sizes.begin(), sizes.end()))*num_parts/n : 1.0);
+
+    total_wgt = cut_wgt = 0;
+
+    for (i=0; i<(int)graph.xadj.size()-1; ++i) {
+        for (e=graph.xadj[i]; e<graph.xadj[i+1]; ++e) {
+            total_wgt += graph.wgt[e];
+
+            if (parts[i] != parts[graph.adj[e]]) cut_wgt += graph.wgt[e];
+        }
+    }
+
+    cut_fraction = (total_wgt > 0 ? cut_wgt/total_wgt : 0.0);
+}
+
+void RCBPartitioner::partition(const PartitionInput &input, const int &num_parts, std::vector<int> &parts) {
+    std::vector<int>    order;
+    int                 i, n;
+
+    n = input.centers.size();
+    parts.assign(n, 0);
+    order.resize(n);
+
+    for (i=0; i<n; ++i) order[i] = i;
+
+    bisect(input, order, 0, n, 0, num_parts, parts);
+}
+
+void RCBPartitioner::bisect(const PartitionInput &input, std::vector<int> &order, const int &first, const int &last,
+                            const int &first_part, const int &num_parts, std::vector<int> &parts) {
+    quakelib::RectBound<3>  bound;
+    quakelib::Vec<3>        extent;
+    unsigned int            axis, d;
+    int                     i, mid, left_parts;
+
+    if (num_parts == 1) {
+        for (i=first; i<last; ++i) parts[order[i]] = first_part;
+
+        return;
+    }
+
+    // Split across the longest extent of the elements
+    for (i=first; i<last; ++i) bound.extend_bound(input.centers[order[i]]);
+
+    axis = 0;
+
+    if (last > first) {
+        extent = bound.max_bound() - bound.min_bound();
+
+        for (d=1; d<3; ++d) if (extent[d] > extent[axis]) axis = d;
+    }
+
+    left_parts = num_parts/2;
+    mid = first + (int)((long long)(last-first)*left_parts/num_parts);
+    std::nth_element(order.begin()+first, order.begin()+mid, order.begin()+last, PartitionCoordLess(input.centers, axis));
+
+    bisect(input, order, first, mid, first_part, left_parts, parts);
+    bisect(input, order, mid, last, first_part+left_parts, num_parts-left_parts, parts);
+}
+
+/*!
+ Index of a point along the Hilbert curve, with X the coordinates in [0, 2^HILBERT_BITS).
+ Uses Skilling's transpose form of the curve (AIP Conf. Proc. 707, 381 (2004)).
+ */
+static unsigned long long hilbertKey(unsigned int X[3]) {
+    unsigned int        M, P, Q, t;
+    unsigned long long  key;
+    int                 i, b;
+
+    M = 1u << (HILBERT_BITS-1);
+
+    // Inverse undo excess work
+    for (Q=M; Q>1; Q>>=1) {
+        P = Q-1;
+
+        for (i=0; i<3; ++i) {
+            if (X[i] & Q) {
+                X[0] ^= P;
+            } else {
+                t = (X[0] ^ X[i]) & P;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+
+    // Gray encode
+    for (i=1; i<3; ++i) X[i] ^= X[i-1];
+
+    for (t=0,Q=M; Q>1; Q>>=1) if (X[2] & Q) t ^= Q-1;
+
+    for (i=0; i<3; ++i) X[i] ^= t;
+
+    // Interleave the transposed bits into a single key
+    for (key=0,b=HILBERT_BITS-1; b>=0; --b) {
+        for (i=0; i<3; ++i) key = (key << 1) | ((X[i] >> b) & 1);
+    }
+
+    return key;
+}
+
+void SFCPartitioner::partition(const PartitionInput &input, const int &num_parts, std::vector<int> &parts) {
+    std::vector<std::pair<unsigned long long, int> >    keys;
+    quakelib::RectBound<3>  bound;
+    quakelib::Vec<3>        extent;
+    unsigned int            X[3];
+    double                  scale;
+    int                     i, d, n;
+
+    n = input.centers.size();
+    parts.assign(n, 0);
+
+    if (n == 0) return;
+
+    for (i=0; i<n; ++i) bound.extend_bound(input.centers[i]);
+
+    // Scale all axes equally so the curve follows the shape of the model
+    extent = bound.max_bound() - bound.min_bound();
+    scale = std::max(extent[0], std::max(extent[1], extent[2]));
+    scale = (scale > 0 ? ((1u << HILBERT_BITS)-1)/scale : 0);
+
+    keys.resize(n);
+
+    for (i=0; i<n; ++i) {
+        for (d=0; d<3; ++d) X[d] = (unsigned int)((input.centers[i][d]-bound.min_bound()[d])*scale);
+
+        keys[i] = std::make_pair(hilbertKey(X), i);
+    }
+
+    std::sort(keys.begin(), keys.end());
+
+    for (i=0; i<n; ++i) parts[keys[i].second] = (int)((long long)i*num_parts/n);
+}
+
+/*!
+ The part element v is most strongly coupled with and how much more strongly
+ than with its own part. Ties go to the lower part.
+ */
+static int strongestPart(const CouplingGraph &graph, const std::vector<int> &parts, const int &v, double &gain) {
+    std::vector<std::pair<int, double> >    conn;
+    double                                  own;
+    int                                     e, c, best;
+
+    for (e=graph.xadj[v]; e<graph.xadj[v+1]; ++e) {
+        for (c=0; c<(int)conn.size() && conn[c].first!=parts[graph.adj[e]]; ++c);
+
+        if (c == (int)conn.size()) conn.push_back(std::make_pair(parts[graph.adj[e]], 0.0));
+
+        conn[c].second += graph.wgt[e];
+    }
+
+    own = 0;
+    best = parts[v];
+    gain = 0;
+
+    for (c=0; c<(int)conn.size(); ++c) if (conn[c].first == parts[v]) own = conn[c].second;
+
+    for (c=0; c<(int)conn.size(); ++c) {
+        if (conn[c].first == parts[v]) continue;
+
+        if (conn[c].second-own > gain || (conn[c].second-own == gain && gain > 0 && conn[c].first < best)) {
+            gain = conn[c].second-own;
+            best = conn[c].first;
+        }
+    }
+
+    return best;
+}
+
+void GraphPartitioner::partition(const PartitionInput &input, const int &num_parts, std::vector<int> &parts) {
+    CouplingGraph       graph;
+    RCBPartitioner      rcb;
+    std::vector<int>    sizes, local_moves, moves;
+    double              gain, avg_size;
+    int                 n, i, v, to, pass, num_moved, max_size, min_size, first, last;
+
+    n = input.centers.size();
+
+    buildCouplingGraph(input, rank, num_ranks, graph);
+    rcb.partition(input, num_parts, parts);
+
+    sizes.assign(num_parts, 0);
+
+    for (i=0; i<n; ++i) sizes[parts[i]]++;
+
+    avg_size = double(n)/num_parts;
+    max_size = (int)ceil(avg_size*PARTITION_IMBALANCE);
+    min_size = (int)floor(avg_size/PARTITION_IMBALANCE);
+    rankShare(n, rank, num_ranks, first, last);
+
+    for (pass=0; pass<PARTITION_REFINE_PASSES; ++pass) {
+        // Propose moving the elements of this process' share that are more strongly coupled to another part
+        local_moves.clear();
+
+        for (v=first; v<last; ++v) {
+            strongestPart(graph, parts, v, gain);
+
+            if (gain > 0) local_moves.push_back(v);
+        }
+
+        allGatherInts(local_moves, moves, num_ranks);
+
+        // Apply the proposals in element order, checking them again against the
+        // moves made so far so all processes reach the same partition
+        for (num_moved=0,i=0; i<(int)moves.size(); ++i) {
+            v = moves[i];
+            to = strongestPart(graph, parts, v, gain);
+
+            if (gain > 0 && sizes[to] < max_size && sizes[parts[v]] > min_size) {
+                sizes[parts[v]]--;
+                sizes[to]++;
+                parts[v] = to;
+                num_moved++;
+            }
+        }
+
+        if (num_moved == 0) break;
+    }
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2012-2014 Eric M. Heien, Michael K. Sachs, John B. Rundle
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "config.h"
+#include "QuakeLibUtil.h"
+
+#include <vector>
+
+#ifndef _PARTITIONER_H_
+#define _PARTITIONER_H_
+
+/*
+ Geometry of the model elements to be partitioned. Element i has center
+ centers[i] and area areas[i].
+ */
+struct PartitionInput {
+    std::vector<quakelib::Vec<3> >  centers;
+    std::vector<double>             areas;
+};
+
+/*
+ Graph of the strongest interactions between elements, stored in compressed row
+ form. The neighbors of element i are adj[xadj[i]] up to but not including
+ adj[xadj[i+1]], with coupling weights wgt[...]. Edges are symmetric.
+ */
+struct CouplingGraph {
+    std::vector<int>            xadj;
+    std::vector<int>            adj;
+    std::vector<double>         wgt;
+};
+
+/*
+ Splits the elements into parts of nearly equal size. parts[i] is set to the
+ part of element i, in [0, num_parts). Partitions must be deterministic so
+ every process computes the same one from the same input.
+ */
+class Partitioner {
+    public:
+        virtual ~Partitioner(void) {};
+
+        virtual void partition(const PartitionInput &input, const int &num_parts, std::vector<int> &parts) = 0;
+};
+
+/*
+ Recursive coordinate bisection. Each set of elements is split across its
+ longest extent into two halves sized in proportion to the parts of each half.
+ */
+class RCBPartitioner : public Partitioner {
+    private:
+        void bisect(const PartitionInput &input, std::vector<int> &order, const int &first, const int &last,
+                    const int &first_part, const int &num_parts, std::vector<int> &parts);
+
+    public:
+        void partition(const PartitionInput &input, const int &num_parts, std::vector<int> &parts);
+};
+
+/*
+ Space filling curve partitioning. The elements are ordered along a 3D Hilbert
+ curve through their centers and the curve is cut into equal pieces.
+ */
+class SFCPartitioner : public Partitioner {
+    public:
+        void partition(const PartitionInput &input, const int &num_parts, std::vector<int> &parts);
+};
+
+/*
+ Coupling graph partitioning. Starting from recursive coordinate bisection,
+ elements are moved to the part they are most strongly coupled with as long as
+ this lowers the coupling cut and keeps the parts balanced. Each process
+ evaluates the moves of its share of the elements, and the proposed moves are
+ exchanged and applied in the same order on all processes.
+ */
+class GraphPartitioner : public Partitioner {
+    private:
+        int             rank, num_ranks;
+
+    public:
+        GraphPartitioner(const int &node_rank, const int &world_size) : rank(node_rank), num_ranks(world_size) {};
+
+        void partition(const PartitionInput &input, const int &num_parts, std::vector<int> &parts);
+};
+
+// Build the coupling graph between each element and its nearest neighbors on
+// processes [0, num_ranks), each process finding the neighbors of a share of the elements
+void buildCouplingGraph(const PartitionInput &input, const int &rank, const int &num_ranks, CouplingGraph &graph);
+
+// Ratio of the largest part to the average part size and the fraction of the
+// coupling weight between elements in different parts
+void evaluatePartition(const CouplingGraph &graph, const std::vector<int> &parts, const int &num_parts,
+                       double &imbalance, double &cut_fraction);
+
+#endif
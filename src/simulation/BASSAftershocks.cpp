@@ -32,7 +32,6 @@ SimRequest BASSAftershocks::run(SimFramework *_sim) {
     Simulation                *sim = static_cast<Simulation *>(_sim);
     unsigned int                genNum = 0, start, stop, count = 0;
     EventAftershock           initial_shock;
-    AftershockVector::iterator  it;
     quakelib::Conversion        convert;
 
     // Only the root node generates and processes aftershocks
@@ -82,11 +81,9 @@ SimRequest BASSAftershocks::run(SimFramework *_sim) {
     // Remove the initial seed event (main shock)
     events_to_process.erase(events_to_process.begin());
 
-    // Finally we add the aftershocks to the simulation list. This is
-    // a set so we don't need to sort the aftershocks manually.
-    for (it=events_to_process.begin(); it!=events_to_process.end(); ++it) {
-        sim->addAftershock(*it);
-    }
+    // Finally we add the aftershocks to the simulation list, which
+    // sorts them into the pending aftershocks in one pass.
+    sim->addAftershocks(events_to_process);
 
     return SIM_STOP_OK;
 }
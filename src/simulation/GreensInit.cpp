@@ -36,7 +36,7 @@ void GreensInit::dryRun(SimFramework *_sim) {
     nblocks = sim->numGlobalBlocks();
 
     // Calculate how much memory we will use during the run
-    running_memory_per_node = 2.0*sizeof(GREEN_VAL)*nblocks*nblocks/num_nodes;
+    running_memory_per_node = 2.0*GreensMatrix::valSize(sim->getGreensStorage())*nblocks*nblocks/num_nodes;
     init_memory_per_node = running_memory_per_node*(2-(1.0/float(num_nodes)));
     running_memory = running_memory_per_node*num_nodes;
     init_memory = init_memory_per_node*num_nodes;
@@ -71,6 +71,10 @@ void GreensInit::dryRun(SimFramework *_sim) {
 
     sim->console() << "# Greens function memory during initialization: " << im_ss.str() << " (" << impn_ss.str() << " per CPU)" << std::endl;
     sim->console() << "# Greens function memory during simulation: " << rm_ss.str() << " (" << rmpn_ss.str() << " per CPU)" << std::endl;
+
+    if (sim->useHMatrix()) {
+        sim->console() << "# With H-matrices the memory is O(N log N) and depends on the ACA tolerance, the above is the dense upper bound." << std::endl;
+    }
 }
 
 /*!
@@ -80,6 +84,7 @@ void GreensInit::init(SimFramework *_sim) {
     Simulation            *sim = static_cast<Simulation *>(_sim);
     GreensFuncCalcBarnesHut bh_calc;
     GreensFuncCalcStandard  gstandard_calc;
+    GreensFuncCalcHMatrix   hmatrix_calc;
     GreensFuncFileParse     file_parse;
     std::string             space_vals[] = {"bytes", "kilobytes", "megabytes", "gigabytes", "terabytes", "petabytes"};
 
@@ -97,8 +102,14 @@ void GreensInit::init(SimFramework *_sim) {
             break;
 
         case GREENS_CALC_STANDARD:
-            sim->console() << "# Calculating Greens function with the standard Okada class" << std::flush;
-            gstandard_calc.CalculateGreens(sim);
+            if (sim->useHMatrix()) {
+                sim->console() << "# Calculating Greens function H-matrices with the standard Okada class" << std::flush;
+                hmatrix_calc.CalculateGreens(sim);
+            } else {
+                sim->console() << "# Calculating Greens function with the standard Okada class" << std::flush;
+                gstandard_calc.CalculateGreens(sim);
+            }
+
             break;
 
         default:
@@ -117,25 +128,40 @@ void GreensInit::init(SimFramework *_sim) {
     double abbr_shear_bytes = shear_bytes/pow(2,shear_ind*10);
     double abbr_normal_bytes = normal_bytes/pow(2,norm_ind*10);
 
+    if (sim->getGreensStorage() == GREENS_STORAGE_FLOAT) {
+        sim->console() << "# Greens matrices stored in single precision." << std::endl;
+    }
+
     sim->console() << "# Greens shear matrix takes " << abbr_shear_bytes << " " << space_vals[shear_ind] << std::endl;
     sim->console() << "# Greens normal matrix takes " << abbr_normal_bytes << " " << space_vals[norm_ind] << std::endl;
-    //
-    // yoder: print some greens max/min/mean stats:
-    // (and this information becoming less interesting with the introduction of (off)diagonal specific data).
-    double shear_min, shear_max, shear_mean, normal_min, normal_max, normal_mean;
-    getGreensStats(sim, shear_min, shear_max, shear_mean, normal_min, normal_max, normal_mean);
-    sim->console() << "# Greens Shear:\n max: " << shear_max << "\n min: " << shear_min << "\n mean: " << shear_mean << std::endl << std::endl;
-    sim->console() << "# Greens Normal:\n max: " << normal_max << "\n min: " << normal_min << "\n mean: " << normal_mean << std::endl << std::endl;
-    //
-    // yoder: and now, get Greens Stats for (off)diagonal elements separately.
-    double shear_diag_min, shear_diag_max, shear_diag_mean, normal_diag_min, normal_diag_max, normal_diag_mean;
-    double shear_offdiag_min, shear_offdiag_max, shear_offdiag_mean, normal_offdiag_min, normal_offdiag_max, normal_offdiag_mean;
-    getGreensDiagStats(sim, shear_diag_min, shear_diag_max, shear_diag_mean, normal_diag_min, normal_diag_max, normal_diag_mean, shear_offdiag_min, shear_offdiag_max, shear_offdiag_mean, normal_offdiag_min, normal_offdiag_max, normal_offdiag_mean);
-    //
-    sim->console() << "# Greens DiagShear:: " << shear_diag_min << " -- " << shear_diag_max << " (" << shear_diag_mean << ")\n"; // << std::endl << std::endl;
-    sim->console() << "# Greens DiagNormal:: " << normal_diag_min << " -- " << normal_diag_max << " (" << normal_diag_mean << ")\n"; // std::endl << std::endl;
-    sim->console() << "# Greens offDiagShear:: " << shear_offdiag_min << " -- " << shear_offdiag_max << " (" << shear_offdiag_mean << ")\n"; // std::endl << std::endl;
-    sim->console() << "# Greens offDiagNormal:: " << normal_offdiag_min << " -- " << normal_offdiag_max << " (" << normal_offdiag_mean << ")\n\n"; //  std::endl << std::endl;
+
+    if (sim->greenShear()->hierarchical()) {
+        unsigned int    num_dense, num_low_rank, max_rank;
+
+        sim->greenShear()->hierarchicalStats(num_dense, num_low_rank, max_rank);
+        sim->console() << "# Greens shear H-matrix: " << num_dense << " dense and " << num_low_rank << " low rank blocks, max rank " << max_rank << std::endl;
+        sim->greenNormal()->hierarchicalStats(num_dense, num_low_rank, max_rank);
+        sim->console() << "# Greens normal H-matrix: " << num_dense << " dense and " << num_low_rank << " low rank blocks, max rank " << max_rank << std::endl;
+    } else {
+        // The statistics look at every matrix value, so they are skipped for H-matrices
+        //
+        // yoder: print some greens max/min/mean stats:
+        // (and this information becoming less interesting with the introduction of (off)diagonal specific data).
+        double shear_min, shear_max, shear_mean, normal_min, normal_max, normal_mean;
+        getGreensStats(sim, shear_min, shear_max, shear_mean, normal_min, normal_max, normal_mean);
+        sim->console() << "# Greens Shear:\n max: " << shear_max << "\n min: " << shear_min << "\n mean: " << shear_mean << std::endl << std::endl;
+        sim->console() << "# Greens Normal:\n max: " << normal_max << "\n min: " << normal_min << "\n mean: " << normal_mean << std::endl << std::endl;
+        //
+        // yoder: and now, get Greens Stats for (off)diagonal elements separately.
+        double shear_diag_min, shear_diag_max, shear_diag_mean, normal_diag_min, normal_diag_max, normal_diag_mean;
+        double shear_offdiag_min, shear_offdiag_max, shear_offdiag_mean, normal_offdiag_min, normal_offdiag_max, normal_offdiag_mean;
+        getGreensDiagStats(sim, shear_diag_min, shear_diag_max, shear_diag_mean, normal_diag_min, normal_diag_max, normal_diag_mean, shear_offdiag_min, shear_offdiag_max, shear_offdiag_mean, normal_offdiag_min, normal_offdiag_max, normal_offdiag_mean);
+        //
+        sim->console() << "# Greens DiagShear:: " << shear_diag_min << " -- " << shear_diag_max << " (" << shear_diag_mean << ")\n"; // << std::endl << std::endl;
+        sim->console() << "# Greens DiagNormal:: " << normal_diag_min << " -- " << normal_diag_max << " (" << normal_diag_mean << ")\n"; // std::endl << std::endl;
+        sim->console() << "# Greens offDiagShear:: " << shear_offdiag_min << " -- " << shear_offdiag_max << " (" << shear_offdiag_mean << ")\n"; // std::endl << std::endl;
+        sim->console() << "# Greens offDiagNormal:: " << normal_offdiag_min << " -- " << normal_offdiag_max << " (" << normal_offdiag_mean << ")\n\n"; //  std::endl << std::endl;
+    }
 
 #ifdef MPI_C_FOUND
 
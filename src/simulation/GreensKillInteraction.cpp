@@ -38,10 +38,23 @@ void GreensKillInteraction::dryRun(SimFramework *_sim) {
 
 /*!
  Actively remove Greens function values during the simulation.
- In future simulations, we might reallocate the sparse matrix to improve memory usage.
+ The remaining values are then stored in sparse matrices to reclaim the memory
+ of the removed ones, and the stress calculations use sparse multiplication.
  */
 void GreensKillInteraction::init(SimFramework *_sim) {
+    Simulation                *sim = static_cast<Simulation *>(_sim);
+
     killInteraction(_sim, false);
+
+    if (sim->greenShear()->sparsify()) {
+        sim->console() << "# Greens shear matrix stored sparsely with " << sim->greenShear()->numNonzero()
+                       << " values in " << sim->greenShear()->mem_bytes()/(1024.0*1024.0) << " megabytes" << std::endl;
+    }
+
+    if (sim->greenNormal()->sparsify()) {
+        sim->console() << "# Greens normal matrix stored sparsely with " << sim->greenNormal()->numNonzero()
+                       << " values in " << sim->greenNormal()->mem_bytes()/(1024.0*1024.0) << " megabytes" << std::endl;
+    }
 }
 
 /*!
@@ -66,7 +79,8 @@ double GreensKillInteraction::killInteraction(SimFramework *_sim, const bool &dr
             if (local_block.center_distance(*jit) > sim->getGreensKillDistance()) {
                 num_kill++;
 
-                if (!dry_run) {
+                // H-matrices apply the kill distance while they are built
+                if (!dry_run && !sim->greenShear()->hierarchical()) {
                     sim->setGreens(local_block.getBlockID(), jit->getBlockID(), 0.0, 0.0);
                 }
             }
@@ -19,6 +19,96 @@
 // DEALINGS IN THE SOFTWARE.
 
 #include "RunEvent.h"
+#include "KrylovSolver.h"
+
+// Number of GMRES iterations between restarts
+#define KRYLOV_RESTART      50
+
+/*!
+ The secondary failure system restricted to the rows of this processor, applied
+ as an operator for the Krylov solver. The unknowns are ordered by processor
+ and within each processor by global block ID, so a vector of local rows is
+ a contiguous piece of the full vector.
+ */
+class SecondaryFailureOperator : public KrylovOperator {
+    private:
+        Simulation              *sim;
+        std::vector<BlockID>    row_ids;
+        std::vector<BlockID>    col_ids;
+        double                  *local_y;
+        std::vector<int>        proc_rows;
+        std::vector<int>        proc_row_disps;
+
+    public:
+        SecondaryFailureOperator(Simulation *_sim, const quakelib::ElementIDSet &local_ids, const BlockIDProcMapping &global_ids) : sim(_sim) {
+            BlockIDProcMapping::const_iterator  jt;
+            std::vector<int>                    next_row;
+            int                                 p;
+
+            row_ids.assign(local_ids.begin(), local_ids.end());
+            local_y = new double[row_ids.size()];
+            proc_rows.assign(sim->getWorldSize(), 0);
+            proc_row_disps.assign(sim->getWorldSize(), 0);
+
+            for (jt=global_ids.begin(); jt!=global_ids.end(); ++jt) proc_rows[jt->second]++;
+
+            for (p=1; p<sim->getWorldSize(); ++p) proc_row_disps[p] = proc_row_disps[p-1]+proc_rows[p-1];
+
+            next_row = proc_row_disps;
+            col_ids.resize(global_ids.size());
+
+            for (jt=global_ids.begin(); jt!=global_ids.end(); ++jt) col_ids[next_row[jt->second]++] = jt->first;
+
+            assertThrow(proc_rows[sim->getNodeRank()] == (int)row_ids.size(), "Local and global secondary failure counts do not match.");
+        };
+
+        ~SecondaryFailureOperator(void) {
+            delete [] local_y;
+        };
+
+        //! Position of the first local row in the full vector
+        int localStart(void) const {
+            return proc_row_disps[sim->getNodeRank()];
+        };
+
+        //! Entry of the system matrix for local row i and global block col
+        double val(const int &i, const BlockID &col) const {
+            double  a = sim->getGreenShear(row_ids[i], col);
+
+            if (sim->doNormalStress()) a -= sim->getFriction(row_ids[i])*sim->getGreenNormal(row_ids[i], col);
+
+            return a;
+        };
+
+        //! Assemble the full vector from the local pieces on every processor
+        void gather(const double *local_vals, double *vals) {
+#ifdef MPI_C_FOUND
+            MPI_Allgatherv(const_cast<double *>(local_vals), row_ids.size(), MPI_DOUBLE,
+                           vals, &proc_rows[0], &proc_row_disps[0], MPI_DOUBLE, MPI_COMM_WORLD);
+#else
+            std::copy(local_vals, local_vals+row_ids.size(), vals);
+#endif
+        };
+
+        virtual void apply(const double *x, double *y) {
+            int     i, n, num_cols;
+            double  sum;
+
+            num_cols = col_ids.size();
+
+            #pragma omp parallel for private(n, sum) schedule(static)
+
+            for (i=0; i<(int)row_ids.size(); ++i) {
+                sum = 0;
+
+                for (n=0; n<num_cols; ++n) sum += val(i, col_ids[n])*x[n];
+
+                local_y[i] = sum;
+            }
+
+            gather(local_y, y);
+        };
+};
 
 
 /*!
@@ -31,7 +121,7 @@ void RunEvent::markBlocks2Fail(Simulation *sim, const FaultID &trigger_fault) {
     bool        add;
 
     for (lid=0; lid<sim->numLocalBlocks(); ++lid) {
-        gid = sim->getGlobalBID(lid);
+        gid = sim->localGID(lid);
 
         // Blocks can only fail once per event, after that they slide freely (in secondary ruptures).
         // Also, we don't want to add elements that have over-slipped and have very negative CFFs (i.e. negative shear stress).
@@ -39,7 +129,7 @@ void RunEvent::markBlocks2Fail(Simulation *sim, const FaultID &trigger_fault) {
         if (sim->getFailed(gid) || sim->getCFF(gid) < sim->getMaxStressDrop(gid)) continue;
 
         // Add this block if it has a static or dynamic CFF failure
-        add = sim->cffFailure(gid) ||  sim->dynamicFailure(gid, trigger_fault);
+        add = sim->cffFailure(gid) ||  sim->dynamicFailure(lid, trigger_fault);
 
         if (add) {
             sim->setFailed(gid, true);
@@ -84,7 +174,10 @@ void RunEvent::processBlocksOrigFail(Simulation *sim, quakelib::ModelSweeps &swe
                                        sim->getNormalStress(gid));
 
                 sim->setSlipDeficit(gid, sim->getSlipDeficit(gid)+slip);
+                sim->setUpdateField(gid, slip);
             } else {
+                sim->setUpdateField(gid, 0);
+
                 // Schultz; If slip <= 0, then CFF <= max_stress_drop and we must have over-slipped.
                 //   Therefore we should consider it as not failed, so it won't contribute any later in the rupture.
                 if (sim->getCFF(gid) <= sim->getMaxStressDrop(gid)) {
@@ -95,33 +188,363 @@ void RunEvent::processBlocksOrigFail(Simulation *sim, quakelib::ModelSweeps &swe
     }
 }
 
-void solve_it(int n, double *x, double *A, double *b) {
-    int     i, j, k;
-    double  v, f, sum;
+/*!
+ Solve the dense system of secondary failure slips on the root node with the
+ configured solver, and record how long the solve took. Systems LAPACK finds
+ singular are solved again from copies with the builtin solver.
+ */
+void RunEvent::solveSlips(Simulation *sim, const int &n, double *x, double *A, double *b) {
+    double              start_time, solve_time;
+    bool                use_lapack;
+#ifdef VQ_HAVE_LAPACK
+    std::vector<double> A_copy, b_copy;
+    int                 i;
+#endif
 
-    for (i=0; i<n; ++i) {
-        v = A[i+n*i];
+    start_time = sim->curTime();
+    use_lapack = false;
+
+#ifdef VQ_HAVE_LAPACK
+    use_lapack = (sim->getSlipSolver() == SLIP_SOLVER_LAPACK);
 
-        for (j=i+1; j<n; ++j) {
-            f = A[i+n*j]/v;
+    // LAPACK overwrites A and b, so keep copies to hand a singular system to the builtin solver
+    if (use_lapack) {
+        A_copy.assign(A, A+(size_t)n*n);
+        b_copy.assign(b, b+n);
 
-            for (k=0; k<n; ++k) {
-                A[k+n*j] -= f*A[k+n*i];
+        if (!solveLAPACK(n, x, A, b)) {
+            num_singular_solves++;
+            solveLU(n, x, &A_copy[0], &b_copy[0]);
+
+            // The builtin solver divides by the zero pivots of a truly singular system
+            for (i=0; i<n; ++i) {
+                if (!isfinite(x[i])) {
+                    sim->errConsole() << "ERROR: Singular secondary failure system of dimension " << n
+                                      << " could not be solved. Quitting." << std::endl;
+                    exit(-1);
+                }
             }
+        }
+    }
+
+#endif
+
+    if (!use_lapack) solveLU(n, x, A, b);
+
+    solve_time = sim->curTime() - start_time;
+    recordSolve(sim, n, solve_time);
+}
+
+/*!
+ Solve the dense system of secondary failure slips on the root node, reusing
+ the LU factors from the previous sweep of this event. The failed set usually
+ only grows between sweeps, so the factors are extended with the new elements
+ as bordering rows and columns. If any element has left the set the system is
+ factored again from scratch. A and b are in global ID order.
+ */
+void RunEvent::solveSlipsIncremental(Simulation *sim, const int &n, double *x, const double *A, const double *b) {
+    BlockIDProcMapping::const_iterator  jt;
+    std::map<BlockID, int>              global_pos;
+    std::map<BlockID, int>::iterator    pit;
+    std::vector<BlockID>                global_ids;
+    std::vector<int>                    order, new_pos;
+    std::vector<bool>                   in_factors;
+    std::vector<double>                 A12, A21, A22, fb, fx;
+    double                              start_time, solve_time;
+    int                                 i, j, k, n1;
+    bool                                extend;
+
+    start_time = sim->curTime();
+
+    for (i=0,jt=global_secondary_elements.begin(); jt!=global_secondary_elements.end(); ++jt,++i) {
+        global_pos[jt->first] = i;
+        global_ids.push_back(jt->first);
+    }
+
+    // The factored elements must all still be in the set, in their factored order
+    extend = (slip_factors.size() > 0);
+    in_factors.assign(n, false);
+
+    for (i=0; extend && i<(int)factor_ids.size(); ++i) {
+        pit = global_pos.find(factor_ids[i]);
+
+        if (pit == global_pos.end()) extend = false;
+        else {
+            order.push_back(pit->second);
+            in_factors[pit->second] = true;
+        }
+    }
+
+    if (extend) {
+        for (i=0; i<n; ++i) {
+            if (!in_factors[i]) new_pos.push_back(i);
+        }
+
+        n1 = order.size();
+        k = new_pos.size();
+        A12.resize(n1*k);
+        A21.resize(k*n1);
+        A22.resize(k*k);
+
+        for (i=0; i<n1; ++i) {
+            for (j=0; j<k; ++j) A12[i*k+j] = A[order[i]*n+new_pos[j]];
+        }
+
+        for (i=0; i<k; ++i) {
+            for (j=0; j<n1; ++j) A21[i*n1+j] = A[new_pos[i]*n+order[j]];
+
+            for (j=0; j<k; ++j) A22[i*k+j] = A[new_pos[i]*n+new_pos[j]];
+        }
+
+        if (k > 0) slip_factors.extend(k, &A12[0], &A21[0], &A22[0]);
+
+        order.insert(order.end(), new_pos.begin(), new_pos.end());
+        num_incremental_solves++;
+    } else {
+        order.clear();
+
+        for (i=0; i<n; ++i) order.push_back(i);
+
+        slip_factors.factor(n, A);
+    }
+
+    // Record the factored order and solve in it
+    factor_ids.resize(n);
+    fb.resize(n);
+    fx.resize(n);
+
+    for (i=0; i<n; ++i) {
+        factor_ids[i] = global_ids[order[i]];
+        fb[i] = b[order[i]];
+    }
+
+    if (n > 0) slip_factors.solve(&fx[0], &fb[0]);
 
-            b[j] -= f*b[i];
+    for (i=0; i<n; ++i) x[order[i]] = fx[i];
+
+    solve_time = sim->curTime() - start_time;
+    recordSolve(sim, n, solve_time);
+}
+
+void RunEvent::recordSolve(Simulation *sim, const int &n, const double &solve_time) {
+#ifdef DEBUG
+    sim->console() << "# Secondary failure solve " << num_solves << ": dimension " << n
+                   << ", " << solve_time << " seconds" << std::endl;
+#endif
+    num_solves++;
+    total_solve_time += solve_time;
+
+    if ((unsigned int)n > max_solve_dim) max_solve_dim = n;
+
+    if (solve_time > max_solve_time) max_solve_time = solve_time;
+}
+
+/*!
+ Solve the secondary failure system directly. The rows of each processor are
+ gathered on the root node, solved there and the slips of the local rows are
+ returned in x.
+ */
+void RunEvent::solveSecondaryDirect(Simulation *sim, const quakelib::ElementIDSet &local_ids, double *x) {
+    quakelib::ElementIDSet::const_iterator      it;
+    BlockIDProcMapping::const_iterator          jt;
+    unsigned int                                i, n;
+
+    int num_local_failed = local_ids.size();
+    int num_global_failed = global_secondary_elements.size();
+
+    // Each local row of A is packed with its right hand side entry b[i] in the last column,
+    // so the whole local system is gathered to the root in a single collective call
+    int row_len = num_global_failed+1;
+    double *rows = new double[num_local_failed*row_len];
+
+    //
+    // stress transfer (greens functions) between each local element and all global elements.
+    for (i=0,it=local_ids.begin(); it!=local_ids.end(); ++i,++it) {
+        double *row = &(rows[i*row_len]);
+
+        for (n=0,jt=global_secondary_elements.begin(); jt!=global_secondary_elements.end(); ++n,++jt) {
+
+            row[n] = sim->getGreenShear(*it, jt->first);
+
+            if (sim->doNormalStress()) {
+                row[n] -= sim->getFriction(*it)*sim->getGreenNormal(*it, jt->first);
+            }
         }
+
+        ///// Schultz:
+        // Even if we are doing dynamic stress drops, they've already been set. Check processStaticFailure() and
+        // the beginning of this method
+        //b[i] = sim->getStressDrop(*it) - sim->getCFF(*it);
+        row[num_global_failed] = sim->getEffectiveStressDrop(*it);
     }
 
-    for (i=n-1; i>=0; --i) {
-        sum = b[i];
+    //
+    // The rows arrive on the root grouped by processor, and within each processor in global
+    // ID order. The number of rows from each processor is known everywhere from
+    // global_secondary_elements, so no extra counts need to be exchanged.
+    int world_size = sim->getWorldSize();
+    int *proc_rows = new int[world_size];
+    int *proc_row_disps = new int[world_size];
+    int *next_row = new int[world_size];
+
+    for (int p=0; p<world_size; ++p) proc_rows[p] = 0;
+
+    for (jt=global_secondary_elements.begin(); jt!=global_secondary_elements.end(); ++jt) proc_rows[jt->second]++;
+
+    for (int p=0; p<world_size; ++p) proc_row_disps[p] = (p > 0 ? proc_row_disps[p-1]+proc_rows[p-1] : 0);
+
+    assertThrow(proc_rows[sim->getNodeRank()] == num_local_failed, "Local and global secondary failure counts do not match.");
+
+    if (sim->isRootNode()) {
+        double *packed = new double[num_global_failed*row_len];
+        double *fullA = new double[num_global_failed*num_global_failed];
+        double *fullb = new double[num_global_failed];
+        double *fullx = new double[num_global_failed];
+
+#ifdef MPI_C_FOUND
+        int *proc_counts = new int[world_size];
+        int *proc_disps = new int[world_size];
+
+        for (int p=0; p<world_size; ++p) {
+            proc_counts[p] = proc_rows[p]*row_len;
+            proc_disps[p] = proc_row_disps[p]*row_len;
+        }
+
+        MPI_Gatherv(rows, num_local_failed*row_len, MPI_DOUBLE,
+                    packed, proc_counts, proc_disps, MPI_DOUBLE,
+                    ROOT_NODE_RANK, MPI_COMM_WORLD);
+
+        delete [] proc_disps;
+        delete [] proc_counts;
+#else
+        assertThrow(world_size == 1, "Single processor version of code, but faults mapped to multiple processors.");
+        memcpy(packed, rows, sizeof(double)*num_local_failed*row_len);
+#endif
+
+        // Unpack the rows into global ID order
+        for (int p=0; p<world_size; ++p) next_row[p] = proc_row_disps[p];
+
+        for (i=0,jt=global_secondary_elements.begin(); jt!=global_secondary_elements.end(); ++jt,++i) {
+            double *row = &(packed[(next_row[jt->second]++)*row_len]);
+
+            memcpy(&(fullA[i*num_global_failed]), row, sizeof(double)*num_global_failed);
+            fullb[i] = row[num_global_failed];
+        }
+
+        delete [] packed;
+
+        //
+        // Solve the global system on the root node (we're inside an if (sim->isRootNode()) {} block )
+        if (sim->getSlipSolver() != SLIP_SOLVER_LAPACK && sim->useIncrementalSlipSolver()) {
+            solveSlipsIncremental(sim, num_global_failed, fullx, fullA, fullb);
+        } else {
+            solveSlips(sim, num_global_failed, fullx, fullA, fullb);
+        }
+
+        // Reorder the solution by processor so each one receives a contiguous piece
+        for (int p=0; p<world_size; ++p) next_row[p] = proc_row_disps[p];
 
-        for (j=i+1; j<n; ++j) {
-            sum -= A[j+n*i]*x[j];
+        for (i=0,jt=global_secondary_elements.begin(); jt!=global_secondary_elements.end(); ++jt,++i) {
+            fullb[next_row[jt->second]++] = fullx[i];
         }
 
-        x[i] = sum/A[i+n*i];
+#ifdef MPI_C_FOUND
+        MPI_Scatterv(fullb, proc_rows, proc_row_disps, MPI_DOUBLE,
+                     x, num_local_failed, MPI_DOUBLE,
+                     ROOT_NODE_RANK, MPI_COMM_WORLD);
+#else
+        memcpy(x, fullb, sizeof(double)*num_local_failed);
+#endif
+
+        //
+        // Delete the memory arrays created (use delete [] for arrays)
+        delete [] fullx;
+        delete [] fullb;
+        delete [] fullA;
+    } else {
+        // NOT root_node:
+#ifdef MPI_C_FOUND
+        // Send the packed rows to the root node, then receive the slips of the local rows
+        MPI_Gatherv(rows, num_local_failed*row_len, MPI_DOUBLE,
+                    NULL, NULL, NULL, MPI_DOUBLE,
+                    ROOT_NODE_RANK, MPI_COMM_WORLD);
+        MPI_Scatterv(NULL, NULL, NULL, MPI_DOUBLE,
+                     x, num_local_failed, MPI_DOUBLE,
+                     ROOT_NODE_RANK, MPI_COMM_WORLD);
+#else
+        assertThrow(false, "Single processor version of code, but processor MPI rank is non-zero.");
+#endif
     }
+
+    delete [] next_row;
+    delete [] proc_row_disps;
+    delete [] proc_rows;
+    delete [] rows;
+}
+
+/*!
+ Solve the secondary failure system with GMRES. The Green's submatrix is
+ never assembled: each processor applies its own rows directly from the
+ Green's matrices and the results are exchanged. The initial guess is the
+ slip each element had in the previous secondary solve of this event.
+ Returns false without recording the solve if GMRES gave up on non-finite values.
+ */
+bool RunEvent::solveSecondaryKrylov(Simulation *sim, const quakelib::ElementIDSet &local_ids, double *x) {
+    SecondaryFailureOperator                    op(sim, local_ids, global_secondary_elements);
+    quakelib::ElementIDSet::const_iterator      it;
+    std::map<BlockID, double>::const_iterator   sit;
+    double                                      start_time, solve_time, rel_res;
+    int                                         i, n, iters;
+
+    start_time = sim->curTime();
+    n = global_secondary_elements.size();
+
+    double *local_b = new double[local_ids.size()];
+    double *local_diag = new double[local_ids.size()];
+    double *full_b = new double[n];
+    double *full_diag = new double[n];
+    double *full_x = new double[n];
+
+    for (i=0,it=local_ids.begin(); it!=local_ids.end(); ++i,++it) {
+        sit = secondary_slips.find(*it);
+        local_b[i] = sim->getEffectiveStressDrop(*it);
+        local_diag[i] = op.val(i, *it);
+        x[i] = (sit != secondary_slips.end() ? sit->second : 0);
+    }
+
+    op.gather(local_b, full_b);
+    op.gather(local_diag, full_diag);
+    op.gather(x, full_x);
+
+    iters = solveGMRES(op, n, full_x, full_b, full_diag,
+                       KRYLOV_RESTART, sim->getKrylovMaxIterations(), sim->getKrylovTolerance(), rel_res);
+
+    for (i=0; i<(int)local_ids.size(); ++i) x[i] = full_x[op.localStart()+i];
+
+    delete [] full_x;
+    delete [] full_diag;
+    delete [] full_b;
+    delete [] local_diag;
+    delete [] local_b;
+
+    // GMRES stops at once on non-finite values, leave those systems to the direct solver.
+    // rel_res is computed from the gathered system so all nodes agree on this.
+    if (!isfinite(rel_res)) {
+        num_krylov_fallbacks++;
+        return false;
+    }
+
+    solve_time = sim->curTime() - start_time;
+    recordSolve(sim, n, solve_time);
+
+    num_krylov_solves++;
+    total_krylov_iters += iters;
+
+    if (!(rel_res <= sim->getKrylovTolerance())) num_unconverged_solves++;
+
+    if ((unsigned int)iters > max_krylov_iters) max_krylov_iters = iters;
+
+    return true;
 }
 
 void RunEvent::processBlocksSecondaryFailures(Simulation *sim, quakelib::ModelSweeps &sweeps) {
@@ -136,7 +559,6 @@ void RunEvent::processBlocksSecondaryFailures(Simulation *sim, quakelib::ModelSw
     BlockID         gid;
     unsigned int    i, n;
     quakelib::ElementIDSet          local_secondary_id_list;  // lists of local/global secondary failures.
-    BlockIDProcMapping              global_secondary_id_list;
     //
     quakelib::ElementIDSet::const_iterator      it;
     BlockIDProcMapping::const_iterator  jt;
@@ -149,7 +571,7 @@ void RunEvent::processBlocksSecondaryFailures(Simulation *sim, quakelib::ModelSw
         // which i think is a pretty safe bet. BUT, let's leave the original looping code in comment, to facilitate an easy recovery if this is a mistake.
         // another possible concern is keepting track of local/global blocks. for now, let's leave this alone. it is a (relatively) small matter of optimization.
         //lid = s_it->_element_id;
-        gid = sim->getGlobalBID(lid);
+        gid = sim->localGID(lid);
 
         //
         // If the block has already failed (but not in this sweep) then adjust the slip
@@ -167,7 +589,8 @@ void RunEvent::processBlocksSecondaryFailures(Simulation *sim, quakelib::ModelSw
     // yoder (note): after we distributeBlocks(), we can check to see that all items in local_ exist in global_ exactly once.
     // if not, throw an exception... and then we'll figure out how this is happening. remember, local_ is like [gid, gig, gid...]
     // global_ is like [(gid, p_rank), (gid, p_rank)...], and each pair item is accessed like global_[rw_num]->first /->second
-    sim->distributeBlocks(local_secondary_id_list, global_secondary_id_list);
+    global_secondary_elements.clear();
+    sim->distributeBlocks(local_secondary_id_list, global_secondary_elements);
 
     // ==== DYNAMIC STRESS DROPS ==========
     // Schultz: now that we know how many elements are involved, assign dynamic stress drops
@@ -187,7 +610,7 @@ void RunEvent::processBlocksSecondaryFailures(Simulation *sim, quakelib::ModelSw
         }
 
         // Also add in the area from the secondary failed elements
-        for (bit=global_secondary_id_list.begin(); bit!=global_secondary_id_list.end(); ++bit) {
+        for (bit=global_secondary_elements.begin(); bit!=global_secondary_elements.end(); ++bit) {
             // Avoid double counting
             if (!all_event_blocks.count(bit->first)) {
                 current_event_area += sim->getBlock(bit->first).area();
@@ -211,124 +634,15 @@ void RunEvent::processBlocksSecondaryFailures(Simulation *sim, quakelib::ModelSw
     // the appropriate stress drops will be communicated to other processors.
 
 
-    //int num_local_failed = local_id_list.size();
-    //int num_global_failed = global_id_list.size();
     int num_local_failed = local_secondary_id_list.size();
-    int num_global_failed = global_secondary_id_list.size();
-
-    double *A = new double[num_local_failed*num_global_failed];
-    double *b = new double[num_local_failed];
+    int num_global_failed = global_secondary_elements.size();
     double *x = new double[num_local_failed];
 
-    //
-    // stress transfer (greens functions) between each local element and all global elements.
-    for (i=0,it=local_secondary_id_list.begin(); it!=local_secondary_id_list.end(); ++i,++it) {
-        for (n=0,jt=global_secondary_id_list.begin(); jt!=global_secondary_id_list.end(); ++n,++jt) {
-
-            A[i*num_global_failed+n] = sim->getGreenShear(*it, jt->first);
-
-            if (sim->doNormalStress()) {
-                A[i*num_global_failed+n] -= sim->getFriction(*it)*sim->getGreenNormal(*it, jt->first);
-            }
-        }
-
-        ///// Schultz:
-        // Even if we are doing dynamic stress drops, they've already been set. Check processStaticFailure() and
-        // the beginning of this method
-        //b[i] = sim->getStressDrop(*it) - sim->getCFF(*it);
-        b[i] = sim->getEffectiveStressDrop(*it);
-    }
-
-    //
-    // so A,b are calculated for each local node (with dimension n_local x n_global and now they'll be consolidated on the root node. note that
-    // the corresponding mpi_send comes after this block. the root node blocks until child nodes have sent A,b and root_node has received A,b.
-
-    /////////////
-    //
-    if (sim->isRootNode()) {
-        double *fullA = new double[num_global_failed*num_global_failed];
-        double *fullb = new double[num_global_failed];
-        double *fullx = new double[num_global_failed];
-
-        // Fill in the A matrix and b vector from the various processes
-        //for (i=0,n=0,jt=global_id_list.begin(); jt!=global_id_list.end(); ++jt,++i) {
-        for (i=0,n=0,jt=global_secondary_id_list.begin(); jt!=global_secondary_id_list.end(); ++jt,++i) {
-            if (jt->second != sim->getNodeRank()) {
-#ifdef MPI_C_FOUND
-                //
-                // element NOT local to this (root) node, so receive this data element from the remote process with mpi_rank jt->second:
-                // note: jt-> first: global_id, jt->second: node_id/rank
-                // MPI_Recv(in_buff{out}, in_len, mpi_dtype, src_node, tag, comm, status{out})
-                // note that in_buff and status are technically "output" parameters for the MPI_Recv function; we read data into in_buff by
-                // calling MPI_Recv()
-                MPI_Recv(&(fullA[i*num_global_failed]), num_global_failed, MPI_DOUBLE, jt->second, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                MPI_Recv(&(fullb[i]), 1, MPI_DOUBLE, jt->second, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-#else
-                assertThrow(false, "Single processor version of code, but faults mapped to multiple processors.");
-#endif
-            } else {
-                // YES, element is local to this node; copy from the "local" array to the "global" array:
-                memcpy(&(fullA[i*num_global_failed]), &(A[n*num_global_failed]), sizeof(double)*num_global_failed);
-                memcpy(&(fullb[i]), &(b[n]), sizeof(double));
-                n++;
-            }
-        }
-
-        //
-        // Solve the global system on the root node (we're inside an if (sim->isRootNode()) {} block )
-        solve_it(num_global_failed, fullx, fullA, fullb);
-
-        // Send back the resulting values from x to each process
-        //for (i=0,n=0,jt=global_id_list.begin(); jt!=global_id_list.end(); ++jt,++i) {
-        for (i=0,n=0,jt=global_secondary_id_list.begin(); jt!=global_secondary_id_list.end(); ++jt,++i) {
-            if (jt->second != sim->getNodeRank()) {
-#ifdef MPI_C_FOUND
-                // send these values to node-rank jt->second:
-                // yoder: try using synchronous send, MPI_Ssend()
-                //MPI_Send(&(fullx[i]), 1, MPI_DOUBLE, jt->second, 0, MPI_COMM_WORLD);
-                /// THIS WAS THE FIX FOR HEISENBUG ////////////////////////
-                MPI_Ssend(&(fullx[i]), 1, MPI_DOUBLE, jt->second, 0, MPI_COMM_WORLD);
-                //////////////////////////////////////////////////////////
-#else
-                assertThrow(false, "Single processor version of code, but faults mapped to multiple   processors.");
-#endif
-            } else {
-                // yoder: so we're copying the revised xfull[j] -- x[n] ('global' to 'local'); x[n] are the local
-                // node's values. aka, node sends these values back to itself.
-                memcpy(&(x[n]), &(fullx[i]), sizeof(double));
-                n++;
-            }
-        }
-
-        //
-        // Delete the memory arrays created (use delete [] for arrays)
-        delete [] fullx;
-        delete [] fullb;
-        delete [] fullA;
-    } else {
-        // NOT root_node:
-#ifdef MPI_C_FOUND
-        // send these values to root (rank 0) node:
-        // Child Nodes do their sending bit:
-        for (i=0; i<num_local_failed; ++i) {
-            // yoder: We must use synchronous MPI_Ssend() (this waits for all processors to report back before proceeding).
-            //MPI_Send(&(A[i*num_global_failed]), num_global_failed, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-            //MPI_Send(&(b[i]), 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-            /// THIS WAS THE FIX FOR HEISENBUG ////////////////////////
-            MPI_Ssend(&(A[i*num_global_failed]), num_global_failed, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-            MPI_Ssend(&(b[i]), 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
-        }
-
-
-        //
-        for (i=0; i<num_local_failed; ++i) {
-            MPI_Recv(&(x[i]), 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-        }
-
-#else
-        assertThrow(false, "Single processor version of code, but processor MPI rank is non-zero.");
-#endif
+    // Large systems may be solved iteratively, warm started from the slips of the previous sweep.
+    // Systems GMRES gives up on because of non-finite values are solved directly.
+    if (sim->getSlipSolver() != SLIP_SOLVER_KRYLOV || num_global_failed < sim->getKrylovMinSize() ||
+            !solveSecondaryKrylov(sim, local_secondary_id_list, x)) {
+        solveSecondaryDirect(sim, local_secondary_id_list, x);
     }
 
     // Take the results of the calculation and determine how much each ruptured block slipped
@@ -338,6 +652,7 @@ void RunEvent::processBlocksSecondaryFailures(Simulation *sim, quakelib::ModelSw
         ///////////////
         // Schultz:: The matrix solution solves for the slip, not the final slip deficit.
         double slip = x[i];
+        secondary_slips[*it] = slip;
         ///////////////
 
         ////// Schultz:
@@ -356,7 +671,10 @@ void RunEvent::processBlocksSecondaryFailures(Simulation *sim, quakelib::ModelSw
                                    sim->getNormalStress(*it));
             //
             sim->setSlipDeficit(*it, sim->getSlipDeficit(*it)+slip);
+            sim->setUpdateField(*it, slip);
         } else {
+            sim->setUpdateField(*it, 0);
+
             // Schultz; If slip <= 0, then CFF <= stress_drop and we must have over-slipped.
             //   Therefore we should consider it as not failed, so it won't contribute any later in the rupture.
             if (sim->getCFF(gid) <= sim->getMaxStressDrop(gid)) {
@@ -367,13 +685,33 @@ void RunEvent::processBlocksSecondaryFailures(Simulation *sim, quakelib::ModelSw
 
     //
     // delete/de-allocate arrays (use "delete []" for arrays, as opposed to "delete" for single objects)
-    delete [] A;
-    delete [] b;
     delete [] x;
 }
 
 
 
+/*!
+ Update the stresses for the slips of the listed blocks in this sweep.
+ The update field of each local listed block holds its slip in this sweep (or 0),
+ so after distributing it only the Greens columns of the slipped blocks are applied.
+ This costs O(k*N) for k slipped blocks rather than a full O(N^2) recompute.
+ */
+void RunEvent::applySlipChanges(Simulation *sim, const BlockIDProcMapping &slipped_elements) {
+    BlockIDProcMapping::const_iterator  it;
+    BlockIDList                         cols;
+
+    // Communicate the slips between processors
+    sim->distributeUpdateField();
+
+    for (it=slipped_elements.begin(); it!=slipped_elements.end(); ++it) {
+        if (sim->getUpdateField(it->first) != 0) cols.push_back(it->first);
+    }
+
+    if (cols.empty()) return;
+
+    sim->updateStressesAndCFFs(cols);
+}
+
 /*!
  Given an initial failed block, propagates the failure throughout the system
  by calculating changes in stress and using static and dynamic stress
@@ -471,82 +809,65 @@ void RunEvent::processStaticFailure(Simulation *sim) {
 
         // Now, each process has updated slips for its elements but only that process has the update.
         // We must communicate these updates among all processes.
-        for (it=sim->begin(); it!=sim->end(); ++it) {
-            BlockID gid = it->getBlockID();
-            sim->setShearStress(gid, 0.0);
-            sim->setNormalStress(gid, sim->getRhogd(gid));
-            //sim->setUpdateField(gid, (sim->getFailed(gid) ? 0 : sim->getSlipDeficit(gid)));
-            ///////// Schultz:
-            // Update the stresses using the current slip of all elements, or else we throw away the slips
-            //   computed in processBlocksOrigFail().
-            sim->setUpdateField(gid, sim->getSlipDeficit(gid));
-            // Although we are adding slip deficits for all elements not just the local ones, when we execute the
-            //   distributeUpdateField() command below only the local elements are selected.
-        }
+        if (sim->doSparseSweepUpdates()) {
+            // Only the Greens columns of the blocks that slipped in this sweep change the stresses
+            applySlipChanges(sim, global_failed_elements);
+        } else {
+            for (it=sim->begin(); it!=sim->end(); ++it) {
+                BlockID gid = it->getBlockID();
+                sim->setShearStress(gid, 0.0);
+                sim->setNormalStress(gid, sim->getRhogd(gid));
+                //sim->setUpdateField(gid, (sim->getFailed(gid) ? 0 : sim->getSlipDeficit(gid)));
+                ///////// Schultz:
+                // Update the stresses using the current slip of all elements, or else we throw away the slips
+                //   computed in processBlocksOrigFail().
+                sim->setUpdateField(gid, sim->getSlipDeficit(gid));
+                // Although we are adding slip deficits for all elements not just the local ones, when we execute the
+                //   distributeUpdateField() command below only the local elements are selected.
+            }
 
-        // Distribute the update field values to other processors
-        sim->distributeUpdateField();
+            // Distribute the update field values to other processors
+            sim->distributeUpdateField();
 
 
-        // Calculate the new CFFs based on the slips computed in processBlocksOrigFail()
-        // multiply greenSchear() x getUpdateFieldPtr() --> getShearStressPtr() ... right?
-        // assign stress values (shear stresses at this stage are all set to 0; normal stresses are set to sim->getRhogd(gid) -- see code a couple paragraphs above.
-        //
-        // The following matrix operation adds in normal/shear changes due to the current slip deficits and the Greens function interaction matrix.
-        sim->matrixVectorMultiplyAccum(sim->getShearStressPtr(),
-                                       sim->greenShear(),
-                                       sim->getUpdateFieldPtr(),
-                                       true);
-
-        if (sim->doNormalStress()) {
-            sim->matrixVectorMultiplyAccum(sim->getNormalStressPtr(),
-                                           sim->greenNormal(),
-                                           sim->getUpdateFieldPtr(),
-                                           true);
+            // Calculate the new CFFs based on the slips computed in processBlocksOrigFail()
+            // multiply greenSchear() x getUpdateFieldPtr() --> getShearStressPtr() ... right?
+            // assign stress values (shear stresses at this stage are all set to 0; normal stresses are set to sim->getRhogd(gid) -- see code a couple paragraphs above.
+            //
+            // The following matrix operation adds in normal/shear changes due to the current slip deficits and the Greens function interaction matrix.
+            sim->updateStressesAndCFFs(true);
         }
 
-        sim->computeCFFs();
-
 
         //
         // Create the matrix equation, including interactions, and solve the system for slips
         processBlocksSecondaryFailures(sim, event_sweeps);
 
-        // Set the update field to the slip of all blocks
-        for (it=sim->begin(); it!=sim->end(); ++it) {
-            BlockID gid = it->getBlockID();
-            sim->setShearStress(gid, 0.0);
-            sim->setNormalStress(gid, sim->getRhogd(gid));
-
-            //////// Schultz: try setting updatefield 0 for newly failed elements this sweep
-            //sim->setUpdateField(gid, ((sim->getFailed(gid) && global_failed_elements.count(gid) == 0) ? 0 : sim->getSlipDeficit(gid)));
-            // We need to ensure our slip economics books are balanced. I suspect we need here
-            // instead: sim->setUpdateField(gid, sim->getSlipDeficit(gid) ). Update the stresses using
-            // the current slip of all elements, or else we throw away the slip information from failed elements.
-            sim->setUpdateField(gid, sim->getSlipDeficit(gid));
-        }
-
-
-        // Communicate the slip deficits between processors.
-        sim->distributeUpdateField();
+        // In the final sweep the stresses are recomputed from the slip deficits, so round off
+        // from the sparse updates does not carry over to the next event.
+        if (sim->doSparseSweepUpdates() && !final_sweep) {
+            applySlipChanges(sim, global_secondary_elements);
+        } else {
+            // Set the update field to the slip of all blocks
+            for (it=sim->begin(); it!=sim->end(); ++it) {
+                BlockID gid = it->getBlockID();
+                sim->setShearStress(gid, 0.0);
+                sim->setNormalStress(gid, sim->getRhogd(gid));
+
+                //////// Schultz: try setting updatefield 0 for newly failed elements this sweep
+                //sim->setUpdateField(gid, ((sim->getFailed(gid) && global_failed_elements.count(gid) == 0) ? 0 : sim->getSlipDeficit(gid)));
+                // We need to ensure our slip economics books are balanced. I suspect we need here
+                // instead: sim->setUpdateField(gid, sim->getSlipDeficit(gid) ). Update the stresses using
+                // the current slip of all elements, or else we throw away the slip information from failed elements.
+                sim->setUpdateField(gid, sim->getSlipDeficit(gid));
+            }
 
-        // Calculate the new shear stresses and CFFs given the new update field values
-        sim->matrixVectorMultiplyAccum(sim->getShearStressPtr(),
-                                       sim->greenShear(),
-                                       sim->getUpdateFieldPtr(),
-                                       true);
 
-        //
-        if (sim->doNormalStress()) {
-            sim->matrixVectorMultiplyAccum(sim->getNormalStressPtr(),
-                                           sim->greenNormal(),
-                                           sim->getUpdateFieldPtr(),
-                                           true);
+            // Communicate the slip deficits between processors and calculate
+            // the new shear stresses and CFFs given the new update field values
+            sim->distributeUpdateFieldAndStresses();
         }
 
-        //
-        sim->computeCFFs();
-
         // ------------------------------------------------------------------------------------------------------------
 
 
@@ -619,8 +940,6 @@ void RunEvent::processStaticFailure(Simulation *sim) {
  field appropriately.
  */
 void RunEvent::processAftershock(Simulation *sim) {
-    std::map<double, BlockID>                   as_elem_dists;
-    std::map<double, BlockID>::const_iterator   it;
     std::map<BlockID, double>                   elem_slips;
     EventAftershock                             as;
     BlockID                                     gid;
@@ -644,13 +963,6 @@ void RunEvent::processAftershock(Simulation *sim) {
         // Pop the next aftershock off the list
         as = sim->popAftershock();
 
-        // Calculate the distance from the aftershock to all elements
-        ////// Schultz: This is very inefficient. Makes aftershock simulations slow.
-        for (gid=0; gid<sim->numGlobalBlocks(); ++gid) {
-            double as_to_elem_dist = sim->getBlock(gid).center().dist(as.loc());
-            as_elem_dists.insert(std::make_pair(as_to_elem_dist, gid));
-        }
-
         // Determine the target rupture area given the aftershock magnitude
         // TODO:
         // user_defined_constants (flag this for later revisions in which we move these contant definitions to a parameters file).
@@ -662,14 +974,26 @@ void RunEvent::processAftershock(Simulation *sim) {
         double selected_rupture_area_mu = 0;
 
         // Go through the elements, closest first, until we find enough to match the rupture area
-        for (it=as_elem_dists.begin(); it!=as_elem_dists.end(); ++it) {
-            Block &b=sim->getBlock(it->second);
+        KDTreeNearest nearest(block_centers, as.loc());
+        unsigned int near_id;
+        double near_dist, prev_dist = 0;
+        bool first = true;
+
+        while (nearest.next(near_id, near_dist)) {
+            // Elements were previously ranked in a map keyed on distance, which kept only the
+            // lowest ID of elements at the same distance. Skip the others to select the same elements.
+            if (!first && near_dist == prev_dist) continue;
+
+            Block &b=sim->getBlock(near_id);
             selected_rupture_area += b.area();
             selected_rupture_area_mu += b.area()*b.lame_mu();
-            id_set.insert(it->second);
+            id_set.insert(near_id);
 
             // If this is the first aftershock element, assign it as the event trigger
-            if (it==as_elem_dists.begin()) sim->getCurrentEvent().setEventTrigger(it->second);
+            if (first) sim->getCurrentEvent().setEventTrigger(near_id);
+
+            first = false;
+            prev_dist = near_dist;
 
             if (selected_rupture_area > rupture_area) break;
         }
@@ -705,19 +1029,7 @@ void RunEvent::processAftershock(Simulation *sim) {
     }
 
     // Calculate the new shear stresses and CFFs given the new update field values
-    sim->matrixVectorMultiplyAccum(sim->getShearStressPtr(),
-                                   sim->greenShear(),
-                                   sim->getUpdateFieldPtr(),
-                                   true);
-
-    if (sim->doNormalStress()) {
-        sim->matrixVectorMultiplyAccum(sim->getNormalStressPtr(),
-                                       sim->greenNormal(),
-                                       sim->getUpdateFieldPtr(),
-                                       true);
-    }
-
-    sim->computeCFFs();
+    sim->updateStressesAndCFFs(true);
 
     // Record final stresses on each block involved in the aftershock
     for (bit=id_set.begin(); bit!=id_set.end(); ++bit) {
@@ -728,13 +1040,49 @@ void RunEvent::processAftershock(Simulation *sim) {
     sim->getCurrentEvent().setSweeps(event_sweeps);
 }
 
+void RunEvent::init(SimFramework *_sim) {
+    Simulation                      *sim = static_cast<Simulation *>(_sim);
+    std::vector<quakelib::Vec<3> >  centers;
+    std::vector<unsigned int>       center_ids;
+    BlockID                         gid;
+
+    num_solves = num_singular_solves = max_solve_dim = 0;
+    num_krylov_solves = num_unconverged_solves = num_krylov_fallbacks = max_krylov_iters = 0;
+    num_incremental_solves = 0;
+    total_krylov_iters = 0;
+    total_solve_time = max_solve_time = 0;
+
+    // Aftershocks are only processed on the root node
+    if (sim->isRootNode()) {
+        for (gid=0; gid<sim->numGlobalBlocks(); ++gid) {
+            centers.push_back(sim->getBlock(gid).center());
+            center_ids.push_back(gid);
+        }
+
+        block_centers.build(centers, center_ids);
+    }
+
+#ifndef VQ_HAVE_LAPACK
+
+    if (sim->getSlipSolver() == SLIP_SOLVER_LAPACK) {
+        sim->console() << "# WARNING: LAPACK slip solver requested but VQ was compiled without LAPACK, using LU." << std::endl;
+    }
+
+#endif
+}
+
 SimRequest RunEvent::run(SimFramework *_sim) {
     Simulation            *sim = static_cast<Simulation *>(_sim);
     int                     lid;
 
     // Save stress information at the beginning of the event
     // This is used to determine dynamic block failure
-    for (lid=0; lid<sim->numLocalBlocks(); ++lid) sim->saveStresses(sim->getGlobalBID(lid));
+    for (lid=0; lid<sim->numLocalBlocks(); ++lid) sim->saveStresses(sim->localGID(lid));
+
+    // Secondary failure slips and factors are only reused within the same event
+    secondary_slips.clear();
+    slip_factors.clear();
+    factor_ids.clear();
 
     if (sim->getCurrentEvent().getEventTrigger() != UNDEFINED_ELEMENT_ID) {
         processStaticFailure(sim);
@@ -748,8 +1096,7 @@ SimRequest RunEvent::run(SimFramework *_sim) {
 
     // Reset the failed status for each local block
     for (lid=0; lid<sim->numLocalBlocks(); ++lid) {
-        BlockID gid = sim->getGlobalBID(lid);
-        sim->setFailed(gid, false);
+        sim->setFailed(sim->localGID(lid), false);
     }
 
     // TODO: reinstate this check
@@ -814,3 +1161,36 @@ void RunEvent::recordEventStresses(Simulation *sim) {
 
     sim->getCurrentEvent().setEventStresses(total_shear_init, total_shear_final, total_normal_init, total_normal_final);
 }
+
+void RunEvent::finish(SimFramework *_sim) {
+    Simulation            *sim = static_cast<Simulation *>(_sim);
+
+    if (!sim->isRootNode() || num_solves == 0) return;
+
+    sim->console() << "# Secondary failure solves: " << num_solves
+                   << " (max dimension " << max_solve_dim
+                   << ", total " << total_solve_time
+                   << "s, max " << max_solve_time << "s)" << std::endl;
+
+    if (num_incremental_solves > 0) {
+        sim->console() << "# Secondary failure solves reusing previous factors: " << num_incremental_solves << std::endl;
+    }
+
+    if (num_krylov_solves > 0) {
+        sim->console() << "# GMRES solves: " << num_krylov_solves
+                       << " (average " << double(total_krylov_iters)/num_krylov_solves
+                       << " iterations, max " << max_krylov_iters << ")" << std::endl;
+    }
+
+    if (num_unconverged_solves > 0) {
+        sim->console() << "# WARNING: " << num_unconverged_solves << " GMRES solves did not reach sim.system.krylov_tolerance." << std::endl;
+    }
+
+    if (num_krylov_fallbacks > 0) {
+        sim->console() << "# WARNING: " << num_krylov_fallbacks << " secondary failure systems had non-finite values and were solved directly." << std::endl;
+    }
+
+    if (num_singular_solves > 0) {
+        sim->console() << "# WARNING: " << num_singular_solves << " secondary failure systems were singular." << std::endl;
+    }
+}
@@ -19,6 +19,8 @@
 // DEALINGS IN THE SOFTWARE.
 
 #include "Simulation.h"
+#include "DenseSolver.h"
+#include "KDTree.h"
 #include <math.h>
 
 #ifndef _RUN_EVENT_H_
@@ -32,17 +34,49 @@ class RunEvent : public SimPlugin {
     private:
         quakelib::ElementIDSet          local_failed_elements;
         BlockIDProcMapping              global_failed_elements;
+        //! Blocks that failed again in the secondary failure calculation of the current sweep
+        BlockIDProcMapping              global_secondary_elements;
         // Schultz: Removing this for now, VC did not use this.
         //quakelib::ElementIDSet  loose_elements;
         unsigned int                    sweep_num;
         quakelib::ElementIDSet          all_event_blocks;
         double                          current_event_area;
 
+        // Statistics on the secondary failure slip solves
+        unsigned int                    num_solves;
+        unsigned int                    max_solve_dim;
+        unsigned int                    num_singular_solves;
+        double                          total_solve_time;
+        double                          max_solve_time;
+        unsigned int                    num_krylov_solves;
+        unsigned int                    num_unconverged_solves;
+        unsigned int                    num_krylov_fallbacks;
+        unsigned int                    max_krylov_iters;
+        unsigned long                   total_krylov_iters;
+        unsigned int                    num_incremental_solves;
+
+        // Slip of each local block in the latest secondary failure solve of this event
+        std::map<BlockID, double>       secondary_slips;
+
+        // Centers of all blocks, used on the root node to find the blocks nearest to aftershocks
+        KDTree                          block_centers;
+
+        // LU factors of the latest direct secondary failure solve of this event, and the block of each row
+        IncrementalLU                   slip_factors;
+        std::vector<BlockID>            factor_ids;
+
+        void solveSlips(Simulation *sim, const int &n, double *x, double *A, double *b);
+        void solveSlipsIncremental(Simulation *sim, const int &n, double *x, const double *A, const double *b);
+        void recordSolve(Simulation *sim, const int &n, const double &solve_time);
+        void solveSecondaryDirect(Simulation *sim, const quakelib::ElementIDSet &local_ids, double *x);
+        bool solveSecondaryKrylov(Simulation *sim, const quakelib::ElementIDSet &local_ids, double *x);
+
         void processBlocksOrigFail(Simulation *sim, quakelib::ModelSweeps &sweeps);
         void processBlocksSecondaryFailures(Simulation *sim, quakelib::ModelSweeps &sweeps);
         void processBlocksSecondaryFailuresCellularAutomata(Simulation *sim, quakelib::ModelSweeps &sweeps);
         virtual void markBlocks2Fail(Simulation *sim, const FaultID &trigger_fault);
         void recordEventStresses(Simulation *sim);
+        void applySlipChanges(Simulation *sim, const BlockIDProcMapping &slipped_elements);
 
         void processStaticFailure(Simulation *sim);
         void processAftershock(Simulation *sim);
@@ -55,9 +89,9 @@ class RunEvent : public SimPlugin {
         virtual bool needsTimer(void) const {
             return true;
         };
+        virtual void init(SimFramework *_sim);
         virtual SimRequest run(SimFramework *_sim);
+        virtual void finish(SimFramework *_sim);
 };
 
-void solve_it(int n, double *x, double *A, double *b);
-
 #endif
@@ -20,6 +20,10 @@
 
 #include "UpdateBlockStress.h"
 
+// Number of per-block fields restored from a stress file and exchanged between nodes at startup
+#define RESTART_FIELDS          3
+#define BLOCK_FIELDS            4
+
 /*!
  Initialize the stress calculation by setting initial block slip and stresses
  then calculating the stress in the whole system.
@@ -34,9 +38,19 @@ void UpdateBlockStress::init(SimFramework *_sim) {
     double depth = 0.0;         //
     quakelib::ModelStressSet    stress_set;
     quakelib::ModelStress       stress;
+    std::vector<double>         restart_fields, block_fields;
+    double                      *fields;
 
     sim = static_cast<Simulation *>(_sim);
-    tmpBuffer = new double[sim->numGlobalBlocks()];
+    shearRate = new double[sim->numGlobalBlocks()];
+    normalRate = new double[sim->numGlobalBlocks()];
+    cffRate = new double[sim->numGlobalBlocks()];
+    ratesValid = false;
+    heapValid = false;
+
+    // Slip deficit, initial shear and initial normal stress read from the stress file,
+    // NaN for blocks without a stored state
+    restart_fields.assign(sim->numGlobalBlocks()*RESTART_FIELDS, std::numeric_limits<double>::quiet_NaN());
 
     // Read the stress input file for initial stress conditions on the root node
     if (sim->isRootNode()) {
@@ -82,24 +96,27 @@ void UpdateBlockStress::init(SimFramework *_sim) {
             // If given an initial stress state, set those stresses and slip deficits.
             // Schultz: The slip deficit is really the only information used to start the sim, as we
             // recalculate stresses at the end of this init() based on slip deficits.
+            // We need to broadcast these values to the other nodes
             for (i=0; i<stress.size(); ++i) {
-                sim->setInitShearNormalStress(stress[i]._element_id, stress[i]._shear_stress, stress[i]._normal_stress);
-                sim->setSlipDeficit(stress[i]._element_id, stress[i]._slip_deficit);
-                // We need to broadcast these values to the other nodes
-                sim->setUpdateField(stress[i]._element_id, stress[i]._slip_deficit);
+                fields = &restart_fields[stress[i]._element_id*RESTART_FIELDS];
+                fields[0] = stress[i]._slip_deficit;
+                fields[1] = stress[i]._shear_stress;
+                fields[2] = stress[i]._normal_stress;
             }
 
         }
     }
 
-    // Broadcast the slip deficits from root node to all nodes
-    sim->broadcastUpdateField();
+    // Broadcast the stored state from root node to all nodes
+    sim->broadcastBlockFields(restart_fields.data(), RESTART_FIELDS);
 
-    // And update the slip deficit on each process to take this into account
+    // And update the state on each process to take this into account
     for (gid=0; gid<sim->numGlobalBlocks(); ++gid) {
-        // If we haven't loaded slip deficits, updateField is NaN so set slip deficit to zero in that case
-        sim->setSlipDeficit(gid, isnan(sim->getUpdateField(gid)) ? 0.0 : sim->getUpdateField(gid));
-        //std::cout << gid << "  slip deficit: " << sim->getSlipDeficit(gid) << std::endl;
+        fields = &restart_fields[gid*RESTART_FIELDS];
+        // If we haven't loaded slip deficits, the field is NaN so set slip deficit to zero in that case
+        sim->setSlipDeficit(gid, isnan(fields[0]) ? 0.0 : fields[0]);
+
+        if (!isnan(fields[0])) sim->setInitShearNormalStress(gid, fields[1], fields[2]);
     }
 
     // Schultz: Now, stress drop computation has moved to the mesher. Here we just read in the
@@ -128,41 +145,35 @@ void UpdateBlockStress::init(SimFramework *_sim) {
         }
     }
 
+    // The Greens values are final at this point, so quantized matrices can be built
+    sim->quantizeGreens();
+
 #ifdef MPI_C_FOUND
 
-    // Transfer stress drop values between nodes
-    // also broadcast the rhogd value.
-    // note that the array rhogd[] is a protected array, so we cannot access it directly (aka, using MPI_Reduce with a custom mpi funciton to
-    // gather/add/whatever, but handle nan), but since this only runs once at the sim initialization, it's not a huge problem.
-    for (gid=0; gid<sim->numGlobalBlocks(); ++gid) {
-        // initialize these to avoid memcheck errors:
-        double       stress_drop=std::numeric_limits<float>::quiet_NaN();
-        double       max_stress_drop=std::numeric_limits<float>::quiet_NaN();
-        double       tmp_rhogd = std::numeric_limits<float>::quiet_NaN();
-        double       slip_deficit = std::numeric_limits<float>::quiet_NaN();
+    // Transfer the stress drop, max stress drop, slip deficit and rhogd values
+    // of each block from the node that owns it to all other nodes.
+    // The fields of all blocks are packed and exchanged in one collective.
+    block_fields.assign(sim->numGlobalBlocks()*BLOCK_FIELDS, std::numeric_limits<double>::quiet_NaN());
 
-        if (sim->isLocalBlockID(gid)) {
-            stress_drop = sim->getStressDrop(gid);
-            max_stress_drop = sim->getMaxStressDrop(gid);
-            //
-            tmp_rhogd = sim->getRhogd(gid);
-            slip_deficit = sim->getSlipDeficit(gid);
-        }
+    for (lid=0; lid<sim->numLocalBlocks(); ++lid) {
+        gid = sim->getGlobalBID(lid);
+        fields = &block_fields[gid*BLOCK_FIELDS];
+        fields[0] = sim->getStressDrop(gid);
+        fields[1] = sim->getMaxStressDrop(gid);
+        fields[2] = sim->getSlipDeficit(gid);
+        fields[3] = sim->getRhogd(gid);
+    }
 
-        //
-        MPI_Bcast(&stress_drop, 1, MPI_DOUBLE, sim->getBlockNode(gid), MPI_COMM_WORLD);
-        MPI_Bcast(&max_stress_drop, 1, MPI_DOUBLE, sim->getBlockNode(gid), MPI_COMM_WORLD);
-        MPI_Bcast(&slip_deficit, 1, MPI_DOUBLE, sim->getBlockNode(gid), MPI_COMM_WORLD);
-        //
-        MPI_Bcast(&tmp_rhogd, 1, MPI_DOUBLE, sim->getBlockNode(gid), MPI_COMM_WORLD);
+    sim->allGatherBlockFields(block_fields.data(), BLOCK_FIELDS);
 
-        //
+    for (gid=0; gid<sim->numGlobalBlocks(); ++gid) {
         if (!sim->isLocalBlockID(gid)) {
-            sim->setStressDrop(gid, stress_drop);
-            sim->setMaxStressDrop(gid, max_stress_drop);
+            fields = &block_fields[gid*BLOCK_FIELDS];
+            sim->setStressDrop(gid, fields[0]);
+            sim->setMaxStressDrop(gid, fields[1]);
             //
-            sim->setRhogd(gid, tmp_rhogd);
-            sim->setSlipDeficit(gid, slip_deficit);
+            sim->setRhogd(gid, fields[3]);
+            sim->setSlipDeficit(gid, fields[2]);
         }
     }
 
@@ -174,20 +185,26 @@ void UpdateBlockStress::init(SimFramework *_sim) {
 }
 
 /*!
- Calculate the stress on all blocks and determine which block will be
- the next to fail and when it will fail. Use this to determine the
- slipDeficit on all blocks at the time of failure. Finally, use the
- new slipDeficit to recalculate the stress on all blocks at the time of failure.
+ Determine which block will be the next to fail and when it will fail.
+ Use this to determine the slipDeficit on all blocks at the time of failure.
+ Since tectonic loading is linear in time, the stresses at the time of failure
+ are found from the cached stress rates rather than recalculated from the
+ slip deficits. The stresses at the start of this step were already computed
+ from the slip deficits at the end of init() or of the previous event.
  */
 SimRequest UpdateBlockStress::run(SimFramework *_sim) {
     // Put a stress load on all blocks and determine which block will fail first
     int                     lid;
+    double                  dt;
     BlockVal                next_static_fail, next_aftershock, next_event, next_event_global;
     quakelib::Conversion    convert;
     quakelib::ModelEvent    new_event;
 
-    // Calculate the current rates of stress change on all blocks
-    stressRecompute();
+    // Make sure the rates of stress change are up to date
+    if (!ratesValid || ratesVersion != sim->getGreensVersion()) {
+        computeStressRates();
+        heapValid = false;
+    }
 
     // Given the rates of change, determine which block will fail next
     nextStaticFailure(next_static_fail);
@@ -213,18 +230,23 @@ SimRequest UpdateBlockStress::run(SimFramework *_sim) {
     if (sim->isRootNode()) assertThrow(next_event_global.val < DBL_MAX, "System stuck, no blocks to move.");
 
     // Increment the simulation year to the next failure time and
-    // update the slip on all other blocks
+    // update the slip and stress on all other blocks
     sim->incrementYear(next_event_global.val);
+    dt = convert.year2sec(next_event_global.val);
 
+    // Recompute the CFF on blocks based on the new shear/normal stresses
     for (lid=0; lid<sim->numLocalBlocks(); ++lid) {
-        BlockID gid = sim->getGlobalBID(lid);
-        Block &local_block = sim->getBlock(gid);
+        BlockID gid = sim->localGID(lid);
         double cur_slip_deficit = sim->getSlipDeficit(gid);
-        sim->setSlipDeficit(gid, cur_slip_deficit-local_block.slip_rate()*convert.year2sec(next_event_global.val)*(1.0-local_block.aseismic()));
+        sim->setSlipDeficit(gid, cur_slip_deficit-sim->localSlipRate(lid)*dt*(1.0-sim->localAseismic(lid)));
+        sim->setShearStress(gid, sim->getShearStress(gid)+shearRate[gid]*dt);
+        sim->setNormalStress(gid, sim->getNormalStress(gid)+normalRate[gid]*dt);
+        sim->calcCFF(gid);
     }
 
-    // Recalculate the stress on all blocks with the new slip deficits
-    stressRecompute();
+    // Loading leaves the failure years unchanged, so only CFF changes made
+    // by the coming event should cause blocks to be rekeyed
+    sim->clearChangedCFFs();
 
     // Record the current event
     new_event.setEventTriggerOnThisNode(next_event_global.block_id==next_static_fail.block_id);
@@ -251,60 +273,114 @@ void UpdateBlockStress::nextAftershock(BlockVal &next_aftershock) {
     next_aftershock.block_id = UNDEFINED_ELEMENT_ID;
 }
 
+// Fraction of the local blocks above which changed failure years are
+// applied by rebuilding the heap in O(N) rather than one update at a time
+#define HEAP_REBUILD_FRACTION   0.05
+
+// Width of the window of failure years, relative to the year, in which blocks
+// are checked exactly when finding the next static failure
+#define FAILURE_YEAR_WINDOW     1e-9
+
 /*!
  Determine the next time step in the simulation when a failure occurs.
  Return the block ID of the block responsible for the failure and the timestep until the failure.
  */
 void UpdateBlockStress::nextStaticFailure(BlockVal &next_static_fail) {
-    BlockList::iterator     it;
-    double                  ts;
+    std::vector<double>     keys;
+    std::vector<int>        ids, candidates;
+    double                  ts, min_key;
     BlockID                 gid;
-    int                     lid;
-    quakelib::Conversion    convert;
+    int                     lid, i;
 
-    // Schultz: The temp buffer will collect the dCFF/dt values by multiplying the
-    ///     Greens function matrices by the effective slip rates (aka the update field).
-    ///     The matrixVectorMultiplyAccum() multiplies matrices and adds the result to tmpBuffer.
-    /////////////////////
-    for (it=sim->begin(); it!=sim->end(); ++it) {
-        tmpBuffer[it->getBlockID()] = 0.0;
+    const std::vector<int>  &changed = sim->changedCFFs();
 
-        // Set the update field to be the slip rate of each block (note: these are local blockID values.)
-        // Schultz: Since aseismic fraction limits the effective slip rate, we must include it here
-        sim->setUpdateField(it->getBlockID(), it->slip_rate()*(1.0 - it->aseismic()));
+    // Between events the loading is linear in time, so the year each block will fail
+    // stays the same. Only blocks whose CFF was changed since the last loading step
+    // need new keys. If many changed, as after a full stress recompute, rebuild the heap.
+    if (!heapValid || changed.size() > HEAP_REBUILD_FRACTION*sim->numLocalBlocks()) {
+        for (lid=0; lid<sim->numLocalBlocks(); ++lid) {
+            keys.push_back(failureYear(lid));
+            ids.push_back(sim->localGID(lid));
+        }
+
+        failHeap.init(keys, ids);
+        heapValid = true;
+    } else {
+        for (i=0; i<(int)changed.size(); ++i) failHeap.update(changed[i], failureYear(changed[i]));
     }
 
-    // update the temporary buffer with the Greens function applied to the block slip rates
-    sim->matrixVectorMultiplyAccum(tmpBuffer,
-                                   sim->greenShear(),
-                                   sim->getUpdateFieldPtr(),
-                                   true);
+    sim->clearChangedCFFs();
 
-    //
-    if (sim->doNormalStress()) {
-        for (it=sim->begin(); it!=sim->end(); ++it) {
-            BlockID gid = it->getBlockID();
-            // Schultz: Since aseismic fraction limits the effective slip rate, we must include it here
-            sim->setUpdateField(gid, -sim->getFriction(gid)*it->slip_rate()*(1.0 - it->aseismic()));
-        }
+    next_static_fail.val = DBL_MAX;
+    next_static_fail.block_id = UNDEFINED_ELEMENT_ID;
 
-        sim->matrixVectorMultiplyAccum(tmpBuffer,
-                                       sim->greenNormal(),
-                                       sim->getUpdateFieldPtr(),
-                                       true);
+    if (failHeap.size() == 0 || failHeap.key(failHeap.top()) >= DBL_MAX) return;
+
+    // The keys carry rounding from the year they were computed in, so every block
+    // failing within a small window of the earliest is checked with the same time to
+    // failure and tie breaking as a full scan
+    min_key = failHeap.key(failHeap.top());
+    failHeap.itemsUpTo(min_key + FAILURE_YEAR_WINDOW*(1+fabs(min_key)), candidates);
+
+    for (i=0; i<(int)candidates.size(); ++i) {
+        gid = sim->localGID(candidates[i]);
+        ts = timeToFailure(gid);
+
+        if (ts <= 0) continue;
+
+        if (ts < next_static_fail.val) {
+            next_static_fail.block_id = gid;
+            next_static_fail.val = ts;
+        } else if (ts == next_static_fail.val) {
+            next_static_fail.block_id = (gid < next_static_fail.block_id ? gid : next_static_fail.block_id);
+        }
     }
 
+    // If rounding moved every candidate past its failure point, fall back to checking all blocks
+    if (next_static_fail.block_id == UNDEFINED_ELEMENT_ID) nextStaticFailureScan(next_static_fail);
+}
+
+/*!
+ Time in years until the local block fails under tectonic loading.
+ */
+double UpdateBlockStress::timeToFailure(const BlockID &gid) const {
+    quakelib::Conversion    convert;
+
+    // The CFF changes linearly in time, so the time until it reaches zero has a closed form.
+    // Since slip rates are in meters/sec, must convert the answer for time to years
+    return convert.sec2year(-sim->getCFF(gid)/cffRate[gid]);
+}
+
+/*!
+ Simulation year the local block will fail if only tectonic loading acts on it,
+ or DBL_MAX if it never fails. This is the key of the block in failHeap.
+ */
+double UpdateBlockStress::failureYear(const int &lid) const {
+    double  ts = timeToFailure(sim->localGID(lid));
+
+    // Also excludes blocks that never fail (infinite or undefined times)
+    if (!(ts > 0 && ts < DBL_MAX)) return DBL_MAX;
+
+    return sim->getYear() + ts;
+}
+
+/*!
+ Find the next static failure by checking the time to failure of every local block.
+ */
+void UpdateBlockStress::nextStaticFailureScan(BlockVal &next_static_fail) {
+    double                  ts;
+    BlockID                 gid;
+    int                     lid;
+
     //
     // Go through the blocks and find which one will fail first
     next_static_fail.val = DBL_MAX;
     next_static_fail.block_id = UNDEFINED_ELEMENT_ID;
 
     for (lid=0; lid<sim->numLocalBlocks(); ++lid) {
-        gid = sim->getGlobalBID(lid);
-        //Block &block = sim->getBlock(gid);
+        gid = sim->localGID(lid);
 
-        // Since slip rates are in meters/sec, must convert the answer for time to years
-        ts = convert.sec2year(sim->getCFF(gid)/tmpBuffer[gid]);
+        ts = timeToFailure(gid);
 
         // Schultz: There is no reason to treat elements with aseismic > 0 differently. We just
         //   use the aseismic fraction to give elements an effective slip rate of rate*(1-aseismic).
@@ -315,12 +391,12 @@ void UpdateBlockStress::nextStaticFailure(BlockVal &next_static_fail) {
         // differential equation d(cff)/dt = rate_of_stress_change + cff*aseismic_frac*self_shear/recurrence
         //if (block.aseismic() > 0) {
         //    double      A, B, K;
-        //    A = -tmpBuffer[gid];
+        //    A = cffRate[gid];
         //    B = -block.aseismic()*sim->getSelfStresses(gid)/sim->getRecurrence(gid);
         //    K = -log(A+B*sim->getCFF(gid))/B;
         //    ts = K + log(A)/B;
         //} else {
-        //    ts = convert.sec2year(sim->getCFF(gid)/tmpBuffer[gid]);
+        //    ts = convert.sec2year(-sim->getCFF(gid)/cffRate[gid]);
         //}
 
         // Blocks with negative timesteps are skipped. These effectively mean the block
@@ -346,42 +422,74 @@ void UpdateBlockStress::nextStaticFailure(BlockVal &next_static_fail) {
 }
 
 /*!
- Recompute the stress on each block based on the slip deficits of all the other blocks.
+ Compute the rate of shear and normal stress change on each local block due to tectonic loading.
+ The slip deficit of each block decreases at its effective slip rate, so the stress rates
+ are the Greens matrices applied to the negative effective slip rates. These only depend
+ on the Greens values, slip rates and friction, so they are recomputed only when the Greens
+ values change.
+ The CFF rate used to find the failure time weights the normal stress contribution by the
+ friction of the source block, as the failure time calculation always has.
  */
-void UpdateBlockStress::stressRecompute(void) {
+void UpdateBlockStress::computeStressRates(void) {
     BlockList::iterator it;
 
-    // Reset the shear and normal stress, and set the update field to be the slip deficit
     for (it=sim->begin(); it!=sim->end(); ++it) {
         BlockID gid = it->getBlockID();
-        sim->setShearStress(gid, 0.0);
-        sim->setNormalStress(gid, sim->getRhogd(gid));
-        sim->setUpdateField(gid, sim->getSlipDeficit(gid));
+        shearRate[gid] = normalRate[gid] = cffRate[gid] = 0.0;
+
+        // Set the update field to be the slip rate of each block
+        // Schultz: Since aseismic fraction limits the effective slip rate, we must include it here
+        sim->setUpdateField(gid, -it->slip_rate()*(1.0 - it->aseismic()));
     }
 
-    // Distribute the new update field over all nodes
-    // (MPI_ calls when MPI enabled)
-    sim->distributeUpdateField();
+    sim->stressMatrixVectorMultiplyAccum(shearRate,
+                                         normalRate,
+                                         sim->getUpdateFieldPtr(),
+                                         true);
 
-    // Multiply the Greens shear function by the slipDeficit vector
-    // to get shear on local blocks
-    sim->matrixVectorMultiplyAccum(sim->getShearStressPtr(),
-                                   sim->greenShear(),
-                                   sim->getUpdateFieldPtr(),
-                                   true);
+    // The CFF rate is the shear rate minus the normal rate weighted by friction
+    for (it=sim->begin(); it!=sim->end(); ++it) {
+        BlockID gid = it->getBlockID();
+        cffRate[gid] = shearRate[gid];
+        sim->setUpdateField(gid, sim->getFriction(gid)*it->slip_rate()*(1.0 - it->aseismic()));
+    }
 
     if (sim->doNormalStress()) {
-        sim->matrixVectorMultiplyAccum(sim->getNormalStressPtr(),
+        sim->matrixVectorMultiplyAccum(cffRate,
                                        sim->greenNormal(),
                                        sim->getUpdateFieldPtr(),
                                        true);
     }
 
-    // Recompute the CFF on blocks based on the new shear/normal stresses
-    sim->computeCFFs();
+    ratesVersion = sim->getGreensVersion();
+    ratesValid = true;
+}
+
+/*!
+ Recompute the stress on each block based on the slip deficits of all the other blocks.
+ */
+void UpdateBlockStress::stressRecompute(void) {
+    BlockList::iterator it;
+
+    // Reset the shear and normal stress, and set the update field to be the slip deficit
+    for (it=sim->begin(); it!=sim->end(); ++it) {
+        BlockID gid = it->getBlockID();
+        sim->setShearStress(gid, 0.0);
+        sim->setNormalStress(gid, sim->getRhogd(gid));
+        sim->setUpdateField(gid, sim->getSlipDeficit(gid));
+    }
+
+    // Distribute the new update field over all nodes (MPI_ calls when MPI enabled)
+    // and multiply the Greens shear and normal functions by the slipDeficit vector
+    // to get the stresses and CFFs on local blocks
+    sim->distributeUpdateFieldAndStresses();
 
 }
 
 void UpdateBlockStress::finish(SimFramework *_sim) {
-    delete [] tmpBuffer;
+    sim->printExchangeStats();
+
+    delete [] shearRate;
+    delete [] normalRate;
+    delete [] cffRate;
 }
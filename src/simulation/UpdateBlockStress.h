@@ -19,6 +19,7 @@
 // DEALINGS IN THE SOFTWARE.
 
 #include "Simulation.h"
+#include "IndexedHeap.h"
 
 #ifndef _UPDATE_BLOCK_STRESS_H_
 #define _UPDATE_BLOCK_STRESS_H_
@@ -26,6 +27,8 @@
 /*!
  Calculates the rate of stress change for all local blocks and
  uses this to determine which block will be the next to fail.
+ Loading is linear in time between events, so the stress rates are
+ computed once and the stresses are advanced directly.
  */
 class UpdateBlockStress : public SimPlugin {
     public:
@@ -45,8 +48,19 @@ class UpdateBlockStress : public SimPlugin {
         void nextAftershock(BlockVal &next_aftershock);
         void nextStaticFailure(BlockVal &next_static_fail);
         void stressRecompute(void);
+        void computeStressRates(void);
+        double failureYear(const int &lid) const;
+        double timeToFailure(const BlockID &gid) const;
+        void nextStaticFailureScan(BlockVal &next_static_fail);
 
-        double          *tmpBuffer;
+        //! Rate of shear, normal stress and CFF change on each block due to tectonic loading
+        double          *shearRate, *normalRate, *cffRate;
+        //! Greens version the stress rates were computed with
+        unsigned int    ratesVersion;
+        bool            ratesValid;
+        //! Local blocks ordered by the year they will fail under tectonic loading alone
+        IndexedMinHeap      failHeap;
+        bool                heapValid;
         Simulation    *sim;
 };
 